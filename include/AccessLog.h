@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace motioncam {
+
+// A read of a file as it was recorded
+struct AccessRecord {
+    uint32_t source;        // Index into AccessLogContents::sources
+    uint32_t entry;         // Index into AccessLogContents::entries
+    uint64_t offset;
+    uint32_t length;
+    uint32_t thread;        // Threads are numbered in the order they first read
+    int64_t timestampNs;    // Time since recording started
+};
+
+struct AccessLogContents {
+    std::vector<std::string> sources;   // Files the reads went to
+    std::vector<std::string> entries;   // Paths of the files within the mount
+    std::vector<AccessRecord> reads;    // In the order they were recorded
+};
+
+// Records every read of the virtual file systems to a compact binary log, so the access
+// pattern of a player can be replayed offline. Off by default, a read then only costs an
+// atomic load.
+class AccessLog {
+public:
+    static bool isRecording() {
+        return sRecording.load(std::memory_order_relaxed);
+    }
+
+    // Starts recording to path, replacing the file. Throws if it can't be created.
+    static void start(const std::string& path);
+    static void stop();
+
+    static void record(const std::string& srcPath, const std::string& entryPath, uint64_t offset, uint64_t length);
+
+    // Reads a log written by a recording. A record cut short at the end, e.g. by a crash, is
+    // ignored. Throws if the file is not an access log.
+    static AccessLogContents load(const std::string& path);
+
+private:
+    static inline std::atomic_bool sRecording{false};
+};
+
+} // namespace motioncam
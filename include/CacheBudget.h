@@ -0,0 +1,46 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace motioncam {
+
+class LRUCache;
+
+struct MemoryStatus {
+    size_t totalBytes;
+    size_t availableBytes;
+    float pressure; // Percentage of time stalled on memory (Linux PSI), 0 when unavailable
+};
+
+MemoryStatus getMemoryStatus();
+
+// Keeps the capacity of the render cache in line with the configured budget. In adaptive
+// mode the capacity grows towards a fraction of the free physical memory and is reduced
+// step by step when the system reports memory pressure.
+class CacheBudget {
+public:
+    CacheBudget(LRUCache& cache, size_t sizeBytes, bool adaptive);
+    ~CacheBudget();
+
+    CacheBudget(const CacheBudget&) = delete;
+    CacheBudget& operator=(const CacheBudget&) = delete;
+
+    void configure(size_t sizeBytes, bool adaptive);
+
+private:
+    void run();
+    void update();
+
+private:
+    LRUCache& mCache;
+    size_t mSizeBytes;
+    bool mAdaptive;
+    bool mStop;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::thread mThread;
+};
+
+} // namespace motioncam
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Metrics.h"
+
+#include <memory>
+#include <vector>
+
+namespace motioncam {
+
+struct CompressionStats {
+    size_t uncompressedBytes;
+    size_t compressedBytes;
+    double compressMs;      // Total time spent compressing
+    double decompressMs;    // Total time spent decompressing
+    size_t numCompressed;
+    size_t numBlocksDecompressed;
+};
+
+// Contents of a rendered file held in the LRUCache. The data is either kept as is or split
+// into fixed size blocks that are compressed independently, so a read only has to
+// decompress the blocks it touches.
+class CachedBuffer {
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 256 * 1024;
+
+    explicit CachedBuffer(std::shared_ptr<std::vector<char>> data);
+
+    // Returns a buffer holding the original data when compression does not save memory
+    static std::shared_ptr<CachedBuffer> compress(std::shared_ptr<std::vector<char>> data, size_t blockSize = DEFAULT_BLOCK_SIZE);
+    static CompressionStats getCompressionStats();
+
+    CachedBuffer(const CachedBuffer&) = delete;
+    CachedBuffer& operator=(const CachedBuffer&) = delete;
+
+    // Size of the file
+    size_t size() const { return mSize; }
+
+    // Bytes of memory held by this buffer
+    size_t memoryUsage() const;
+
+    bool isCompressed() const { return !mData; }
+
+    // Contiguous file contents, nullptr if compressed
+    const char* data() const { return mData ? mData->data() : nullptr; }
+
+    // Copy up to len bytes starting at pos into dst, returns the number of bytes copied
+    size_t read(size_t pos, size_t len, void* dst) const;
+
+    // Offset of the DNG time code value, 0 if the file has none. Lets entries that share the
+    // rendered frame patch in their own time code.
+    size_t timeCodeOffset() const { return mTimeCodeOffset; }
+    void setTimeCodeOffset(size_t offset) { mTimeCodeOffset = offset; }
+
+    // Counts the memory of the buffer against a mount for as long as the buffer lives
+    void trackMemory(std::shared_ptr<Metrics> metrics);
+
+private:
+    CachedBuffer();
+
+    size_t readCompressed(size_t pos, size_t len, char* dst) const;
+
+private:
+    size_t mSize;
+    std::shared_ptr<std::vector<char>> mData;
+    std::vector<char> mCompressedData;
+    std::vector<size_t> mBlockOffsets;  // Start of each compressed block, plus the end
+    size_t mBlockSize;
+    size_t mTimeCodeOffset;
+    TrackedMemory mTrackedMemory;
+};
+
+} // namespace motioncam
@@ -4,6 +4,7 @@
 #include <vector>
 #include <string>
 #include <array>
+#include <memory>
 
 namespace motioncam {
 
@@ -15,6 +16,25 @@ enum class ScreenOrientation : int {
     INVALID
 };
 
+// Lens shading gains, one width x height plane per channel stored one after the other.
+// Frames with the same gains share one immutable map.
+struct ShadingMap {
+    int width;
+    int height;
+    int numChannels;
+    std::vector<float> gains;
+    std::vector<float> normalizedGains;     // Gains divided by the largest gain
+    size_t hash;
+
+    const float* channel(int c, bool normalized) const {
+        return (normalized ? normalizedGains.data() : gains.data()) + static_cast<size_t>(c) * width * height;
+    }
+
+    // The map in use with the same size and gains, compared in full, otherwise a new one.
+    // Null if gains doesn't hold a whole number of width x height planes.
+    static std::shared_ptr<const ShadingMap> intern(int width, int height, std::vector<float> gains);
+};
+
 struct CameraFrameMetadata {
     std::array<float, 3> asShotNeutral;
     int compressionType;
@@ -27,9 +47,7 @@ struct CameraFrameMetadata {
     bool isBinned;
     bool isCompressed;
     int iso;
-    std::vector<std::vector<float>> lensShadingMap;
-    int lensShadingMapHeight;
-    int lensShadingMapWidth;
+    std::shared_ptr<const ShadingMap> lensShadingMap;     // Null if the frame has none
     bool needRemosaic;
     std::string offset;
     ScreenOrientation orientation;
@@ -44,6 +62,10 @@ struct CameraFrameMetadata {
 
     static CameraFrameMetadata parse(const std::string& jsonString);
     static CameraFrameMetadata parse(const nlohmann::json& j);
+
+    // Reads only what is needed to render the frame, in one pass over the metadata. The
+    // other fields are left empty.
+    static CameraFrameMetadata parseForRender(const nlohmann::json& j);
 };
 
 }
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "CameraFrameMetadata.h"
+#include "Metrics.h"
+
+#include <spdlog/spdlog.h>
+
+namespace motioncam {
+
+// Raw frame as read from the container, before any render options are applied
+struct DecodedFrame {
+    std::vector<uint8_t> data;
+    CameraFrameMetadata metadata;
+    TrackedMemory memory;   // Counted against the mount that decoded the frame
+};
+
+// Bounded cache of decoded frames, shared by all mounts. Sits between the decoder and the
+// DNG cache so that re-rendering with different options does not touch the container.
+class DecodedFrameCache {
+public:
+    struct Key {
+        std::string srcPath;
+        int64_t timestamp;
+
+        bool operator==(const Key& other) const {
+            return timestamp == other.timestamp && srcPath == other.srcPath;
+        }
+
+        struct Hash {
+            size_t operator()(const Key& key) const {
+                size_t hash = std::hash<std::string>{}(key.srcPath);
+                hash ^= std::hash<int64_t>{}(key.timestamp) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+                return hash;
+            }
+        };
+    };
+
+    explicit DecodedFrameCache(size_t maxSize) : mMaxSize(maxSize), mCurrentSize(0) {}
+
+    // Get value from cache, returns nullptr if not found.
+    // Same contract as LRUCache::get(), a miss marks the key as in progress and the caller
+    // must call put() or markLoadFailed().
+    std::shared_ptr<const DecodedFrame> get(const Key& key, std::chrono::milliseconds timeout = std::chrono::seconds(2)) {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        bool success = mCondition.wait_for(lock, timeout, [this, &key] {
+            return mInProgress.find(key) == mInProgress.end();
+        });
+
+        if (!success) {
+            spdlog::warn("Timeout waiting for frame {} to be decoded by another thread", key.timestamp);
+            return nullptr;
+        }
+
+        auto it = mCacheMap.find(key);
+        if (it == mCacheMap.end()) {
+            mInProgress.insert(key);
+            return nullptr;
+        }
+
+        mCacheList.splice(mCacheList.begin(), mCacheList, it->second);
+
+        return it->second->second;
+    }
+
+    // Non-blocking variant for decoding ahead. Returns true if the key is neither cached nor
+    // being decoded, in which case it is marked as in progress.
+    bool beginPrefetch(const Key& key) {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if (mCacheMap.find(key) != mCacheMap.end() || mInProgress.find(key) != mInProgress.end())
+            return false;
+
+        mInProgress.insert(key);
+
+        return true;
+    }
+
+    void put(const Key& key, std::shared_ptr<const DecodedFrame> value) {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        const size_t valueSize = value->data.size();
+
+        auto it = mCacheMap.find(key);
+        if (it != mCacheMap.end()) {
+            mCurrentSize -= it->second->second->data.size();
+            mCacheList.erase(it->second);
+            mCacheMap.erase(it);
+        }
+
+        evict(mMaxSize > valueSize ? mMaxSize - valueSize : 0);
+
+        if (valueSize <= mMaxSize) {
+            mCacheList.emplace_front(key, std::move(value));
+            mCacheMap[key] = mCacheList.begin();
+            mCurrentSize += valueSize;
+        }
+
+        mInProgress.erase(key);
+        mCondition.notify_all();
+    }
+
+    void markLoadFailed(const Key& key) {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        mInProgress.erase(key);
+        mCondition.notify_all();
+    }
+
+    void resize(size_t maxSize) {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        mMaxSize = maxSize;
+
+        evict(mMaxSize);
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        return mCurrentSize;
+    }
+
+    size_t capacity() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        return mMaxSize;
+    }
+
+private:
+    // Caller must hold the lock
+    void evict(size_t targetSize) {
+        while (!mCacheList.empty() && mCurrentSize > targetSize) {
+            auto& last = mCacheList.back();
+            mCurrentSize -= last.second->data.size();
+            mCacheMap.erase(last.first);
+            mCacheList.pop_back();
+        }
+    }
+
+private:
+    using CacheItem = std::pair<Key, std::shared_ptr<const DecodedFrame>>;
+    using CacheList = std::list<CacheItem>;
+    using CacheMap = std::unordered_map<Key, CacheList::iterator, Key::Hash>;
+
+    CacheList mCacheList;
+    CacheMap mCacheMap;
+    std::unordered_set<Key, Key::Hash> mInProgress;
+    size_t mMaxSize;
+    size_t mCurrentSize;
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+};
+
+} // namespace motioncam
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "Types.h"
+
+namespace motioncam {
+
+struct ExportProgress {
+    int64_t totalFrames;
+    int64_t framesDone;         // Written in this run or left over from a previous one
+    int64_t framesWritten;      // Written in this run
+    size_t bytesWritten;
+    double elapsedSeconds;
+    double framesPerSecond;     // Sustained over this run
+    double megabytesPerSecond;
+};
+
+// Renders every frame of an MCRAW file into a folder of DNG files, named as they appear in
+// a mount. Decoding, rendering and writing run as a pipeline with bounded queues in between
+// so that memory use stays flat however far the writers fall behind. Frames already in the
+// folder are skipped, an interrupted export picks up where it stopped.
+class Exporter {
+public:
+    // Thread counts of 0 use the defaults
+    Exporter(
+        const std::string& srcFile,
+        const std::string& dstFolder,
+        FileRenderOptions options,
+        int draftScale,
+        unsigned int decodeThreads = 0,
+        unsigned int renderThreads = 0,
+        unsigned int writerThreads = 0);
+
+    Exporter(const Exporter&) = delete;
+    Exporter& operator=(const Exporter&) = delete;
+
+    // Blocks until all frames are written or the export is cancelled. onProgress is called
+    // from this thread about twice a second. Throws if a frame can't be read or written.
+    ExportProgress run(std::function<void(const ExportProgress&)> onProgress = nullptr);
+
+    // Can be called from any thread, including from onProgress
+    void cancel();
+    bool isCancelled() const { return mCancelled; }
+
+private:
+    std::string mSrcFile;
+    std::string mDstFolder;
+    FileRenderOptions mOptions;
+    int mDraftScale;
+    unsigned int mDecodeThreads;
+    unsigned int mRenderThreads;
+    unsigned int mWriterThreads;
+    std::atomic_bool mCancelled;
+};
+
+} // namespace motioncam
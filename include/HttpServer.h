@@ -0,0 +1,52 @@
+#ifndef HTTPSERVER_H
+#define HTTPSERVER_H
+
+#include <QHash>
+#include <QHostAddress>
+#include <QObject>
+#include <QString>
+
+#include <memory>
+
+class QTcpServer;
+
+namespace BS {
+    class thread_pool;
+}
+
+namespace motioncam {
+    class IVirtualFileSystem;
+}
+
+// Serves mounted files over HTTP/1.1 for tools that can't use a mount. Each file system is
+// a directory named after its file, frames are read in chunks through readFile() so that
+// responses come from the same cache as the mounts. Reads run on a pool of the server's own,
+// never on the thread of the event loop. Supports HEAD, single Range requests
+// and keep-alive, and answers any number of connections at once.
+class HttpServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit HttpServer(QObject* parent = nullptr);
+    ~HttpServer();
+
+    bool listen(const QHostAddress& address, quint16 port);
+    quint16 serverPort() const;
+
+    void addFileSystem(const QString& name, std::shared_ptr<motioncam::IVirtualFileSystem> fs);
+    void removeFileSystem(const QString& name);
+
+    std::shared_ptr<motioncam::IVirtualFileSystem> getFileSystem(const QString& name) const;
+    QStringList fileSystemNames() const;
+
+private:
+    void onNewConnection();
+
+private:
+    QTcpServer* mServer;
+    std::unique_ptr<BS::thread_pool> mIoThreadPool;
+    QHash<QString, std::shared_ptr<motioncam::IVirtualFileSystem>> mFileSystems;
+};
+
+#endif // HTTPSERVER_H
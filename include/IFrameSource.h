@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace motioncam {
+
+typedef int64_t Timestamp;
+typedef std::pair<Timestamp, std::vector<int16_t>> AudioChunk;
+
+// The part of the MCRAW decoder the file systems and the exporter read through. Not thread
+// safe, each thread opens its own.
+class IFrameSource {
+public:
+    virtual ~IFrameSource() = default;
+
+    virtual const std::vector<Timestamp>& getFrames() const = 0;
+    virtual const nlohmann::json& getContainerMetadata() const = 0;
+
+    virtual void loadFrame(const Timestamp timestamp, std::vector<uint8_t>& outData, nlohmann::json& outMetadata) = 0;
+
+    virtual int audioSampleRateHz() const = 0;
+    virtual int numAudioChannels() const = 0;
+    virtual void loadAudio(std::vector<AudioChunk>& outAudioChunks) = 0;
+
+    // Bytes held while the source is open, may be an estimate
+    virtual size_t memoryUsage() const = 0;
+};
+
+// Opens an MCRAW file, or generates a clip in memory for paths starting with
+// SyntheticFrameSource::PATH_PREFIX
+std::unique_ptr<IFrameSource> openFrameSource(const std::string& path);
+
+} // namespace motioncam
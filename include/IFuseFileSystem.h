@@ -1,11 +1,16 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <string>
 
 #include "Types.h"
 
 namespace motioncam {
 
+class IVirtualFileSystem;
+class Metrics;
+
 using MountId = int;
 
 constexpr auto InvalidMountId = -1;
@@ -18,8 +23,30 @@ public:
     IFuseFileSystem& operator=(const IFuseFileSystem&) = delete;
 
     virtual MountId mount(FileRenderOptions options, int draftScale, const std::string& srcFile, const std::string& dstPath) = 0;
+
+    // Mounts every MCRAW file in srcFolder as a subdirectory of dstPath. Clips are opened the
+    // first time they are used and closed again when idle.
+    virtual MountId mountLibrary(FileRenderOptions options, int draftScale, const std::string& srcFolder, const std::string& dstPath) = 0;
+
     virtual void unmount(MountId mountId) = 0;
     virtual void updateOptions(MountId mountId, FileRenderOptions options, int draftScale) = 0;
+    virtual void setCacheSize(size_t sizeBytes, bool adaptive) = 0;
+    virtual void setCacheCompression(bool enabled) = 0;
+
+    // Most memory that frames being rendered may hold at once across all mounts, reads wait
+    // when it is reached. 0 for no limit.
+    virtual void setRenderMemoryLimit(size_t limitBytes) = 0;
+
+    // Render frames of a mounted file into the cache in the background until it is first read
+    virtual void warmCache(MountId mountId, int64_t startFrame, int numFrames) = 0;
+    virtual int64_t lastAccessedFrame(MountId mountId) = 0;
+
+    // File system behind a mounted file, lets other frontends read through the same cache.
+    // nullptr for libraries and unknown mounts.
+    virtual std::shared_ptr<IVirtualFileSystem> getFileSystem(MountId mountId) = 0;
+
+    // Stage latencies and memory of the reads of a mount, nullptr for unknown mounts
+    virtual std::shared_ptr<Metrics> getMetrics(MountId mountId) = 0;
 
 protected:
     IFuseFileSystem() = default;
@@ -2,6 +2,7 @@
 
 #include "Types.h"
 
+#include <memory>
 #include <optional>
 #include <string>
 #include <vector>
@@ -9,6 +10,8 @@
 
 namespace motioncam {
 
+class Metrics;
+
 class IVirtualFileSystem {
 public:
     virtual ~IVirtualFileSystem() = default;
@@ -28,6 +31,9 @@ public:
 
     virtual void updateOptions(FileRenderOptions options, int draftScale) = 0;
 
+    // Latencies and memory of the reads, shared with whatever serves the files
+    virtual std::shared_ptr<Metrics> getMetrics() const = 0;
+
 protected:
     IVirtualFileSystem() = default;
 };
@@ -1,25 +1,66 @@
 #pragma once
 
 #include <vector>
+#include <functional>
 #include <unordered_map>
 #include <unordered_set>
 #include <list>
 #include <mutex>
 #include <memory>
+#include <atomic>
 
 #include "Types.h"
+#include "CachedBuffer.h"
+#include "Logging.h"
 
 #include <spdlog/spdlog.h>
 
 namespace motioncam {
 
+// Identifies the contents of a rendered frame. Entries that show the same frame with the
+// same render settings, such as duplicates covering dropped frames, share one cache entry.
+struct CacheKey {
+    std::string srcPath;
+    int64_t timestamp;
+    FileRenderOptions options;
+    int scale;
+
+    bool operator==(const CacheKey& other) const {
+        return timestamp == other.timestamp &&
+               options == other.options &&
+               scale == other.scale &&
+               srcPath == other.srcPath;
+    }
+
+    struct Hash {
+        size_t operator()(const CacheKey& key) const {
+            size_t hash = std::hash<std::string>{}(key.srcPath);
+
+            hash ^= std::hash<int64_t>{}(key.timestamp) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+            hash ^= std::hash<unsigned int>{}(key.options) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+            hash ^= std::hash<int>{}(key.scale) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+            return hash;
+        }
+    };
+};
+
 class LRUCache {
 public:
-    explicit LRUCache(size_t maxSize) : mMaxSize(maxSize), mCurrentSize(0) {}
+    enum class Lookup {
+        HIT,        // The value was cached
+        MISS,       // The key is now in progress, the caller must put() or markLoadFailed()
+        PENDING     // Another thread is processing the key, onReady will be called
+    };
+
+    // Called with the value once a key in progress is put, or with nullptr if it fails
+    using Waiter = std::function<void(std::shared_ptr<CachedBuffer>)>;
+
+    explicit LRUCache(size_t maxSize) : mMaxSize(maxSize), mCurrentSize(0), mCompressionEnabled(false) {}
 
     // Get value from cache, returns nullptr if not found
     // If another thread is already processing the same key, this thread will wait
-    std::shared_ptr<std::vector<char>> get(const Entry& key, std::chrono::milliseconds timeout = std::chrono::seconds(2)) {
+    std::shared_ptr<CachedBuffer> get(const CacheKey& key, std::chrono::milliseconds timeout = std::chrono::seconds(2)) {
         std::unique_lock<std::mutex> lock(mMutex);
 
         // Wait if another thread is currently processing this key, with timeout
@@ -53,84 +94,110 @@ public:
         return it->second->second;
     }
 
-    // Add or update value in cache
-    void put(const Entry& key, std::shared_ptr<std::vector<char>> value) {
+    // Like get() but never waits. If another thread is processing the key, onReady is called
+    // on the thread that finishes it, after the cache lock has been released.
+    Lookup lookup(const CacheKey& key, std::shared_ptr<CachedBuffer>& value, Waiter onReady) {
         std::lock_guard<std::mutex> lock(mMutex);
 
-        size_t valueSize = value->size();
+        if (mInProgress.find(key) != mInProgress.end()) {
+            mWaiters[key].push_back(std::move(onReady));
+            return Lookup::PENDING;
+        }
 
-        // Check if key already exists in cache
         auto it = mCacheMap.find(key);
-
-        if (it != mCacheMap.end()) {
-            // Update value
-            size_t oldSize = it->second->second->size();
-            mCurrentSize -= oldSize;
-            mCurrentSize += valueSize;
-
-            // Move to front and update
-            mCacheList.splice(mCacheList.begin(), mCacheList, it->second);
-            it->second->second = value;
+        if (it == mCacheMap.end()) {
+            mInProgress.insert(key);
+            return Lookup::MISS;
         }
-        else {
-            // New entry
 
-            // If adding this would exceed max size, remove older entries
-            while (!mCacheList.empty() && (mCurrentSize + valueSize > mMaxSize)) {
-                auto last = mCacheList.back();
-                mCurrentSize -= last.second->size();
-                mCacheMap.erase(last.first);
-                mCacheList.pop_back();
-            }
+        mCacheList.splice(mCacheList.begin(), mCacheList, it->second);
+        value = it->second->second;
 
-            // If the single item is too large for the cache, don't add it
-            if (valueSize > mMaxSize) {
-                // Remove from in-progress set and notify waiting threads
-                mInProgress.erase(key);
-                mCondition.notify_all();
-                return;
-            }
+        return Lookup::HIT;
+    }
 
-            // Add new entry
-            mCacheList.emplace_front(key, value);
-            mCacheMap[key] = mCacheList.begin();
-            mCurrentSize += valueSize;
-        }
+    // Non-blocking check used when filling the cache in the background. Returns true if the
+    // key is neither cached nor being processed, in which case it is marked as in progress.
+    bool beginPrefetch(const CacheKey& key) {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if (mCacheMap.find(key) != mCacheMap.end() || mInProgress.find(key) != mInProgress.end())
+            return false;
 
-        // Remove from in-progress set and notify waiting threads
-        mInProgress.erase(key);
-        mCondition.notify_all();
+        mInProgress.insert(key);
 
-        spdlog::debug("Cache size is {} bytes", mCurrentSize);
+        return true;
     }
 
-    // Remove an entry from the cache
-    void remove(const Entry& key) {
+    // Returns the cached value without waiting for a key in progress or changing its position
+    std::shared_ptr<CachedBuffer> peek(const CacheKey& key) const {
         std::lock_guard<std::mutex> lock(mMutex);
 
         auto it = mCacheMap.find(key);
+        if (it == mCacheMap.end())
+            return nullptr;
 
-        if (it != mCacheMap.end()) {
-            mCurrentSize -= it->second->second->size();
-            mCacheList.erase(it->second);
-            mCacheMap.erase(it);
+        return it->second->second;
+    }
+
+    // Add or update value in cache
+    void put(const CacheKey& key, std::shared_ptr<CachedBuffer> value) {
+        std::vector<Waiter> waiters;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            insert(key, value);
+            waiters = finish(key);
         }
 
-        // Also remove from in-progress set if present and notify
-        if (mInProgress.erase(key) > 0) {
-            mCondition.notify_all();
+        for (auto& waiter : waiters)
+            waiter(value);
+    }
+
+    // Remove an entry from the cache
+    void remove(const CacheKey& key) {
+        std::vector<Waiter> waiters;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            auto it = mCacheMap.find(key);
+
+            if (it != mCacheMap.end()) {
+                mCurrentSize -= it->second->second->memoryUsage();
+                mCacheList.erase(it->second);
+                mCacheMap.erase(it);
+            }
+
+            // Also remove from in-progress set if present and notify
+            waiters = finish(key);
         }
+
+        for (auto& waiter : waiters)
+            waiter(nullptr);
     }
 
     // Clear the cache
     void clear() {
-        std::lock_guard<std::mutex> lock(mMutex);
+        std::unordered_map<CacheKey, std::vector<Waiter>, CacheKey::Hash> waiters;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
 
-        mCacheMap.clear();
-        mCacheList.clear();
-        mInProgress.clear();
-        mCurrentSize = 0;
-        mCondition.notify_all();
+            mCacheMap.clear();
+            mCacheList.clear();
+            mInProgress.clear();
+            mCurrentSize = 0;
+            mCondition.notify_all();
+
+            waiters.swap(mWaiters);
+        }
+
+        for (auto& [key, keyWaiters] : waiters) {
+            for (auto& waiter : keyWaiters)
+                waiter(nullptr);
+        }
     }
 
     // Get current size
@@ -142,27 +209,123 @@ public:
 
     // Get maximum size
     size_t capacity() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+
         return mMaxSize;
     }
 
+    // Change the maximum size. When shrinking, only the least recently used entries
+    // are evicted until the cache fits, the rest of the cache stays intact.
+    void resize(size_t maxSize) {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        mMaxSize = maxSize;
+
+        evict(mMaxSize);
+
+        SPDLOG_DEBUG("Cache capacity is {} bytes (size: {} bytes)", mMaxSize, mCurrentSize);
+    }
+
+    // Whether new entries should be stored compressed
+    void setCompressionEnabled(bool enabled) {
+        mCompressionEnabled = enabled;
+    }
+
+    bool isCompressionEnabled() const {
+        return mCompressionEnabled;
+    }
+
     // Method to mark that processing for a key has failed
     // This should be called if the caller gets nullptr from get() but fails to load the data
-    void markLoadFailed(const Entry& key) {
-        std::lock_guard<std::mutex> lock(mMutex);
-        mInProgress.erase(key);
-        mCondition.notify_all();
+    void markLoadFailed(const CacheKey& key) {
+        std::vector<Waiter> waiters;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            waiters = finish(key);
+        }
+
+        for (auto& waiter : waiters)
+            waiter(nullptr);
+    }
+
+private:
+    // Add or update the value, caller must hold the lock
+    void insert(const CacheKey& key, const std::shared_ptr<CachedBuffer>& value) {
+        size_t valueSize = value->memoryUsage();
+
+        // Check if key already exists in cache
+        auto it = mCacheMap.find(key);
+
+        if (it != mCacheMap.end()) {
+            // Update value
+            size_t oldSize = it->second->second->memoryUsage();
+            mCurrentSize -= oldSize;
+            mCurrentSize += valueSize;
+
+            // Move to front and update
+            mCacheList.splice(mCacheList.begin(), mCacheList, it->second);
+            it->second->second = value;
+        }
+        else {
+            // New entry
+
+            // If adding this would exceed max size, remove older entries
+            evict(mMaxSize > valueSize ? mMaxSize - valueSize : 0);
+
+            // If the single item is too large for the cache, don't add it
+            if (valueSize > mMaxSize)
+                return;
+
+            // Add new entry
+            mCacheList.emplace_front(key, value);
+            mCacheMap[key] = mCacheList.begin();
+            mCurrentSize += valueSize;
+        }
+
+        LOG_SAMPLED_DEBUG("Cache size is {} bytes", mCurrentSize);
+    }
+
+    // Remove the key from the in-progress set and wake up threads waiting in get(). Returns
+    // the waiters of lookup(), to be called once the lock is released. Caller must hold the lock.
+    std::vector<Waiter> finish(const CacheKey& key) {
+        std::vector<Waiter> waiters;
+
+        if (mInProgress.erase(key) > 0)
+            mCondition.notify_all();
+
+        auto it = mWaiters.find(key);
+        if (it != mWaiters.end()) {
+            waiters = std::move(it->second);
+            mWaiters.erase(it);
+        }
+
+        return waiters;
+    }
+
+    // Remove least recently used entries until the cache size is at most targetSize.
+    // Caller must hold the lock.
+    void evict(size_t targetSize) {
+        while (!mCacheList.empty() && mCurrentSize > targetSize) {
+            auto& last = mCacheList.back();
+            mCurrentSize -= last.second->memoryUsage();
+            mCacheMap.erase(last.first);
+            mCacheList.pop_back();
+        }
     }
 
 private:
-    using CacheItem = std::pair<Entry, std::shared_ptr<std::vector<char>>>;
+    using CacheItem = std::pair<CacheKey, std::shared_ptr<CachedBuffer>>;
     using CacheList = std::list<CacheItem>;
-    using CacheMap = std::unordered_map<Entry, typename CacheList::iterator, Entry::Hash>;
+    using CacheMap = std::unordered_map<CacheKey, typename CacheList::iterator, CacheKey::Hash>;
 
     CacheList mCacheList; // List of cache entries, most recently used at the front
     CacheMap mCacheMap;   // Map from key to list iterator
-    std::unordered_set<Entry, Entry::Hash> mInProgress; // Set of keys currently being processed
+    std::unordered_set<CacheKey, CacheKey::Hash> mInProgress; // Set of keys currently being processed
+    std::unordered_map<CacheKey, std::vector<Waiter>, CacheKey::Hash> mWaiters; // Callbacks of lookup() for keys in progress
     size_t mMaxSize;      // Maximum cache size in bytes
     size_t mCurrentSize;  // Current cache size in bytes
+    std::atomic_bool mCompressionEnabled; // Store new entries compressed
     mutable std::mutex mMutex; // Mutex for thread safety
     mutable std::condition_variable mCondition; // Condition variable for waiting
 };
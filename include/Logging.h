@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <spdlog/spdlog.h>
+
+namespace motioncam {
+
+// Set up the default logger. Logs go to the console, and to logFile unless it is empty.
+// Messages are written by a background thread, when its queue is full the oldest are dropped
+// so that logging never blocks a read.
+void setupLogging(const std::string& logFile);
+
+// Lets through up to MESSAGES_PER_SECOND messages a second from one place in the code and
+// counts the rest. Lock free.
+class LogSampler {
+public:
+    static constexpr uint32_t MESSAGES_PER_SECOND = 20;
+
+    LogSampler() : mWindowStartNs(0), mCount(0), mSuppressed(0) {}
+
+    // Returns true if the message should be logged, suppressed is then set to the number of
+    // messages dropped since the last one that was
+    bool sample(uint64_t& suppressed);
+
+private:
+    std::atomic<int64_t> mWindowStartNs;
+    std::atomic<uint32_t> mCount;
+    std::atomic<uint64_t> mSuppressed;
+};
+
+} // namespace motioncam
+
+// Debug messages logged for every read. Compiled out like SPDLOG_DEBUG() below
+// SPDLOG_ACTIVE_LEVEL, otherwise sampled so debug logging can stay on under load.
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+#define LOG_SAMPLED_DEBUG(...) \
+    do { \
+        if(spdlog::should_log(spdlog::level::debug)) { \
+            static motioncam::LogSampler logSampler_; \
+            uint64_t logSuppressed_ = 0; \
+            if(logSampler_.sample(logSuppressed_)) { \
+                if(logSuppressed_ > 0) \
+                    SPDLOG_DEBUG("({} messages like the next were suppressed)", logSuppressed_); \
+                SPDLOG_DEBUG(__VA_ARGS__); \
+            } \
+        } \
+    } while(0)
+#else
+#define LOG_SAMPLED_DEBUG(...) (void)0
+#endif
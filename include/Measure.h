@@ -1,23 +1,29 @@
 #pragma once
 
+#include "Metrics.h"
+#include "Logging.h"
+
 #include <chrono>
-#include <string>
-#include <spdlog/spdlog.h>
 
 namespace motioncam {
 
+// Records the time until it goes out of scope as a stage of a read. Metrics may be null, in
+// which case the time is only logged.
 class Measure {
 public:
-    explicit Measure(const std::string& name)
-        : mName(name)
-        , mStart(std::chrono::high_resolution_clock::now()) {
+    Measure(Metrics* metrics, Stage stage)
+        : mMetrics(metrics)
+        , mStage(stage)
+        , mStart(std::chrono::steady_clock::now()) {
     }
 
     ~Measure() {
-        const auto end = std::chrono::high_resolution_clock::now();
-        const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - mStart).count();
+        const auto duration = std::chrono::steady_clock::now() - mStart;
+
+        if(mMetrics)
+            mMetrics->record(mStage, duration);
 
-        spdlog::debug("{}: {} ms", mName, duration / 1000.0);
+        LOG_SAMPLED_DEBUG("{}: {} ms", stageName(mStage), std::chrono::duration<double, std::milli>(duration).count());
     }
 
     // Prevent copying and moving
@@ -27,8 +33,9 @@ public:
     Measure& operator=(Measure&&) = delete;
 
 private:
-    std::string mName;
-    std::chrono::time_point<std::chrono::high_resolution_clock> mStart;
+    Metrics* mMetrics;
+    Stage mStage;
+    std::chrono::steady_clock::time_point mStart;
 };
 
 } // namespace motioncam
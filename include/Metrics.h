@@ -0,0 +1,158 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace motioncam {
+
+// Steps a read of a frame goes through, in order
+enum class Stage {
+    QUEUE_WAIT,         // Waiting in a thread pool queue
+    CONTAINER_READ,     // Reading and decompressing the frame from the MCRAW file
+    DECOMPRESS,         // Decompressing a rendered frame held in the cache
+    METADATA_PARSE,     // Parsing frame and container metadata
+    PREPROCESS,         // Scaling, shading map and black/white levels
+    PACK,               // Bit packing the raw data
+    HEADER_WRITE,       // Writing the DNG
+    REPLY,              // Copying into the read buffer and answering the read
+    COUNT
+};
+
+const char* stageName(Stage stage);
+
+// What the memory of a mount is held by
+enum class Memory {
+    RENDERED_FRAMES,    // Rendered frames, in the render cache or held by open files
+    DECODED_FRAMES,     // Decoded frames, in the decoded frame cache or being rendered
+    DECODERS,           // Decoders kept open by the IO and processing threads, estimated
+    AUDIO,              // The audio file, held in memory in full
+    FILE_LIST,          // File entries
+    IN_FLIGHT,          // Reserved by renders in progress, overlaps the frames above
+    COUNT
+};
+
+const char* memoryName(Memory memory);
+
+struct MemoryStats {
+    uint64_t currentBytes;
+    uint64_t peakBytes;
+};
+
+// Responses of the HTTP server and the time from each request until its last byte was written
+struct TransferStats {
+    uint64_t count;
+    uint64_t bytes;
+    double seconds;
+};
+
+struct LatencyStats {
+    uint64_t count;
+    double meanUs;
+    double p50Us;
+    double p95Us;
+    double p99Us;
+    double maxUs;
+};
+
+// Histogram with log-linear buckets, four per power of two, so percentiles are within about
+// 12% of the recorded value. Recording is lock free.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BUCKET_BITS = 2;
+    static constexpr int NUM_BUCKETS = 64 << SUB_BUCKET_BITS;
+
+    LatencyHistogram();
+
+    void record(uint64_t nanoseconds);
+    LatencyStats stats() const;
+    void reset();
+
+private:
+    std::array<std::atomic<uint64_t>, NUM_BUCKETS> mBuckets;
+    std::atomic<uint64_t> mCount;
+    std::atomic<uint64_t> mTotalNs;
+    std::atomic<uint64_t> mMaxNs;
+};
+
+// Bytes in use and the most that were in use at once. Lock free.
+class MemoryCounter {
+public:
+    MemoryCounter();
+
+    // Negative to release
+    void add(int64_t bytes);
+    MemoryStats stats() const;
+
+    // Starts tracking the peak again from the bytes in use now
+    void resetPeak();
+
+private:
+    std::atomic<int64_t> mCurrent;
+    std::atomic<int64_t> mPeak;
+};
+
+// Latency of each stage and memory held for the reads of one mount
+class Metrics {
+public:
+    Metrics() = default;
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    void record(Stage stage, std::chrono::nanoseconds duration);
+    LatencyStats stats(Stage stage) const;
+
+    void addMemory(Memory memory, int64_t bytes);
+    MemoryStats memory(Memory memory) const;
+
+    // All memory except IN_FLIGHT, which is already part of the rest
+    MemoryStats totalMemory() const;
+
+    void recordHttpResponse(uint64_t bytes, std::chrono::nanoseconds duration);
+    TransferStats httpResponses() const;
+
+    // Clears the latencies and restarts the memory peaks
+    void reset();
+
+    // Tables of the stages that have been recorded and of the memory in use
+    std::string format() const;
+
+private:
+    std::array<LatencyHistogram, static_cast<size_t>(Stage::COUNT)> mHistograms;
+    std::array<MemoryCounter, static_cast<size_t>(Memory::COUNT)> mMemory;
+    MemoryCounter mTotalMemory;
+    std::atomic<uint64_t> mHttpResponses{0};
+    std::atomic<uint64_t> mHttpBytes{0};
+    std::atomic<uint64_t> mHttpNs{0};
+};
+
+// Counts bytes against a mount for as long as it lives, so memory is released however the
+// object holding it goes away. Empty when metrics is null.
+class TrackedMemory {
+public:
+    TrackedMemory() : mMemory(Memory::COUNT), mBytes(0) {}
+    TrackedMemory(std::shared_ptr<Metrics> metrics, Memory memory, size_t bytes);
+    ~TrackedMemory();
+
+    TrackedMemory(TrackedMemory&& other) noexcept;
+    TrackedMemory& operator=(TrackedMemory&& other) noexcept;
+
+    TrackedMemory(const TrackedMemory&) = delete;
+    TrackedMemory& operator=(const TrackedMemory&) = delete;
+
+    size_t bytes() const { return mBytes; }
+
+private:
+    void release();
+
+private:
+    std::shared_ptr<Metrics> mMetrics;
+    Memory mMemory;
+    size_t mBytes;
+};
+
+} // namespace motioncam
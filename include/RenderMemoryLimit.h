@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Metrics.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace motioncam {
+
+// Caps the memory of frames being rendered, from reading the frame until the DNG is in the
+// render cache. Shared by all mounts. Reads wait for earlier renders to finish rather than
+// memory growing with the number of reads in flight, in the order they arrived. A render is
+// let through on its own when nothing else is in flight, however large it is.
+class RenderMemoryLimit {
+public:
+    // 0 for no limit
+    explicit RenderMemoryLimit(size_t limitBytes = 0);
+
+    RenderMemoryLimit(const RenderMemoryLimit&) = delete;
+    RenderMemoryLimit& operator=(const RenderMemoryLimit&) = delete;
+
+    void setLimit(size_t limitBytes);
+    size_t limit() const;
+
+    // Bytes reserved by renders in progress and the most reserved at once
+    MemoryStats usage() const;
+
+    // Waits until bytes fit under the limit
+    void acquire(size_t bytes);
+
+    // Returns false straight away if bytes don't fit, for renders that can be skipped
+    bool tryAcquire(size_t bytes);
+
+    void release(size_t bytes);
+
+private:
+    bool fits(size_t bytes) const;
+
+private:
+    size_t mLimit;
+    size_t mUsed;
+    size_t mPeak;
+    uint64_t mNextTicket;
+    uint64_t mServing;      // Ticket of the next read let through
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+};
+
+// Memory reserved by a render, counted as in flight for the mount until destroyed. Holds
+// nothing when limit is null or the reservation was refused.
+class RenderReservation {
+public:
+    RenderReservation(RenderMemoryLimit* limit, std::shared_ptr<Metrics> metrics, size_t bytes, bool wait);
+    ~RenderReservation();
+
+    RenderReservation(const RenderReservation&) = delete;
+    RenderReservation& operator=(const RenderReservation&) = delete;
+
+    // False if the render should be skipped
+    bool isAcquired() const { return mAcquired; }
+
+    // Gives the memory back before the reservation is destroyed
+    void release();
+
+private:
+    RenderMemoryLimit* mLimit;
+    size_t mBytes;
+    std::atomic_bool mAcquired;
+    TrackedMemory mTracked;
+};
+
+} // namespace motioncam
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "IFrameSource.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace motioncam {
+
+// Describes a generated clip. Written as a path so that it can go anywhere an MCRAW file
+// can, e.g. "synthetic:clip?width=1920&height=1080&frames=240&fps=24&drop=50&audio=2"
+struct SyntheticClipOptions {
+    std::string name = "synthetic";
+    int width = 4032;
+    int height = 3024;
+    int numFrames = 300;
+    float fps = 30.0f;
+    int dropEvery = 0;              // Leave out every nth frame, 0 for none
+    int audioChannels = 2;          // 0 for no audio
+    int audioSampleRate = 48000;
+    std::string sensorArrangement = "rggb";
+    int bits = 10;                  // White level of the raw data
+    int shadingMapWidth = 17;       // 0 for no shading map
+    int shadingMapHeight = 13;
+    int distinctFrames = 4;         // Frames cycle through this many images
+    unsigned int seed = 1;
+
+    // Throws if the path is not a synthetic clip or has invalid values
+    static SyntheticClipOptions parse(const std::string& path);
+    std::string toPath() const;
+};
+
+struct SyntheticClip;
+
+// In-memory stand-in for the MCRAW decoder. Frames are generated once per clip and shared
+// by every source opened on it, loading a frame is a copy so reads are free of disk noise.
+// Nothing is written to or read from an MCRAW file, so results from a synthetic clip cover
+// rendering, caching and scheduling but not container parsing, decompression or disk IO.
+class SyntheticFrameSource : public IFrameSource {
+public:
+    static constexpr const char* PATH_PREFIX = "synthetic:";
+
+    static bool isSyntheticPath(const std::string& path);
+
+    explicit SyntheticFrameSource(const SyntheticClipOptions& options);
+
+    const std::vector<Timestamp>& getFrames() const override;
+    const nlohmann::json& getContainerMetadata() const override;
+
+    void loadFrame(const Timestamp timestamp, std::vector<uint8_t>& outData, nlohmann::json& outMetadata) override;
+
+    int audioSampleRateHz() const override;
+    int numAudioChannels() const override;
+    void loadAudio(std::vector<AudioChunk>& outAudioChunks) override;
+
+    // Only the source itself, the clip is shared and not counted
+    size_t memoryUsage() const override;
+
+private:
+    std::shared_ptr<const SyntheticClip> mClip;
+};
+
+} // namespace motioncam
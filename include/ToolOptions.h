@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Metrics.h"
+#include "Types.h"
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+
+namespace motioncam {
+
+// Command line parsing and output shared by the command line tools. Invalid values throw
+// std::runtime_error naming the option.
+namespace tools {
+
+int toInt(const std::string& option, const std::string& value, int minValue);
+
+// Draft scale of 2, 4 or 8
+int toDraftScale(const std::string& option, const std::string& value);
+
+// Adds the render option set by a flag like --vignette-correction to renderOptions, returns
+// false if option isn't one
+bool parseRenderOption(const std::string& option, FileRenderOptions& renderOptions);
+
+// Latencies in milliseconds
+nlohmann::json toJson(const LatencyStats& stats);
+
+} // namespace tools
+
+} // namespace motioncam
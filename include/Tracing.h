@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace motioncam {
+
+// Where a span sits in the flow of a read from thread to thread
+enum class TraceFlow {
+    NONE,
+    BEGIN,
+    STEP,
+    END
+};
+
+// Records spans of work as Chrome trace events (chrome://tracing, ui.perfetto.dev). Tracing
+// is off by default, spans only cost an atomic load until it is started.
+class Trace {
+public:
+    static bool isEnabled() {
+        return sEnabled.load(std::memory_order_relaxed);
+    }
+
+    // Starts recording, dropping the events of an earlier trace
+    static void start();
+
+    static void stop();
+
+    // Writes the events recorded so far. Throws if the file can't be written.
+    static void write(const std::string& path);
+
+    // Identifies a read across the threads it passes through, 0 while tracing is off
+    static uint64_t newReadId();
+
+private:
+    static inline std::atomic_bool sEnabled{false};
+};
+
+// Records the time until it goes out of scope on the current thread. name must outlive the
+// trace, e.g. a string literal.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name, uint64_t readId = 0, TraceFlow flow = TraceFlow::NONE) :
+        mName(name), mReadId(readId), mFlow(flow), mStartNs(Trace::isEnabled() ? now() : -1) {
+    }
+
+    ~TraceSpan() {
+        if(mStartNs >= 0)
+            record();
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    friend class Trace;
+
+    static int64_t now();
+    void record();
+
+private:
+    const char* mName;
+    uint64_t mReadId;
+    TraceFlow mFlow;
+    int64_t mStartNs;
+};
+
+} // namespace motioncam
@@ -14,12 +14,18 @@ enum EntryType : int {
     INVALID_ENTRY = -1
 };
 
+// Source frame of a file entry. Several entries share a timestamp when frames were dropped.
+struct FrameInfo {
+    int64_t timestamp;
+    int64_t frameNumber;
+};
+
 struct Entry {
     EntryType type;
     std::vector<std::string> pathParts;
     std::string name;
     size_t size;
-    std::variant<int64_t> userData;
+    std::variant<int64_t, FrameInfo> userData;
 
     // Custom hash function for Entry
     struct Hash {
@@ -7,6 +7,11 @@
 #include <ostream>
 #include <algorithm>
 #include <memory>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <tuple>
 
 #include "Types.h"
 
@@ -14,6 +19,7 @@ namespace motioncam {
 
 struct CameraFrameMetadata;
 struct CameraConfiguration;
+class Metrics;
 
 namespace utils {
 
@@ -155,16 +161,67 @@ public:
     }
 };
 
-std::shared_ptr<std::vector<char>> generateDng(
-    std::vector<uint8_t>& data,
+// Packs 16 bit samples in place, width must be a multiple of 4
+void encodeTo10Bit(std::vector<uint8_t>& data, uint32_t& width, uint32_t& height);
+void encodeTo12Bit(std::vector<uint8_t>& data, uint32_t& width, uint32_t& height);
+void encodeTo14Bit(std::vector<uint8_t>& data, uint32_t& width, uint32_t& height);
+
+// Linearises, scales and optionally applies the shading map to raw 16 bit data. Returns the
+// new data with its black and white levels, the dimensions are updated to match.
+std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short> preprocessData(
+    const std::vector<uint8_t>& data,
+    uint32_t& inOutWidth,
+    uint32_t& inOutHeight,
     const CameraFrameMetadata& metadata,
     const CameraConfiguration& cameraConfiguration,
+    const std::array<uint8_t, 4>& cfa,
+    uint32_t scale,
+    bool applyShadingMap=true,
+    bool normaliseShadingMap=false);
+
+// What every frame of a clip is rendered with, derived once from its container metadata
+struct RenderConfig {
+    std::shared_ptr<const CameraConfiguration> cameraConfiguration;
+    std::array<uint8_t, 4> cfa;
+    int colorIlluminant1;
+    int colorIlluminant2;
+};
+
+// Throws if the sensor arrangement is not supported
+std::shared_ptr<const RenderConfig> makeRenderConfig(std::shared_ptr<const CameraConfiguration> cameraConfiguration);
+
+std::shared_ptr<std::vector<char>> generateDng(
+    const std::vector<uint8_t>& data,
+    const CameraFrameMetadata& metadata,
+    const RenderConfig& renderConfig,
     float recordingFps,
     int frameNumber,
     FileRenderOptions options,
-    int scale=1);
+    int scale=1,
+    Metrics* metrics=nullptr);
 
 std::pair<int, int> toFraction(float frameRate, int base = 1000);
 
+// Average frame rate of sorted timestamps in nanoseconds, 0 if it can't be determined
+float calculateFrameRate(const std::vector<int64_t>& frames);
+int64_t getFrameNumberFromTimestamp(int64_t timestamp, int64_t referenceTimestamp, float frameRate);
+
+// Frames of a clip in the order they are listed, a frame is repeated to fill in for dropped frames
+std::vector<FrameInfo> listFrames(const std::vector<int64_t>& frames, float frameRate);
+
+// Entry with the given path relative to the root of a listing
+std::optional<Entry> findEntry(const std::vector<Entry>& entries, const std::string& fullPath);
+
+std::string constructFrameFilename(
+    const std::string& baseName, int frameNumber, int padding = 6, const std::string& extension = "");
+
+constexpr uint16_t DNG_TAG_TIMECODES = 51043;
+
+// SMPTE time code as stored in the DNG TimeCodes tag
+std::array<uint8_t, 8> getTimeCode(int frameNumber, float recordingFps);
+
+// Returns the offset of the value of a tag in the first IFD of a little endian DNG, or 0 if not found
+size_t findTagValueOffset(const std::vector<char>& dng, uint16_t tag);
+
 } // namespace utils
 } // namespace motioncam
@@ -1,6 +1,13 @@
 #pragma once
 
 #include <IVirtualFileSystem.h>
+#include "Metrics.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 namespace BS {
 class thread_pool;
@@ -8,8 +15,38 @@ class thread_pool;
 
 namespace motioncam {
 
-class Decoder;
 class LRUCache;
+class DecodedFrameCache;
+class CachedBuffer;
+class RenderMemoryLimit;
+struct CacheKey;
+
+namespace utils {
+struct RenderConfig;
+}
+
+// State of an open file. Once the frame has been rendered the handle holds on to it, so
+// further reads through the handle don't go through the cache.
+struct FileHandle {
+    Entry entry;
+    std::shared_ptr<CachedBuffer> frame;
+    uint64_t generation;    // Listing the entry and frame belong to
+    std::mutex mutex;
+};
+
+// Part of a rendered frame that can be handed to the kernel without copying it first. The
+// time code of the entry replaces the one in the shared frame.
+struct FrameSlice {
+    struct Segment {
+        const char* data;
+        size_t size;
+    };
+
+    std::shared_ptr<CachedBuffer> frame; // Keeps the segments alive
+    std::array<uint8_t, 8> timeCode;
+    std::array<Segment, 3> segments;
+    int numSegments;
+};
 
 class VirtualFileSystemImpl_MCRAW : public IVirtualFileSystem
 {
@@ -18,15 +55,21 @@ public:
         BS::thread_pool& ioThreadPool,
         BS::thread_pool& processingThreadPool,
         LRUCache& lruCache,
+        DecodedFrameCache& decodedFrameCache,
         FileRenderOptions options,
         int draftScale,
-        const std::string& file);
+        const std::string& file,
+        std::shared_ptr<Metrics> metrics = nullptr,
+        RenderMemoryLimit* renderMemoryLimit = nullptr);
 
     ~VirtualFileSystemImpl_MCRAW();
 
     std::vector<Entry> listFiles(const std::string& filter = "") const override;
     std::optional<Entry> findEntry(const std::string& fullPath) const override;
 
+    // With async set, a read of a cached frame returns the number of bytes read without
+    // calling result. Otherwise 0 is returned and result is called exactly once, possibly
+    // before this returns. Never waits for a frame being rendered by another read.
     int readFile(
         const Entry& entry,
         const size_t pos,
@@ -37,10 +80,78 @@ public:
 
     void updateOptions(FileRenderOptions options, int draftScale) override;
 
+    // Open a file for reading, frames that are not cached start rendering straight away
+    std::unique_ptr<FileHandle> openFile(const Entry& entry);
+
+    // Synchronous read through an open file
+    int readFile(FileHandle& handle, const size_t pos, const size_t len, void* dst);
+
+    // Read through an open file without waiting for the frame to render. result is called
+    // exactly once with the number of bytes in dst and an error code, possibly before this
+    // returns. dst must stay valid until then.
+    void readFileAsync(FileHandle& handle, const size_t pos, const size_t len, void* dst, std::function<void(size_t, int)> result);
+
+    // Returns false unless the file is a frame that has been rendered and is stored
+    // uncompressed, in which case the read is described by slice instead of being copied
+    bool sliceFile(FileHandle& handle, const size_t pos, const size_t len, FrameSlice& slice);
+
+    // Render numFrames frames starting at startFrame into the cache in the background.
+    // Stops as soon as a frame is read.
+    void warmUp(int64_t startFrame, int numFrames);
+
+    // Frame number of the most recently read frame, -1 if none has been read
+    int64_t lastAccessedFrame() const;
+
+    // Frame rate the clip was recorded at, 0 if it can't be determined
+    float frameRate() const;
+
+    // Stage latencies of reads and memory held, shared with the file systems passed the same metrics
+    std::shared_ptr<Metrics> getMetrics() const override;
+
 private:
-    void init(FileRenderOptions options);
+    // Files of the clip and everything that depends on the render options. Replaced as a
+    // whole when the options change, a read uses the listing it started with throughout.
+    struct Listing {
+        std::vector<Entry> files;
+        std::vector<int64_t> frames;
+        std::vector<uint8_t> audioFile;
+        float fps = 0;
+        size_t typicalDngSize = 0;
+        size_t renderMemorySize = 0;    // Reserved for each frame being rendered
+        std::shared_ptr<const utils::RenderConfig> renderConfig;  // Parsed once, shared by the frames being rendered
+        FileRenderOptions options;
+        int draftScale;
+        uint64_t generation = 0;
+        TrackedMemory audioMemory;
+        TrackedMemory fileListMemory;
+    };
+
+    void stopWarmUp();
+
+    std::shared_ptr<const Listing> getListing() const;
+    std::shared_ptr<const Listing> createListing(FileRenderOptions options, int draftScale, uint64_t generation) const;
+
+    CacheKey getCacheKey(const Listing& listing, const FrameInfo& frameInfo) const;
+    void renderInBackground(const Listing& listing, const FrameInfo& frameInfo);
+
+    std::pair<Entry, std::shared_ptr<CachedBuffer>> resolveHandle(FileHandle& handle, const Listing& listing);
+    std::shared_ptr<CachedBuffer> pinFrame(FileHandle& handle, const Listing& listing, const FrameInfo& frameInfo);
+    size_t readPinnedFrame(const CachedBuffer& frame, const FrameInfo& frameInfo, float fps, const size_t pos, const size_t len, void* dst);
+
+    // readFile() without recording the access
+    int readEntry(
+        const Listing& listing,
+        const Entry& entry,
+        const size_t pos,
+        const size_t len,
+        void* dst,
+        std::function<void(size_t, int)> result,
+        bool async);
+
+    void recordAccess(const Entry& entry, const size_t pos, const size_t len) const;
 
     size_t generateFrame(
+        const Listing& listing,
         const Entry& entry,
         const size_t pos,
         const size_t len,
@@ -48,7 +159,10 @@ private:
         std::function<void(size_t, int)> result,
         bool async);
 
+    void decodeAhead(const Listing& listing, int64_t timestamp);
+
     size_t generateAudio(
+        const Listing& listing,
         const Entry& entry,
         const size_t pos,
         const size_t len,
@@ -58,17 +172,19 @@ private:
 
 private:
     LRUCache& mCache;
+    DecodedFrameCache& mDecodedFrameCache;
     BS::thread_pool& mIoThreadPool;
     BS::thread_pool& mProcessingThreadPool;
+    const std::shared_ptr<Metrics> mMetrics;
+    RenderMemoryLimit* const mRenderMemoryLimit;    // Null for no limit, must outlive the pools
     const std::string mSrcPath;
     const std::string mBaseName;
-    size_t mTypicalDngSize;
-    std::vector<Entry> mFiles;
-    std::vector<uint8_t> mAudioFile;
-    int mDraftScale;
-    FileRenderOptions mOptions;
-    float mFps;
-    std::mutex mMutex;
+    std::shared_ptr<const Listing> mListing;    // Guarded by mMutex, swapped but never changed
+    mutable std::mutex mMutex;
+    std::thread mWarmUpThread;
+    std::atomic_bool mStopWarmUp;
+    std::atomic<uint64_t> mForegroundReads;
+    std::atomic<int64_t> mLastAccessedFrame;
 };
 
 } // namespace motioncam
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "IFuseFileSystem.h"
+
+namespace BS {
+    class thread_pool;
+}
+
+namespace motioncam {
+
+struct Session;
+class LRUCache;
+class CacheBudget;
+class DecodedFrameCache;
+class RenderMemoryLimit;
+class VirtualFileSystemImpl_MCRAW;
+
+// Creates the file system of a clip with the current render options, recording into the
+// metrics of the mount
+using ClipLoader = std::function<std::unique_ptr<VirtualFileSystemImpl_MCRAW>(
+    const std::string&, FileRenderOptions, int, std::shared_ptr<Metrics>)>;
+
+class FuseFileSystemImpl_Linux : public IFuseFileSystem
+{
+public:
+    // Thread counts of 0 use the defaults
+    explicit FuseFileSystemImpl_Linux(unsigned int ioThreads = 0, unsigned int processingThreads = 0);
+    ~FuseFileSystemImpl_Linux();
+
+    MountId mount(FileRenderOptions options, int draftScale, const std::string& srcFile, const std::string& dstPath) override;
+    MountId mountLibrary(FileRenderOptions options, int draftScale, const std::string& srcFolder, const std::string& dstPath) override;
+    void unmount(MountId mountId) override;
+    void updateOptions(MountId mountId, FileRenderOptions options, int draftScale) override;
+    void setCacheSize(size_t sizeBytes, bool adaptive) override;
+    void setCacheCompression(bool enabled) override;
+    void setRenderMemoryLimit(size_t limitBytes) override;
+    void warmCache(MountId mountId, int64_t startFrame, int numFrames) override;
+    int64_t lastAccessedFrame(MountId mountId) override;
+    std::shared_ptr<IVirtualFileSystem> getFileSystem(MountId mountId) override;
+    std::shared_ptr<Metrics> getMetrics(MountId mountId) override;
+
+private:
+    static void createMountPoint(const std::string& dstPath);
+    ClipLoader getClipLoader();
+
+private:
+    MountId mNextMountId;
+    std::map<MountId, std::unique_ptr<Session>> mMountedFiles;
+    std::unique_ptr<BS::thread_pool> mIoThreadPool;
+    std::unique_ptr<BS::thread_pool> mProcessingThreadPool;
+    std::unique_ptr<LRUCache> mCache;
+    std::unique_ptr<CacheBudget> mCacheBudget;
+    std::unique_ptr<DecodedFrameCache> mDecodedFrameCache;
+    std::unique_ptr<RenderMemoryLimit> mRenderMemoryLimit;
+};
+
+} // namespace motioncam
@@ -13,16 +13,28 @@ namespace motioncam {
 
 struct Session;
 class LRUCache;
+class CacheBudget;
+class DecodedFrameCache;
+class RenderMemoryLimit;
 
 class FuseFileSystemImpl_MacOs : public IFuseFileSystem
 {
 public:
-    FuseFileSystemImpl_MacOs();
+    // Thread counts of 0 use the defaults
+    explicit FuseFileSystemImpl_MacOs(unsigned int ioThreads = 0, unsigned int processingThreads = 0);
     ~FuseFileSystemImpl_MacOs();
 
     MountId mount(FileRenderOptions options, int draftScale, const std::string& srcFile, const std::string& dstPath) override;
+    MountId mountLibrary(FileRenderOptions options, int draftScale, const std::string& srcFolder, const std::string& dstPath) override;
     void unmount(MountId mountId) override;
     void updateOptions(MountId mountId, FileRenderOptions options, int draftScale) override;
+    void setCacheSize(size_t sizeBytes, bool adaptive) override;
+    void setCacheCompression(bool enabled) override;
+    void setRenderMemoryLimit(size_t limitBytes) override;
+    void warmCache(MountId mountId, int64_t startFrame, int numFrames) override;
+    int64_t lastAccessedFrame(MountId mountId) override;
+    std::shared_ptr<IVirtualFileSystem> getFileSystem(MountId mountId) override;
+    std::shared_ptr<Metrics> getMetrics(MountId mountId) override;
 
 private:
     MountId mNextMountId;
@@ -30,6 +42,9 @@ private:
     std::unique_ptr<BS::thread_pool> mIoThreadPool;
     std::unique_ptr<BS::thread_pool> mProcessingThreadPool;
     std::unique_ptr<LRUCache> mCache;
+    std::unique_ptr<CacheBudget> mCacheBudget;
+    std::unique_ptr<DecodedFrameCache> mDecodedFrameCache;
+    std::unique_ptr<RenderMemoryLimit> mRenderMemoryLimit;
 };
 
 } // namespace motioncam
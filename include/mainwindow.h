@@ -2,12 +2,19 @@
 #define MAINWINDOW_H
 
 #include "IFuseFileSystem.h"
+#include "HttpServer.h"
 
 #include <QMainWindow>
 #include <QList>
+#include <QHash>
 #include <QString>
 
+#include <memory>
+#include <thread>
+
 namespace motioncam {
+    class Exporter;
+
     struct MountedFile {
         MountedFile(MountId mountId, QString srcFile) :
             mountId(mountId), srcFile(srcFile)
@@ -57,7 +64,7 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
-    void mountFile(const QString& filePath);
+    void mountFile(const QString& filePath, qint64 resumeFrame = -1);
 
 protected:
     bool eventFilter(QObject *watched, QEvent *event) override;
@@ -65,10 +72,15 @@ protected:
 private slots:
     void onRenderSettingsChanged(const Qt::CheckState &state);
     void onDraftModeQualityChanged(int index);
+    void onCacheSizeChanged(int index);
+    void onCacheCompressionChanged(const Qt::CheckState &state);
+    void onRecordTraceChanged(const Qt::CheckState &state);
     void onSetCacheFolder(bool checked);
 
     void playFile(const QString& path);
+    void exportFile(const QString& filePath);
     void removeFile(QWidget* fileWidget);
+    void showStats(motioncam::MountId mountId, const QString& fileName);
 
 private:
     void saveSettings();
@@ -78,9 +90,17 @@ private:
 private:
     Ui::MainWindow *ui;
     std::unique_ptr<motioncam::IFuseFileSystem> mFuseFilesystem;
+    std::unique_ptr<HttpServer> mHttpServer; // Shares the mounts' file systems, must go before them
     QList<motioncam::MountedFile> mMountedFiles;
     QString mCacheRootFolder;
     int mDraftQuality;
+    int mCacheSizeMb;
+    int mWarmUpFrames;
+    int mHttpPort;
+    QHash<motioncam::MountId, qint64> mResumeFrames;
+    QHash<motioncam::MountId, QString> mHttpNames;  // Directory of each mount in the HTTP server
+    std::unique_ptr<motioncam::Exporter> mExporter;
+    std::thread mExportThread;
 };
 
 #endif // MAINWINDOW_H
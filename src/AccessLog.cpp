@@ -0,0 +1,211 @@
+#include "AccessLog.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace motioncam {
+
+namespace {
+    // The log starts with MAGIC followed by records, each starting with a tag. Sources and
+    // entries are written once, the first time they are read, and referred to by index after
+    // that. Values are in host byte order.
+    constexpr char MAGIC[8] = { 'M', 'C', 'F', 'S', 'A', 'C', 'C', '1' };
+
+    constexpr uint8_t TAG_SOURCE = 1;   // uint32 index, uint16 size, path
+    constexpr uint8_t TAG_ENTRY = 2;    // uint32 index, uint16 size, path
+    constexpr uint8_t TAG_READ = 3;     // uint32 source, uint32 entry, uint64 offset, uint32 length, uint32 thread, int64 timestamp
+
+    struct Recording {
+        std::mutex mutex;
+        std::ofstream file;
+        std::unordered_map<std::string, uint32_t> sources;
+        std::unordered_map<std::string, uint32_t> entries;
+        std::chrono::steady_clock::time_point start;
+        uint64_t generation = 0;    // Tells apart thread numbers of earlier recordings
+        uint32_t numThreads = 0;
+        size_t numReads = 0;
+    };
+
+    Recording gRecording;
+
+    template<typename T>
+    void writeValue(std::ostream& out, T value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    bool readValue(std::istream& in, T& value) {
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
+    void writeString(std::ostream& out, uint8_t tag, uint32_t index, const std::string& value) {
+        const auto size = static_cast<uint16_t>((std::min)(value.size(), size_t(UINT16_MAX)));
+
+        writeValue(out, tag);
+        writeValue(out, index);
+        writeValue(out, size);
+
+        out.write(value.data(), size);
+    }
+
+    bool readString(std::istream& in, std::vector<std::string>& values) {
+        uint32_t index;
+        uint16_t size;
+
+        if(!readValue(in, index) || !readValue(in, size))
+            return false;
+
+        std::string value(size, '\0');
+
+        if(!in.read(value.data(), size))
+            return false;
+
+        if(index != values.size())
+            throw std::runtime_error("Corrupt access log");
+
+        values.push_back(std::move(value));
+
+        return true;
+    }
+
+    uint32_t intern(std::ostream& out, uint8_t tag, std::unordered_map<std::string, uint32_t>& values, const std::string& value) {
+        auto it = values.find(value);
+        if(it != values.end())
+            return it->second;
+
+        const auto index = static_cast<uint32_t>(values.size());
+
+        values.emplace(value, index);
+        writeString(out, tag, index, value);
+
+        return index;
+    }
+}
+
+void AccessLog::start(const std::string& path) {
+    stop();
+
+    std::lock_guard<std::mutex> lock(gRecording.mutex);
+
+    gRecording.file.open(path, std::ios::binary | std::ios::trunc);
+    if(!gRecording.file)
+        throw std::runtime_error("Failed to create " + path);
+
+    gRecording.file.write(MAGIC, sizeof(MAGIC));
+
+    gRecording.sources.clear();
+    gRecording.entries.clear();
+    gRecording.start = std::chrono::steady_clock::now();
+    gRecording.numThreads = 0;
+    gRecording.numReads = 0;
+    ++gRecording.generation;
+
+    sRecording = true;
+
+    spdlog::info("Recording reads to {}", path);
+}
+
+void AccessLog::stop() {
+    std::lock_guard<std::mutex> lock(gRecording.mutex);
+
+    sRecording = false;
+
+    if(!gRecording.file.is_open())
+        return;
+
+    gRecording.file.close();
+
+    if(!gRecording.file)
+        spdlog::error("Failed to write access log");
+
+    spdlog::info("Recorded {} reads", gRecording.numReads);
+}
+
+void AccessLog::record(const std::string& srcPath, const std::string& entryPath, uint64_t offset, uint64_t length) {
+    thread_local uint64_t threadGeneration = 0;
+    thread_local uint32_t threadIndex = 0;
+
+    const auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(gRecording.mutex);
+
+    if(!gRecording.file.is_open())
+        return;
+
+    if(threadGeneration != gRecording.generation) {
+        threadGeneration = gRecording.generation;
+        threadIndex = gRecording.numThreads++;
+    }
+
+    auto& out = gRecording.file;
+
+    const auto source = intern(out, TAG_SOURCE, gRecording.sources, srcPath);
+    const auto entry = intern(out, TAG_ENTRY, gRecording.entries, entryPath);
+
+    writeValue(out, TAG_READ);
+    writeValue(out, source);
+    writeValue(out, entry);
+    writeValue(out, offset);
+    writeValue(out, static_cast<uint32_t>((std::min)(length, uint64_t(UINT32_MAX))));
+    writeValue(out, threadIndex);
+    writeValue(out, static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - gRecording.start).count()));
+
+    ++gRecording.numReads;
+}
+
+AccessLogContents AccessLog::load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if(!in)
+        throw std::runtime_error("Failed to open " + path);
+
+    char magic[sizeof(MAGIC)];
+
+    if(!in.read(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+        throw std::runtime_error(path + " is not an access log");
+
+    AccessLogContents contents;
+    uint8_t tag;
+
+    while(readValue(in, tag)) {
+        if(tag == TAG_SOURCE) {
+            if(!readString(in, contents.sources))
+                break;
+        }
+        else if(tag == TAG_ENTRY) {
+            if(!readString(in, contents.entries))
+                break;
+        }
+        else if(tag == TAG_READ) {
+            AccessRecord read;
+
+            if(!readValue(in, read.source) ||
+               !readValue(in, read.entry) ||
+               !readValue(in, read.offset) ||
+               !readValue(in, read.length) ||
+               !readValue(in, read.thread) ||
+               !readValue(in, read.timestampNs))
+            {
+                break;
+            }
+
+            if(read.source >= contents.sources.size() || read.entry >= contents.entries.size())
+                throw std::runtime_error("Corrupt access log");
+
+            contents.reads.push_back(read);
+        }
+        else {
+            throw std::runtime_error("Corrupt access log");
+        }
+    }
+
+    return contents;
+}
+
+} // namespace motioncam
@@ -0,0 +1,227 @@
+#include "CacheBudget.h"
+#include "LRUCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif __APPLE__
+#include <mach/mach.h>
+#include <sys/sysctl.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+namespace motioncam {
+
+namespace {
+    constexpr auto UPDATE_INTERVAL = std::chrono::seconds(2);
+    constexpr size_t MIN_CACHE_SIZE = 256 * 1024 * 1024;
+    constexpr size_t MIN_RESIZE_STEP = 64 * 1024 * 1024;   // Ignore small fluctuations in free memory
+    constexpr float FREE_MEMORY_FRACTION = 0.5f;            // How much of the free memory the cache may use
+    constexpr float LOW_MEMORY_FRACTION = 0.05f;            // Treat less than 5% free memory as pressure
+    constexpr float PRESSURE_THRESHOLD = 10.0f;             // PSI "some avg10" percentage
+    constexpr float SHRINK_STEP = 0.75f;                    // Shrink by at most 25% per update
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+    size_t readMemInfoValue(const std::string& contents, const std::string& key) {
+        auto pos = contents.find(key + ":");
+        if(pos == std::string::npos)
+            return 0;
+
+        std::istringstream iss(contents.substr(pos + key.size() + 1));
+        size_t valueKb = 0;
+
+        iss >> valueKb;
+
+        return valueKb * 1024;
+    }
+
+    float readMemoryPressure() {
+        // Format: "some avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+        std::ifstream psi("/proc/pressure/memory");
+        std::string line;
+
+        while(std::getline(psi, line)) {
+            if(line.rfind("some", 0) != 0)
+                continue;
+
+            auto pos = line.find("avg10=");
+            if(pos == std::string::npos)
+                return 0.0f;
+
+            try {
+                return std::stof(line.substr(pos + 6));
+            }
+            catch(const std::exception&) {
+                return 0.0f;
+            }
+        }
+
+        return 0.0f;
+    }
+#endif
+}
+
+MemoryStatus getMemoryStatus() {
+    MemoryStatus status = { 0, 0, 0.0f };
+
+#ifdef _WIN32
+    MEMORYSTATUSEX memStatus;
+    memStatus.dwLength = sizeof(memStatus);
+
+    if(GlobalMemoryStatusEx(&memStatus)) {
+        status.totalBytes = static_cast<size_t>(memStatus.ullTotalPhys);
+        status.availableBytes = static_cast<size_t>(memStatus.ullAvailPhys);
+    }
+#elif __APPLE__
+    uint64_t memSize = 0;
+    size_t len = sizeof(memSize);
+
+    if(sysctlbyname("hw.memsize", &memSize, &len, nullptr, 0) == 0)
+        status.totalBytes = static_cast<size_t>(memSize);
+
+    vm_statistics64_data_t vmStats;
+    mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+    vm_size_t pageSize = 0;
+
+    if(host_page_size(mach_host_self(), &pageSize) == KERN_SUCCESS &&
+       host_statistics64(mach_host_self(), HOST_VM_INFO64, reinterpret_cast<host_info64_t>(&vmStats), &count) == KERN_SUCCESS)
+    {
+        status.availableBytes =
+            static_cast<size_t>(vmStats.free_count + vmStats.inactive_count + vmStats.purgeable_count) * pageSize;
+    }
+
+    // 1 = normal, 2 = warning, 4 = critical
+    int pressureLevel = 0;
+    len = sizeof(pressureLevel);
+
+    if(sysctlbyname("kern.memorystatus_vm_pressure_level", &pressureLevel, &len, nullptr, 0) == 0 && pressureLevel > 1)
+        status.pressure = 100.0f;
+#else
+    std::ifstream meminfo("/proc/meminfo");
+    std::stringstream contents;
+
+    contents << meminfo.rdbuf();
+
+    status.totalBytes = readMemInfoValue(contents.str(), "MemTotal");
+    status.availableBytes = readMemInfoValue(contents.str(), "MemAvailable");
+    status.pressure = readMemoryPressure();
+#endif
+
+    return status;
+}
+
+CacheBudget::CacheBudget(LRUCache& cache, size_t sizeBytes, bool adaptive) :
+    mCache(cache),
+    mSizeBytes(sizeBytes),
+    mAdaptive(adaptive),
+    mStop(false)
+{
+    update();
+
+    mThread = std::thread(&CacheBudget::run, this);
+}
+
+CacheBudget::~CacheBudget() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+
+    mCondition.notify_all();
+
+    if(mThread.joinable())
+        mThread.join();
+}
+
+void CacheBudget::configure(size_t sizeBytes, bool adaptive) {
+    spdlog::info("Setting cache budget to {} bytes (adaptive: {})", sizeBytes, adaptive);
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        mSizeBytes = sizeBytes;
+        mAdaptive = adaptive;
+    }
+
+    update();
+}
+
+void CacheBudget::run() {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    while(!mStop) {
+        mCondition.wait_for(lock, UPDATE_INTERVAL, [this] { return mStop; });
+
+        if(mStop)
+            break;
+
+        lock.unlock();
+        update();
+        lock.lock();
+    }
+}
+
+void CacheBudget::update() {
+    size_t sizeBytes;
+    bool adaptive;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        sizeBytes = mSizeBytes;
+        adaptive = mAdaptive;
+    }
+
+    const auto capacity = mCache.capacity();
+
+    if(!adaptive) {
+        if(capacity != sizeBytes)
+            mCache.resize(sizeBytes);
+
+        return;
+    }
+
+    auto status = getMemoryStatus();
+
+    // Can't tell how much memory there is, use the configured size
+    if(status.totalBytes == 0) {
+        if(capacity != sizeBytes)
+            mCache.resize(sizeBytes);
+
+        return;
+    }
+
+    const bool underPressure =
+        status.pressure > PRESSURE_THRESHOLD ||
+        status.availableBytes < static_cast<size_t>(status.totalBytes * LOW_MEMORY_FRACTION);
+
+    // Memory held by the cache is not reported as available, so add it back
+    size_t target = static_cast<size_t>((mCache.size() + status.availableBytes) * FREE_MEMORY_FRACTION);
+    const size_t shrinkLimit = static_cast<size_t>(capacity * SHRINK_STEP);
+
+    if(underPressure)
+        target = (std::min)(target, shrinkLimit);
+    else
+        target = (std::max)(target, shrinkLimit);
+
+    target = (std::max)(target, MIN_CACHE_SIZE);
+
+    const size_t diff = target > capacity ? target - capacity : capacity - target;
+    if(diff < MIN_RESIZE_STEP && !underPressure)
+        return;
+
+    if(target != capacity) {
+        SPDLOG_DEBUG("Adjusting cache capacity from {} to {} bytes (available: {}, pressure: {})",
+                      capacity, target, status.availableBytes, status.pressure);
+
+        mCache.resize(target);
+    }
+}
+
+} // namespace motioncam
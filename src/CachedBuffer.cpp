@@ -0,0 +1,191 @@
+#include "CachedBuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+#include <lz4.h>
+#include <spdlog/spdlog.h>
+
+namespace motioncam {
+
+namespace {
+    constexpr auto MIN_COMPRESSION_RATIO = 1.05;    // Keep the data uncompressed when it saves less than this
+    constexpr auto STATS_LOG_INTERVAL = 100;
+
+    std::atomic<uint64_t> gUncompressedBytes { 0 };
+    std::atomic<uint64_t> gCompressedBytes { 0 };
+    std::atomic<uint64_t> gCompressUs { 0 };
+    std::atomic<uint64_t> gDecompressUs { 0 };
+    std::atomic<uint64_t> gNumCompressed { 0 };
+    std::atomic<uint64_t> gNumBlocksDecompressed { 0 };
+
+    uint64_t elapsedUs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+CachedBuffer::CachedBuffer() : mSize(0), mBlockSize(0), mTimeCodeOffset(0) {
+}
+
+CachedBuffer::CachedBuffer(std::shared_ptr<std::vector<char>> data) :
+    mSize(data ? data->size() : 0),
+    mData(std::move(data)),
+    mBlockSize(0),
+    mTimeCodeOffset(0)
+{
+}
+
+std::shared_ptr<CachedBuffer> CachedBuffer::compress(std::shared_ptr<std::vector<char>> data, size_t blockSize) {
+    const auto start = std::chrono::steady_clock::now();
+
+    std::shared_ptr<CachedBuffer> buffer(new CachedBuffer());
+
+    const size_t numBlocks = (data->size() + blockSize - 1) / blockSize;
+
+    buffer->mSize = data->size();
+    buffer->mBlockSize = blockSize;
+    buffer->mBlockOffsets.reserve(numBlocks + 1);
+    buffer->mCompressedData.resize(LZ4_compressBound(static_cast<int>(blockSize)) * numBlocks);
+
+    size_t dstOffset = 0;
+
+    for(size_t block = 0; block < numBlocks; ++block) {
+        const size_t srcOffset = block * blockSize;
+        const size_t srcLen = (std::min)(blockSize, data->size() - srcOffset);
+
+        char* dst = buffer->mCompressedData.data() + dstOffset;
+
+        int compressedLen = LZ4_compress_default(
+            data->data() + srcOffset,
+            dst,
+            static_cast<int>(srcLen),
+            LZ4_compressBound(static_cast<int>(blockSize)));
+
+        buffer->mBlockOffsets.push_back(dstOffset);
+
+        // Blocks that don't compress are stored as is, recognisable by their length
+        if(compressedLen <= 0 || static_cast<size_t>(compressedLen) >= srcLen) {
+            std::memcpy(dst, data->data() + srcOffset, srcLen);
+            dstOffset += srcLen;
+        }
+        else {
+            dstOffset += compressedLen;
+        }
+    }
+
+    buffer->mBlockOffsets.push_back(dstOffset);
+    buffer->mCompressedData.resize(dstOffset);
+    buffer->mCompressedData.shrink_to_fit();
+
+    gUncompressedBytes += data->size();
+    gCompressedBytes += dstOffset;
+    gCompressUs += elapsedUs(start);
+
+    if(++gNumCompressed % STATS_LOG_INTERVAL == 0) {
+        auto stats = getCompressionStats();
+
+        spdlog::info("Cache compression ratio {:.2f}x, {:.2f} ms per file to compress, {:.3f} ms per block to decompress",
+                     stats.compressedBytes > 0 ? static_cast<double>(stats.uncompressedBytes) / stats.compressedBytes : 0.0,
+                     stats.compressMs / stats.numCompressed,
+                     stats.numBlocksDecompressed > 0 ? stats.decompressMs / stats.numBlocksDecompressed : 0.0);
+    }
+
+    if(dstOffset * MIN_COMPRESSION_RATIO > data->size())
+        return std::make_shared<CachedBuffer>(std::move(data));
+
+    return buffer;
+}
+
+CompressionStats CachedBuffer::getCompressionStats() {
+    CompressionStats stats;
+
+    stats.uncompressedBytes = gUncompressedBytes;
+    stats.compressedBytes = gCompressedBytes;
+    stats.compressMs = gCompressUs / 1000.0;
+    stats.decompressMs = gDecompressUs / 1000.0;
+    stats.numCompressed = gNumCompressed;
+    stats.numBlocksDecompressed = gNumBlocksDecompressed;
+
+    return stats;
+}
+
+size_t CachedBuffer::memoryUsage() const {
+    if(mData)
+        return mData->capacity();
+
+    return mCompressedData.capacity() + mBlockOffsets.capacity() * sizeof(size_t);
+}
+
+void CachedBuffer::trackMemory(std::shared_ptr<Metrics> metrics) {
+    mTrackedMemory = TrackedMemory(std::move(metrics), Memory::RENDERED_FRAMES, memoryUsage());
+}
+
+size_t CachedBuffer::read(size_t pos, size_t len, void* dst) const {
+    if(pos >= mSize)
+        return 0;
+
+    const size_t actualLen = (std::min)(len, mSize - pos);
+
+    if(mData) {
+        std::memcpy(dst, mData->data() + pos, actualLen);
+        return actualLen;
+    }
+
+    return readCompressed(pos, actualLen, reinterpret_cast<char*>(dst));
+}
+
+size_t CachedBuffer::readCompressed(size_t pos, size_t len, char* dst) const {
+    thread_local std::vector<char> scratch;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    size_t copied = 0;
+    size_t numBlocks = 0;
+
+    while(copied < len) {
+        const size_t block = (pos + copied) / mBlockSize;
+        const size_t blockStart = block * mBlockSize;
+        const size_t blockLen = (std::min)(mBlockSize, mSize - blockStart);
+        const size_t offsetInBlock = pos + copied - blockStart;
+        const size_t copyLen = (std::min)(blockLen - offsetInBlock, len - copied);
+
+        const char* src = mCompressedData.data() + mBlockOffsets[block];
+        const size_t srcLen = mBlockOffsets[block + 1] - mBlockOffsets[block];
+
+        if(srcLen == blockLen) {
+            // Stored uncompressed
+            std::memcpy(dst + copied, src + offsetInBlock, copyLen);
+        }
+        else {
+            // Decompress straight into the destination when the whole block is wanted
+            char* blockDst = dst + copied;
+
+            if(offsetInBlock != 0 || copyLen != blockLen) {
+                scratch.resize(mBlockSize);
+                blockDst = scratch.data();
+            }
+
+            int result = LZ4_decompress_safe(src, blockDst, static_cast<int>(srcLen), static_cast<int>(blockLen));
+            if(result != static_cast<int>(blockLen)) {
+                spdlog::error("Failed to decompress cached block {} (error: {})", block, result);
+                break;
+            }
+
+            if(blockDst != dst + copied)
+                std::memcpy(dst + copied, blockDst + offsetInBlock, copyLen);
+
+            ++numBlocks;
+        }
+
+        copied += copyLen;
+    }
+
+    gDecompressUs += elapsedUs(start);
+    gNumBlocksDecompressed += numBlocks;
+
+    return copied;
+}
+
+} // namespace motioncam
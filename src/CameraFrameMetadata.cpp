@@ -1,15 +1,181 @@
 #include "CameraFrameMetadata.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
 using json = nlohmann::json;
 
 namespace motioncam {
 
+namespace {
+    // Maps no longer used are removed once the registry has doubled in size since the last sweep
+    constexpr size_t MIN_SWEEP_SIZE = 64;
+
+    struct ShadingMapRegistry {
+        std::mutex mutex;
+        std::unordered_multimap<size_t, std::weak_ptr<const ShadingMap>> maps;
+        size_t sweepSize = MIN_SWEEP_SIZE;
+    };
+
+    ShadingMapRegistry gShadingMaps;
+
+    // FNV-1a over the dimensions and the bits of the gains
+    size_t hashShadingMap(int width, int height, const std::vector<float>& gains) {
+        uint64_t hash = 14695981039346656037ULL;
+
+        auto add = [&hash](const void* data, size_t size) {
+            const auto* bytes = static_cast<const uint8_t*>(data);
+
+            for(size_t i = 0; i < size; ++i) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ULL;
+            }
+        };
+
+        add(&width, sizeof(width));
+        add(&height, sizeof(height));
+        add(gains.data(), gains.size() * sizeof(float));
+
+        return static_cast<size_t>(hash);
+    }
+
+    // Channels of the lens shading map one after the other, channels that are not arrays are skipped
+    std::vector<float> readShadingMapGains(const json& shadingMapArray) {
+        std::vector<float> gains;
+
+        if(!shadingMapArray.is_array())
+            return gains;
+
+        if(!shadingMapArray.empty() && shadingMapArray[0].is_array())
+            gains.reserve(shadingMapArray.size() * shadingMapArray[0].size());
+
+        for(const auto& channel : shadingMapArray) {
+            if(!channel.is_array())
+                continue;
+
+            for(const auto& value : channel)
+                gains.push_back(value.get<float>());
+        }
+
+        return gains;
+    }
+
+    template<size_t N>
+    void readFloats(const json& array, std::array<float, N>& values) {
+        if(!array.is_array())
+            return;
+
+        for(size_t i = 0; i < N && i < array.size(); ++i)
+            values[i] = array[i].get<float>();
+    }
+}
+
+std::shared_ptr<const ShadingMap> ShadingMap::intern(int width, int height, std::vector<float> gains) {
+    const size_t planeSize = static_cast<size_t>((std::max)(width, 0)) * (std::max)(height, 0);
+
+    if(planeSize == 0 || gains.empty() || gains.size() % planeSize != 0)
+        return nullptr;
+
+    const size_t hash = hashShadingMap(width, height, gains);
+
+    std::lock_guard<std::mutex> lock(gShadingMaps.mutex);
+
+    // The hash only narrows the search, maps are shared only if all of their gains are equal
+    auto range = gShadingMaps.maps.equal_range(hash);
+
+    for(auto it = range.first; it != range.second; ++it) {
+        auto existing = it->second.lock();
+
+        if(existing && existing->width == width && existing->height == height && existing->gains == gains)
+            return existing;
+    }
+
+    auto map = std::make_shared<ShadingMap>();
+
+    map->width = width;
+    map->height = height;
+    map->numChannels = static_cast<int>(gains.size() / planeSize);
+    map->hash = hash;
+
+    // Normalized over all channels, so the colour balance between them stays the same
+    const float maxValue = *std::max_element(gains.begin(), gains.end());
+
+    map->normalizedGains = gains;
+
+    if(maxValue > 0.0f) {
+        for(float& value : map->normalizedGains)
+            value /= maxValue;
+    }
+
+    map->gains = std::move(gains);
+
+    gShadingMaps.maps.emplace(hash, map);
+
+    if(gShadingMaps.maps.size() >= gShadingMaps.sweepSize) {
+        for(auto it = gShadingMaps.maps.begin(); it != gShadingMaps.maps.end();) {
+            if(it->second.expired())
+                it = gShadingMaps.maps.erase(it);
+            else
+                ++it;
+        }
+
+        gShadingMaps.sweepSize = (std::max)(MIN_SWEEP_SIZE, gShadingMaps.maps.size() * 2);
+    }
+
+    return map;
+}
+
+CameraFrameMetadata CameraFrameMetadata::parseForRender(const json& j) {
+    CameraFrameMetadata frame{};
+
+    frame.orientation = ScreenOrientation::INVALID;
+
+    const json* shadingMapArray = nullptr;
+    int shadingMapWidth = 0;
+    int shadingMapHeight = 0;
+
+    for(auto it = j.begin(); it != j.end(); ++it) {
+        const auto& key = it.key();
+        const auto& value = it.value();
+
+        if(key == "asShotNeutral")
+            readFloats(value, frame.asShotNeutral);
+        else if(key == "exposureTime")
+            frame.exposureTime = value.get<double>();
+        else if(key == "height")
+            frame.height = value.get<int>();
+        else if(key == "iso")
+            frame.iso = value.get<int>();
+        else if(key == "lensShadingMap")
+            shadingMapArray = &value;
+        else if(key == "lensShadingMapHeight")
+            shadingMapHeight = value.get<int>();
+        else if(key == "lensShadingMapWidth")
+            shadingMapWidth = value.get<int>();
+        else if(key == "orientation")
+            frame.orientation = static_cast<ScreenOrientation>(value.get<int>());
+        else if(key == "originalHeight")
+            frame.originalHeight = value.get<int>();
+        else if(key == "originalWidth")
+            frame.originalWidth = value.get<int>();
+        else if(key == "width")
+            frame.width = value.get<int>();
+    }
+
+    if(shadingMapArray)
+        frame.lensShadingMap = ShadingMap::intern(shadingMapWidth, shadingMapHeight, readShadingMapGains(*shadingMapArray));
+
+    return frame;
+}
+
 CameraFrameMetadata CameraFrameMetadata::parse(const json& j) {
     CameraFrameMetadata frame;
 
     // Parse asShotNeutral array
     if (j.contains("asShotNeutral") && j["asShotNeutral"].is_array()) {
-        auto neutralArray = j["asShotNeutral"];
+        const auto& neutralArray = j["asShotNeutral"];
         for (size_t i = 0; i < 3 && i < neutralArray.size(); ++i) {
             frame.asShotNeutral[i] = neutralArray[i].get<float>();
         }
@@ -17,30 +183,16 @@ CameraFrameMetadata CameraFrameMetadata::parse(const json& j) {
 
     // Parse dynamicBlackLevel array
     if (j.contains("dynamicBlackLevel") && j["dynamicBlackLevel"].is_array()) {
-        auto blackLevelArray = j["dynamicBlackLevel"];
+        const auto& blackLevelArray = j["dynamicBlackLevel"];
         for (size_t i = 0; i < 4 && i < blackLevelArray.size(); ++i) {
             frame.dynamicBlackLevel[i] = blackLevelArray[i].get<float>();
         }
     }
 
     // Parse lens shading map (4 channels x height x width)
-    if (j.contains("lensShadingMap") && j["lensShadingMap"].is_array()) {
-        auto shadingMapArray = j["lensShadingMap"];
-        frame.lensShadingMap.reserve(shadingMapArray.size()); // Should be 4 channels
-
-        for (const auto& channel : shadingMapArray) {
-            if (!channel.is_array())
-                continue;
-
-            // Parse 1D array for this channel
-            std::vector<float> channelData1D;
-            channelData1D.reserve(channel.size());
-
-            for (const auto& value : channel)
-                channelData1D.push_back(value.get<float>());
-
-            frame.lensShadingMap.emplace_back(channelData1D);
-        }
+    if (j.contains("lensShadingMap")) {
+        frame.lensShadingMap = ShadingMap::intern(
+            j.value("lensShadingMapWidth", 0), j.value("lensShadingMapHeight", 0), readShadingMapGains(j["lensShadingMap"]));
     }
 
     // Parse simple fields with safe defaults
@@ -53,8 +205,6 @@ CameraFrameMetadata CameraFrameMetadata::parse(const json& j) {
     frame.isBinned = j.value("isBinned", false);
     frame.isCompressed = j.value("isCompressed", false);
     frame.iso = j.value("iso", 0);
-    frame.lensShadingMapHeight = j.value("lensShadingMapHeight", 0);
-    frame.lensShadingMapWidth = j.value("lensShadingMapWidth", 0);
     frame.needRemosaic = j.value("needRemosaic", false);
     frame.offset = j.value("offset", "");
     frame.orientation = static_cast<ScreenOrientation>(j.value("orientation", ScreenOrientation::INVALID));
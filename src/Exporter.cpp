@@ -0,0 +1,481 @@
+#include "Exporter.h"
+#include "CameraFrameMetadata.h"
+#include "CameraMetadata.h"
+#include "IFrameSource.h"
+#include "Utils.h"
+
+#include <boost/filesystem.hpp>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+namespace motioncam {
+
+namespace {
+    constexpr auto DEFAULT_DECODE_THREADS = 2;
+    constexpr auto DEFAULT_WRITER_THREADS = 2;
+    constexpr auto PROGRESS_INTERVAL = std::chrono::milliseconds(500);
+
+    // Render settings of the files in a folder, an export is only resumed with the same settings
+    constexpr auto SETTINGS_FILE = ".motioncam-export";
+
+    // Files are written under a temporary name and renamed once complete
+    constexpr auto PARTIAL_EXTENSION = ".partial";
+
+    // Queue between two stages of the pipeline. push() blocks while the queue is full and pop()
+    // while it is empty. After close() the remaining items can still be taken, after abort()
+    // they are dropped.
+    template<typename T>
+    class BoundedQueue {
+    public:
+        explicit BoundedQueue(size_t capacity) : mCapacity(capacity), mClosed(false) {}
+
+        bool push(T item) {
+            std::unique_lock<std::mutex> lock(mMutex);
+
+            mNotFull.wait(lock, [this] { return mClosed || mItems.size() < mCapacity; });
+
+            if(mClosed)
+                return false;
+
+            mItems.push_back(std::move(item));
+            mNotEmpty.notify_one();
+
+            return true;
+        }
+
+        std::optional<T> pop() {
+            std::unique_lock<std::mutex> lock(mMutex);
+
+            mNotEmpty.wait(lock, [this] { return mClosed || !mItems.empty(); });
+
+            if(mItems.empty())
+                return {};
+
+            auto item = std::move(mItems.front());
+            mItems.pop_front();
+
+            mNotFull.notify_one();
+
+            return item;
+        }
+
+        void close() {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            mClosed = true;
+
+            mNotFull.notify_all();
+            mNotEmpty.notify_all();
+        }
+
+        void abort() {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            mClosed = true;
+            mItems.clear();
+
+            mNotFull.notify_all();
+            mNotEmpty.notify_all();
+        }
+
+    private:
+        const size_t mCapacity;
+        bool mClosed;
+        std::deque<T> mItems;
+        std::mutex mMutex;
+        std::condition_variable mNotFull;
+        std::condition_variable mNotEmpty;
+    };
+
+    // A source frame and the frame numbers rendered from it, more than one where frames were dropped
+    struct FrameJob {
+        int64_t timestamp;
+        std::vector<int64_t> frameNumbers;
+    };
+
+    struct DecodedJob {
+        const FrameJob* job;
+        std::vector<uint8_t> data;
+        CameraFrameMetadata metadata;
+    };
+
+    struct RenderedJob {
+        const FrameJob* job;
+        std::shared_ptr<std::vector<char>> dng;
+    };
+
+    struct Segment {
+        const char* data;
+        size_t size;
+    };
+
+    std::string getFrameFilename(int64_t frameNumber) {
+        return utils::constructFrameFilename("frame-", static_cast<int>(frameNumber), 6, "dng");
+    }
+
+    // Writes the segments to path in one go, through a temporary file so that an interrupted
+    // write never leaves a file that looks complete
+    void writeFile(const fs::path& path, const std::vector<Segment>& segments) {
+        const auto tmpPath = path.string() + PARTIAL_EXTENSION;
+
+#ifdef _WIN32
+        {
+            std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+
+            for(auto& segment : segments)
+                file.write(segment.data, static_cast<std::streamsize>(segment.size));
+
+            if(!file)
+                throw std::runtime_error("Failed to write " + tmpPath);
+        }
+#else
+        int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+            throw std::runtime_error("Failed to create " + tmpPath + " (error: " + std::strerror(errno) + ")");
+
+        std::vector<iovec> iov;
+
+        for(auto& segment : segments)
+            iov.push_back({ const_cast<char*>(segment.data), segment.size });
+
+        size_t first = 0;
+
+        while(first < iov.size()) {
+            auto written = ::writev(fd, iov.data() + first, static_cast<int>(iov.size() - first));
+
+            if(written < 0) {
+                if(errno == EINTR)
+                    continue;
+
+                const std::string error = std::strerror(errno);
+
+                ::close(fd);
+                ::unlink(tmpPath.c_str());
+
+                throw std::runtime_error("Failed to write " + tmpPath + " (error: " + error + ")");
+            }
+
+            // Short writes can end in the middle of a segment
+            auto remaining = static_cast<size_t>(written);
+
+            while(first < iov.size() && remaining >= iov[first].iov_len) {
+                remaining -= iov[first].iov_len;
+                ++first;
+            }
+
+            if(remaining > 0) {
+                iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + remaining;
+                iov[first].iov_len -= remaining;
+            }
+        }
+
+        if(::close(fd) != 0)
+            throw std::runtime_error("Failed to write " + tmpPath + " (error: " + std::strerror(errno) + ")");
+#endif
+
+        fs::rename(tmpPath, path);
+    }
+
+    void checkSettings(const fs::path& dstFolder, const std::string& settings) {
+        const auto settingsPath = dstFolder / SETTINGS_FILE;
+
+        if(fs::exists(settingsPath)) {
+            std::ifstream file(settingsPath.string());
+            std::string previous;
+
+            std::getline(file, previous);
+
+            if(previous != settings)
+                throw std::runtime_error(
+                    dstFolder.string() + " holds an export with different settings (" + previous + "), choose another folder");
+
+            return;
+        }
+
+        std::ofstream file(settingsPath.string(), std::ios::trunc);
+        file << settings << "\n";
+
+        if(!file)
+            throw std::runtime_error("Failed to write " + settingsPath.string());
+    }
+}
+
+Exporter::Exporter(
+    const std::string& srcFile,
+    const std::string& dstFolder,
+    FileRenderOptions options,
+    int draftScale,
+    unsigned int decodeThreads,
+    unsigned int renderThreads,
+    unsigned int writerThreads) :
+    mSrcFile(srcFile),
+    mDstFolder(dstFolder),
+    mOptions(options),
+    mDraftScale(draftScale),
+    mDecodeThreads(decodeThreads > 0 ? decodeThreads : DEFAULT_DECODE_THREADS),
+    mRenderThreads(renderThreads > 0 ? renderThreads : (std::max)(1u, std::thread::hardware_concurrency())),
+    mWriterThreads(writerThreads > 0 ? writerThreads : DEFAULT_WRITER_THREADS),
+    mCancelled(false)
+{
+}
+
+void Exporter::cancel() {
+    mCancelled = true;
+}
+
+ExportProgress Exporter::run(std::function<void(const ExportProgress&)> onProgress) {
+    auto decoder = openFrameSource(mSrcFile);
+
+    auto frames = decoder->getFrames();
+    std::sort(frames.begin(), frames.end());
+
+    if(frames.empty())
+        throw std::runtime_error("No frames in " + mSrcFile);
+
+    const auto fps = utils::calculateFrameRate(frames);
+    const auto renderConfig = utils::makeRenderConfig(std::make_shared<const CameraConfiguration>(CameraConfiguration::parse(decoder->getContainerMetadata())));
+    const auto scale = (mOptions & RENDER_OPT_DRAFT) ? mDraftScale : 1;
+    const fs::path dstFolder(mDstFolder);
+
+    fs::create_directories(dstFolder);
+
+    checkSettings(dstFolder, optionsToString(mOptions) + " scale=" + std::to_string(scale));
+
+    // Frames already in the folder were completely written by a previous run
+    std::vector<FrameJob> jobs;
+    ExportProgress progress = {};
+
+    for(auto& frameInfo : utils::listFrames(frames, fps)) {
+        ++progress.totalFrames;
+
+        if(fs::exists(dstFolder / getFrameFilename(frameInfo.frameNumber))) {
+            ++progress.framesDone;
+            continue;
+        }
+
+        if(jobs.empty() || jobs.back().timestamp != frameInfo.timestamp)
+            jobs.push_back(FrameJob { frameInfo.timestamp, {} });
+
+        jobs.back().frameNumbers.push_back(frameInfo.frameNumber);
+    }
+
+    const auto framesSkipped = progress.framesDone;
+
+    spdlog::info("Exporting {} to {} ({} of {} frames left, options: {})",
+                 mSrcFile, mDstFolder, progress.totalFrames - framesSkipped, progress.totalFrames, optionsToString(mOptions));
+
+    // Renderers always have a frame waiting, the writers absorb short stalls of the disk
+    BoundedQueue<DecodedJob> decodedFrames(mRenderThreads);
+    BoundedQueue<RenderedJob> renderedFrames(mWriterThreads * 2);
+
+    std::atomic<size_t> nextJob(0);
+    std::atomic<int> activeDecoders(static_cast<int>(mDecodeThreads));
+    std::atomic<int> activeRenderers(static_cast<int>(mRenderThreads));
+    std::atomic<int64_t> framesWritten(0);
+    std::atomic<size_t> bytesWritten(0);
+
+    std::mutex stateMutex;
+    std::condition_variable stateCondition;
+    std::exception_ptr error;
+    int activeWriters = static_cast<int>(mWriterThreads);
+
+    // The first error stops the whole pipeline
+    auto fail = [&](std::exception_ptr e) {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+
+            if(!error)
+                error = e;
+        }
+
+        decodedFrames.abort();
+        renderedFrames.abort();
+
+        stateCondition.notify_all();
+    };
+
+    auto decodeMain = [&]() {
+        try {
+            auto threadDecoder = openFrameSource(mSrcFile);
+
+            while(!mCancelled) {
+                const auto i = nextJob++;
+                if(i >= jobs.size())
+                    break;
+
+                DecodedJob frame;
+                nlohmann::json metadata;
+
+                frame.job = &jobs[i];
+                threadDecoder->loadFrame(jobs[i].timestamp, frame.data, metadata);
+                frame.metadata = CameraFrameMetadata::parseForRender(metadata);
+
+                if(!decodedFrames.push(std::move(frame)))
+                    break;
+            }
+        }
+        catch(...) {
+            fail(std::current_exception());
+        }
+
+        if(--activeDecoders == 0)
+            decodedFrames.close();
+    };
+
+    auto renderMain = [&]() {
+        try {
+            while(auto frame = decodedFrames.pop()) {
+                RenderedJob rendered;
+
+                rendered.job = frame->job;
+                rendered.dng = utils::generateDng(
+                    frame->data,
+                    frame->metadata,
+                    *renderConfig,
+                    fps,
+                    static_cast<int>(frame->job->frameNumbers.front()),
+                    mOptions,
+                    scale);
+
+                if(!renderedFrames.push(std::move(rendered)))
+                    break;
+            }
+        }
+        catch(...) {
+            fail(std::current_exception());
+        }
+
+        if(--activeRenderers == 0)
+            renderedFrames.close();
+    };
+
+    auto writeMain = [&]() {
+        try {
+            while(auto frame = renderedFrames.pop()) {
+                const auto& dng = *frame->dng;
+                const auto timeCodeOffset = utils::findTagValueOffset(dng, utils::DNG_TAG_TIMECODES);
+                const auto& frameNumbers = frame->job->frameNumbers;
+
+                for(size_t i = 0; i < frameNumbers.size(); ++i) {
+                    std::vector<Segment> segments;
+
+                    // Repeated frames are written with their own time code
+                    auto timeCode = utils::getTimeCode(static_cast<int>(frameNumbers[i]), fps);
+
+                    if(i == 0 || timeCodeOffset == 0 || timeCodeOffset + timeCode.size() > dng.size()) {
+                        segments.push_back({ dng.data(), dng.size() });
+                    }
+                    else {
+                        const auto tail = timeCodeOffset + timeCode.size();
+
+                        segments.push_back({ dng.data(), timeCodeOffset });
+                        segments.push_back({ reinterpret_cast<const char*>(timeCode.data()), timeCode.size() });
+                        segments.push_back({ dng.data() + tail, dng.size() - tail });
+                    }
+
+                    writeFile(dstFolder / getFrameFilename(frameNumbers[i]), segments);
+
+                    bytesWritten += dng.size();
+                    ++framesWritten;
+                }
+            }
+        }
+        catch(...) {
+            fail(std::current_exception());
+        }
+
+        std::lock_guard<std::mutex> lock(stateMutex);
+
+        --activeWriters;
+        stateCondition.notify_all();
+    };
+
+    std::vector<std::thread> threads;
+
+    for(unsigned int i = 0; i < mDecodeThreads; ++i)
+        threads.emplace_back(decodeMain);
+
+    for(unsigned int i = 0; i < mRenderThreads; ++i)
+        threads.emplace_back(renderMain);
+
+    for(unsigned int i = 0; i < mWriterThreads; ++i)
+        threads.emplace_back(writeMain);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    auto updateProgress = [&]() {
+        progress.framesWritten = framesWritten;
+        progress.framesDone = framesSkipped + progress.framesWritten;
+        progress.bytesWritten = bytesWritten;
+        progress.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if(progress.elapsedSeconds > 0) {
+            progress.framesPerSecond = progress.framesWritten / progress.elapsedSeconds;
+            progress.megabytesPerSecond = progress.bytesWritten / (1024.0 * 1024.0) / progress.elapsedSeconds;
+        }
+    };
+
+    {
+        std::unique_lock<std::mutex> lock(stateMutex);
+
+        while(activeWriters > 0) {
+            if(stateCondition.wait_for(lock, PROGRESS_INTERVAL, [&] { return activeWriters == 0; }))
+                break;
+
+            // Frames in the queues are dropped, the ones being written are finished
+            if(mCancelled) {
+                decodedFrames.abort();
+                renderedFrames.abort();
+            }
+
+            updateProgress();
+
+            if(onProgress) {
+                lock.unlock();
+                onProgress(progress);
+                lock.lock();
+            }
+        }
+    }
+
+    for(auto& thread : threads)
+        thread.join();
+
+    updateProgress();
+
+    if(error)
+        std::rethrow_exception(error);
+
+    spdlog::info("{} {} frames of {} in {:.1f}s ({:.1f} frames/s, {:.1f} MB/s)",
+                 mCancelled ? "Cancelled after exporting" : "Exported",
+                 progress.framesWritten, mSrcFile, progress.elapsedSeconds,
+                 progress.framesPerSecond, progress.megabytesPerSecond);
+
+    if(onProgress)
+        onProgress(progress);
+
+    return progress;
+}
+
+} // namespace motioncam
@@ -0,0 +1,59 @@
+#include "IFrameSource.h"
+#include "SyntheticFrameSource.h"
+
+#include <motioncam/Decoder.hpp>
+
+namespace motioncam {
+
+namespace {
+    // The decoder keeps an index entry per frame besides the timestamp, roughly this large
+    constexpr size_t INDEX_BYTES_PER_FRAME = 64;
+
+    class DecoderFrameSource : public IFrameSource {
+    public:
+        explicit DecoderFrameSource(const std::string& path) : mDecoder(path) {}
+
+        const std::vector<Timestamp>& getFrames() const override {
+            return mDecoder.getFrames();
+        }
+
+        const nlohmann::json& getContainerMetadata() const override {
+            return mDecoder.getContainerMetadata();
+        }
+
+        void loadFrame(const Timestamp timestamp, std::vector<uint8_t>& outData, nlohmann::json& outMetadata) override {
+            mDecoder.loadFrame(timestamp, outData, outMetadata);
+        }
+
+        int audioSampleRateHz() const override {
+            return mDecoder.audioSampleRateHz();
+        }
+
+        int numAudioChannels() const override {
+            return mDecoder.numAudioChannels();
+        }
+
+        void loadAudio(std::vector<AudioChunk>& outAudioChunks) override {
+            mDecoder.loadAudio(outAudioChunks);
+        }
+
+        // The decoder doesn't report its memory, this counts the frame index and metadata
+        size_t memoryUsage() const override {
+            return sizeof(*this) +
+                mDecoder.getFrames().capacity() * (sizeof(Timestamp) + INDEX_BYTES_PER_FRAME) +
+                mDecoder.getContainerMetadata().dump().size();
+        }
+
+    private:
+        Decoder mDecoder;
+    };
+}
+
+std::unique_ptr<IFrameSource> openFrameSource(const std::string& path) {
+    if(SyntheticFrameSource::isSyntheticPath(path))
+        return std::make_unique<SyntheticFrameSource>(SyntheticClipOptions::parse(path));
+
+    return std::make_unique<DecoderFrameSource>(path);
+}
+
+} // namespace motioncam
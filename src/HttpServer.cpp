@@ -0,0 +1,571 @@
+#include "HttpServer.h"
+#include "IVirtualFileSystem.h"
+#include "Logging.h"
+#include "Metrics.h"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QLocale>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QUrl>
+
+#include <spdlog/spdlog.h>
+#include <BS_thread_pool.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace {
+    constexpr qint64 CHUNK_SIZE = 1024 * 1024;          // Same as the largest read of a mount
+    constexpr qint64 MAX_BUFFERED = 4 * 1024 * 1024;    // Written ahead of what the client has taken
+    constexpr int MAX_HEADER_SIZE = 16 * 1024;
+    constexpr int IO_THREADS = 2;
+
+    // Reads complete on the IO or processing pool, they reach the connection through this so that
+    // a connection closed in the meantime is never touched
+    struct ConnectionGuard {
+        std::mutex mutex;
+        QObject* connection = nullptr;
+    };
+
+    struct Request {
+        QByteArray method;
+        QString path;
+        QHash<QByteArray, QByteArray> headers;
+        bool keepAlive = false;
+    };
+
+    enum class RangeResult {
+        FULL,
+        PARTIAL,
+        UNSATISFIABLE
+    };
+
+    QByteArray httpDate() {
+        return QLocale::c().toString(QDateTime::currentDateTimeUtc(), "ddd, dd MMM yyyy hh:mm:ss 'GMT'").toLatin1();
+    }
+
+    QByteArray contentType(const QString& name) {
+        if(name.endsWith(".dng", Qt::CaseInsensitive))
+            return "image/x-adobe-dng";
+        else if(name.endsWith(".wav", Qt::CaseInsensitive))
+            return "audio/wav";
+
+        return "application/octet-stream";
+    }
+
+    bool parseRequest(const QByteArray& head, Request& request) {
+        const auto lines = head.split('\n');
+        const auto requestLine = lines.front().trimmed().split(' ');
+
+        if(requestLine.size() != 3 || !requestLine[2].startsWith("HTTP/1."))
+            return false;
+
+        for(int i = 1; i < lines.size(); ++i) {
+            const auto separator = lines[i].indexOf(':');
+            if(separator <= 0)
+                return false;
+
+            request.headers[lines[i].left(separator).trimmed().toLower()] = lines[i].mid(separator + 1).trimmed();
+        }
+
+        // Query strings are ignored
+        auto target = requestLine[1];
+        const auto queryStart = target.indexOf('?');
+
+        if(queryStart >= 0)
+            target.truncate(queryStart);
+
+        if(!target.startsWith('/'))
+            return false;
+
+        const auto connection = request.headers.value("connection").toLower();
+
+        request.method = requestLine[0];
+        request.path = QUrl::fromPercentEncoding(target);
+        request.keepAlive = requestLine[2] == "HTTP/1.1" ? !connection.contains("close") : connection.contains("keep-alive");
+
+        return true;
+    }
+
+    // Only a single range is served, anything else gets the whole file as allowed by RFC 9110
+    RangeResult parseRange(const QByteArray& header, qint64 size, qint64& start, qint64& end) {
+        if(header.isEmpty() || !header.startsWith("bytes=") || header.contains(','))
+            return RangeResult::FULL;
+
+        const auto spec = header.mid(6).trimmed();
+        const auto dash = spec.indexOf('-');
+
+        if(dash < 0)
+            return RangeResult::FULL;
+
+        bool ok = false;
+
+        // Suffix range, the last n bytes
+        if(dash == 0) {
+            const auto suffixLength = spec.mid(1).toLongLong(&ok);
+
+            if(!ok || suffixLength < 0)
+                return RangeResult::FULL;
+
+            if(suffixLength == 0 || size == 0)
+                return RangeResult::UNSATISFIABLE;
+
+            start = (std::max)(qint64(0), size - suffixLength);
+            end = size;
+
+            return RangeResult::PARTIAL;
+        }
+
+        start = spec.left(dash).toLongLong(&ok);
+        if(!ok || start < 0)
+            return RangeResult::FULL;
+
+        end = size;
+
+        if(dash + 1 < spec.size()) {
+            const auto last = spec.mid(dash + 1).toLongLong(&ok);
+
+            if(!ok || last < start)
+                return RangeResult::FULL;
+
+            end = (std::min)(last + 1, size);
+        }
+
+        if(start >= size)
+            return RangeResult::UNSATISFIABLE;
+
+        return RangeResult::PARTIAL;
+    }
+
+    class HttpConnection : public QObject {
+    public:
+        HttpConnection(HttpServer& server, BS::thread_pool& ioThreadPool, QTcpSocket* socket);
+        ~HttpConnection();
+
+    private:
+        void processInput();
+        void handleRequest(const Request& request);
+
+        void sendListing(const QString& path, const std::vector<std::pair<QString, QString>>& links, bool headOnly);
+        void sendFile(const Request& request, std::shared_ptr<motioncam::IVirtualFileSystem> fs, const motioncam::Entry& entry);
+        void sendStatus(int status, const QByteArray& reason, const QByteArray& extraHeaders = {});
+
+        void writeHeader(
+            int status, const QByteArray& reason, const QByteArray& type, qint64 contentLength, const QByteArray& extraHeaders = {});
+
+        // Feeds the socket with chunks of the file until MAX_BUFFERED bytes are waiting to be sent
+        void continueFile();
+        void onChunkRead(const std::vector<char>& buffer, size_t readBytes, int errorCode);
+        void finishResponse();
+
+    private:
+        HttpServer& mServer;
+        BS::thread_pool& mIoThreadPool;
+        QTcpSocket* mSocket;
+        std::shared_ptr<ConnectionGuard> mGuard;
+        QByteArray mInput;
+        bool mBusy;
+        bool mKeepAlive;
+
+        // File being sent
+        std::shared_ptr<motioncam::IVirtualFileSystem> mFs;
+        motioncam::Entry mEntry;
+        qint64 mPos;
+        qint64 mEnd;
+        qint64 mBytesSent;
+        bool mReadPending;
+        QElapsedTimer mTimer;
+    };
+
+    HttpConnection::HttpConnection(HttpServer& server, BS::thread_pool& ioThreadPool, QTcpSocket* socket) :
+        QObject(socket),
+        mServer(server),
+        mIoThreadPool(ioThreadPool),
+        mSocket(socket),
+        mGuard(std::make_shared<ConnectionGuard>()),
+        mBusy(false),
+        mKeepAlive(true),
+        mPos(0),
+        mEnd(0),
+        mBytesSent(0),
+        mReadPending(false)
+    {
+        mGuard->connection = this;
+
+        connect(mSocket, &QTcpSocket::readyRead, this, [this] {
+            mInput.append(mSocket->readAll());
+            processInput();
+        });
+
+        connect(mSocket, &QTcpSocket::bytesWritten, this, [this] {
+            if(mFs && !mReadPending)
+                continueFile();
+        });
+    }
+
+    HttpConnection::~HttpConnection() {
+        std::lock_guard<std::mutex> lock(mGuard->mutex);
+
+        mGuard->connection = nullptr;
+    }
+
+    void HttpConnection::processInput() {
+        // Pipelined requests are answered in order, one at a time
+        while(!mBusy && mKeepAlive) {
+            const auto headerEnd = mInput.indexOf("\r\n\r\n");
+
+            if(headerEnd < 0) {
+                if(mInput.size() > MAX_HEADER_SIZE) {
+                    mKeepAlive = false;
+                    sendStatus(431, "Request Header Fields Too Large");
+                }
+
+                return;
+            }
+
+            const auto head = mInput.left(headerEnd).replace("\r", "");
+            mInput.remove(0, headerEnd + 4);
+
+            Request request;
+
+            if(!parseRequest(head, request)) {
+                mKeepAlive = false;
+                sendStatus(400, "Bad Request");
+
+                return;
+            }
+
+            mKeepAlive = request.keepAlive;
+
+            handleRequest(request);
+        }
+    }
+
+    void HttpConnection::handleRequest(const Request& request) {
+        LOG_SAMPLED_DEBUG("HTTP {} {}", request.method.toStdString(), request.path.toStdString());
+
+        // Requests with a body are not expected, close the connection instead of reading it
+        if(request.method != "GET" && request.method != "HEAD") {
+            mKeepAlive = false;
+            sendStatus(405, "Method Not Allowed", "Allow: GET, HEAD\r\n");
+
+            return;
+        }
+
+        const bool headOnly = request.method == "HEAD";
+
+        // Root lists the mounted files
+        if(request.path == "/") {
+            std::vector<std::pair<QString, QString>> links;
+
+            for(auto& name : mServer.fileSystemNames())
+                links.emplace_back(name + "/", name + "/");
+
+            sendListing(request.path, links, headOnly);
+            return;
+        }
+
+        const auto rest = request.path.mid(1);
+        const auto separator = rest.indexOf('/');
+        const auto name = separator < 0 ? rest : rest.left(separator);
+        const auto fileName = separator < 0 ? QString() : rest.mid(separator + 1);
+
+        auto fs = mServer.getFileSystem(name);
+
+        if(!fs) {
+            sendStatus(404, "Not Found");
+            return;
+        }
+
+        // Directories are always addressed with a trailing slash so relative links work
+        if(separator < 0) {
+            sendStatus(301, "Moved Permanently", "Location: /" + QUrl::toPercentEncoding(name) + "/\r\n");
+            return;
+        }
+
+        if(fileName.isEmpty()) {
+            std::vector<std::pair<QString, QString>> links;
+
+            links.emplace_back("../", "../");
+
+            for(auto& entry : fs->listFiles("")) {
+                const auto entryName = QString::fromStdString(entry.name);
+                links.emplace_back(entryName, QString("%1 (%2 bytes)").arg(entryName).arg(entry.size));
+            }
+
+            sendListing(request.path, links, headOnly);
+            return;
+        }
+
+        auto entry = fs->findEntry(fileName.toStdString());
+
+        if(!entry.has_value() || entry->type != motioncam::EntryType::FILE_ENTRY) {
+            sendStatus(404, "Not Found");
+            return;
+        }
+
+        sendFile(request, fs, entry.value());
+    }
+
+    void HttpConnection::sendListing(const QString& path, const std::vector<std::pair<QString, QString>>& links, bool headOnly) {
+        const auto title = QString("Index of %1").arg(path).toHtmlEscaped();
+
+        QByteArray body;
+
+        body += "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>" + title.toUtf8() + "</title></head>\n";
+        body += "<body><h1>" + title.toUtf8() + "</h1>\n<ul>\n";
+
+        for(auto& link : links) {
+            body += "<li><a href=\"" + QUrl::toPercentEncoding(link.first, "/") + "\">";
+            body += link.second.toHtmlEscaped().toUtf8() + "</a></li>\n";
+        }
+
+        body += "</ul></body></html>\n";
+
+        writeHeader(200, "OK", "text/html; charset=utf-8", body.size());
+
+        if(!headOnly)
+            mSocket->write(body);
+
+        finishResponse();
+    }
+
+    void HttpConnection::sendFile(
+        const Request& request, std::shared_ptr<motioncam::IVirtualFileSystem> fs, const motioncam::Entry& entry)
+    {
+        const auto size = static_cast<qint64>(entry.size);
+        const auto name = QString::fromStdString(entry.name);
+
+        qint64 start = 0;
+        qint64 end = size;
+
+        switch(parseRange(request.headers.value("range"), size, start, end)) {
+            case RangeResult::UNSATISFIABLE:
+                sendStatus(416, "Range Not Satisfiable", "Content-Range: bytes */" + QByteArray::number(size) + "\r\n");
+                return;
+
+            case RangeResult::PARTIAL:
+                writeHeader(
+                    206,
+                    "Partial Content",
+                    contentType(name),
+                    end - start,
+                    "Accept-Ranges: bytes\r\nContent-Range: bytes " +
+                        QByteArray::number(start) + "-" + QByteArray::number(end - 1) + "/" + QByteArray::number(size) + "\r\n");
+                break;
+
+            case RangeResult::FULL:
+                start = 0;
+                end = size;
+
+                writeHeader(200, "OK", contentType(name), size, "Accept-Ranges: bytes\r\n");
+                break;
+        }
+
+        if(request.method == "HEAD" || start == end) {
+            finishResponse();
+            return;
+        }
+
+        mFs = std::move(fs);
+        mEntry = entry;
+        mPos = start;
+        mEnd = end;
+        mBytesSent = 0;
+        mTimer.start();
+
+        continueFile();
+    }
+
+    void HttpConnection::sendStatus(int status, const QByteArray& reason, const QByteArray& extraHeaders) {
+        const QByteArray body = QByteArray::number(status) + " " + reason + "\n";
+
+        writeHeader(status, reason, "text/plain; charset=utf-8", body.size(), extraHeaders);
+        mSocket->write(body);
+
+        finishResponse();
+    }
+
+    void HttpConnection::writeHeader(
+        int status, const QByteArray& reason, const QByteArray& type, qint64 contentLength, const QByteArray& extraHeaders)
+    {
+        QByteArray header;
+
+        header += "HTTP/1.1 " + QByteArray::number(status) + " " + reason + "\r\n";
+        header += "Date: " + httpDate() + "\r\n";
+        header += "Server: motioncam-fs\r\n";
+        header += "Content-Type: " + type + "\r\n";
+        header += "Content-Length: " + QByteArray::number(contentLength) + "\r\n";
+        header += mKeepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+        header += extraHeaders;
+        header += "\r\n";
+
+        mBusy = true;
+        mSocket->write(header);
+    }
+
+    void HttpConnection::continueFile() {
+        // One chunk is read at a time, the next is requested once it has been written
+        if(!mFs || mReadPending || mPos >= mEnd || mSocket->bytesToWrite() >= MAX_BUFFERED)
+            return;
+
+        const auto len = static_cast<size_t>((std::min)(CHUNK_SIZE, mEnd - mPos));
+        auto buffer = std::make_shared<std::vector<char>>(len);
+        auto guard = mGuard;
+
+        mReadPending = true;
+
+        // Called from the IO or processing pool, the chunk is handed over on the connection's thread
+        auto result = [guard, buffer](size_t readBytes, int errorCode) {
+            std::lock_guard<std::mutex> lock(guard->mutex);
+
+            auto* connection = static_cast<HttpConnection*>(guard->connection);
+            if(!connection)
+                return;
+
+            QMetaObject::invokeMethod(connection, [connection, buffer, readBytes, errorCode] {
+                connection->onChunkRead(*buffer, readBytes, errorCode);
+                connection->continueFile();
+            }, Qt::QueuedConnection);
+        };
+
+        mIoThreadPool.detach_task([fs = mFs, entry = mEntry, pos = static_cast<size_t>(mPos), len, buffer, result]() {
+            // Anything but a frame is held in memory and read straight away
+            const bool isFrame = std::holds_alternative<motioncam::FrameInfo>(entry.userData);
+
+            try {
+                const auto readBytes = isFrame ?
+                    fs->readFile(entry, pos, len, buffer->data(), result, true) :
+                    fs->readFile(entry, pos, len, buffer->data(), [](size_t, int) {}, false);
+
+                // Frames that aren't cached are answered through result
+                if(readBytes > 0)
+                    result(readBytes, 0);
+                else if(!isFrame || readBytes < 0)
+                    result(0, -1);
+            }
+            catch(std::exception& e) {
+                spdlog::error("Failed to read {} (error: {})", entry.name, e.what());
+                result(0, -1);
+            }
+        });
+    }
+
+    void HttpConnection::onChunkRead(const std::vector<char>& buffer, size_t readBytes, int errorCode) {
+        mReadPending = false;
+
+        // The headers promised more data, all that can be done is to drop the connection
+        if(errorCode != 0 || readBytes == 0) {
+            spdlog::error("Failed to read {} at {} (error: {})", mEntry.name, mPos, errorCode);
+
+            mFs.reset();
+            mSocket->abort();
+
+            return;
+        }
+
+        const auto len = (std::min)(static_cast<qint64>(readBytes), mEnd - mPos);
+
+        mSocket->write(buffer.data(), len);
+        mPos += len;
+        mBytesSent += len;
+
+        if(mPos >= mEnd) {
+            const auto elapsed = std::chrono::nanoseconds(mTimer.nsecsElapsed());
+
+            // Throughput is kept with the mount's metrics, next to the reads through the mount
+            if(auto metrics = mFs->getMetrics())
+                metrics->recordHttpResponse(static_cast<uint64_t>(mBytesSent), elapsed);
+
+            LOG_SAMPLED_DEBUG("Served {} ({} bytes in {:.1f} ms)",
+                              mEntry.name, mBytesSent, std::chrono::duration<double, std::milli>(elapsed).count());
+
+            mFs.reset();
+            finishResponse();
+        }
+    }
+
+    void HttpConnection::finishResponse() {
+        mBusy = false;
+
+        if(!mKeepAlive) {
+            mSocket->disconnectFromHost();
+            return;
+        }
+
+        // Requests that arrived while answering, processed after returning to the event loop
+        QMetaObject::invokeMethod(this, [this] { processInput(); }, Qt::QueuedConnection);
+    }
+}
+
+//
+
+HttpServer::HttpServer(QObject* parent) :
+    QObject(parent),
+    mServer(new QTcpServer(this)),
+    mIoThreadPool(std::make_unique<BS::thread_pool>(IO_THREADS))
+{
+    connect(mServer, &QTcpServer::newConnection, this, &HttpServer::onNewConnection);
+}
+
+HttpServer::~HttpServer() {
+    // Connections belong to the server and go first, reads still queued find them gone
+    delete mServer;
+
+    mIoThreadPool->wait();
+}
+
+bool HttpServer::listen(const QHostAddress& address, quint16 port) {
+    if(!mServer->listen(address, port)) {
+        spdlog::error("Failed to listen on {}:{} (error: {})",
+                      address.toString().toStdString(), port, mServer->errorString().toStdString());
+        return false;
+    }
+
+    spdlog::info("Serving HTTP on http://{}:{}/", address.toString().toStdString(), mServer->serverPort());
+
+    return true;
+}
+
+quint16 HttpServer::serverPort() const {
+    return mServer->serverPort();
+}
+
+void HttpServer::addFileSystem(const QString& name, std::shared_ptr<motioncam::IVirtualFileSystem> fs) {
+    if(mFileSystems.contains(name))
+        spdlog::warn("Replacing {} in the HTTP server", name.toStdString());
+
+    mFileSystems[name] = std::move(fs);
+}
+
+void HttpServer::removeFileSystem(const QString& name) {
+    mFileSystems.remove(name);
+}
+
+std::shared_ptr<motioncam::IVirtualFileSystem> HttpServer::getFileSystem(const QString& name) const {
+    return mFileSystems.value(name);
+}
+
+QStringList HttpServer::fileSystemNames() const {
+    auto names = mFileSystems.keys();
+    names.sort();
+
+    return names;
+}
+
+void HttpServer::onNewConnection() {
+    while(mServer->hasPendingConnections()) {
+        auto* socket = mServer->nextPendingConnection();
+
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
+        // Owned by the socket, which is deleted once closed
+        new HttpConnection(*this, *mIoThreadPool, socket);
+
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    }
+}
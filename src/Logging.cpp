@@ -0,0 +1,95 @@
+#include "Logging.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <spdlog/async.h>
+#include <spdlog/sinks/basic_file_sink.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#ifdef _WIN32
+#include <spdlog/sinks/msvc_sink.h>
+#endif
+
+namespace motioncam {
+
+namespace {
+    constexpr size_t QUEUE_SIZE = 8192;     // Messages waiting to be written
+    constexpr auto FLUSH_INTERVAL = std::chrono::seconds(1);
+    constexpr int64_t SAMPLE_WINDOW_NS = 1000000000;
+}
+
+void setupLogging(const std::string& logFile) {
+    try {
+        // Create a vector of sinks
+        std::vector<spdlog::sink_ptr> sinks;
+
+        // Regular console output
+        sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
+
+        // File sink
+        if(!logFile.empty())
+            sinks.push_back(std::make_shared<spdlog::sinks::basic_file_sink_mt>(logFile, true));
+
+#ifdef _WIN32
+        // For Windows/Visual Studio debugger
+        sinks.push_back(std::make_shared<spdlog::sinks::msvc_sink_mt>());
+#endif
+
+        // One thread writes the messages of all threads
+        spdlog::init_thread_pool(QUEUE_SIZE, 1);
+
+        auto logger = std::make_shared<spdlog::async_logger>(
+            "multi_sink", sinks.begin(), sinks.end(), spdlog::thread_pool(), spdlog::async_overflow_policy::overrun_oldest);
+
+        // Set as default logger
+        spdlog::set_default_logger(logger);
+
+        // Set log level
+#ifdef NDEBUG
+        spdlog::set_level(spdlog::level::info);
+#else
+        spdlog::set_level(spdlog::level::debug);
+#endif
+
+        // Warnings are written straight away, the rest at least once a second
+        spdlog::flush_on(spdlog::level::warn);
+        spdlog::flush_every(FLUSH_INTERVAL);
+
+        // Write what is queued before exiting, the logger thread can't be joined once statics are destroyed
+        static bool registered = false;
+
+        if(!registered) {
+            std::atexit([] { spdlog::shutdown(); });
+            registered = true;
+        }
+    }
+    catch (const spdlog::spdlog_ex& ex) {
+        std::cerr << "Log initialization failed: " << ex.what() << std::endl;
+    }
+}
+
+bool LogSampler::sample(uint64_t& suppressed) {
+    const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    int64_t windowStart = mWindowStartNs.load(std::memory_order_relaxed);
+
+    // Only the thread that moves the window on resets the count
+    if(now - windowStart >= SAMPLE_WINDOW_NS && mWindowStartNs.compare_exchange_strong(windowStart, now, std::memory_order_relaxed))
+        mCount.store(0, std::memory_order_relaxed);
+
+    if(mCount.fetch_add(1, std::memory_order_relaxed) >= MESSAGES_PER_SECOND) {
+        mSuppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    suppressed = mSuppressed.exchange(0, std::memory_order_relaxed);
+
+    return true;
+}
+
+} // namespace motioncam
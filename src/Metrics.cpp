@@ -0,0 +1,300 @@
+#include "Metrics.h"
+
+#include <spdlog/fmt/fmt.h>
+
+#include <algorithm>
+
+namespace motioncam {
+
+namespace {
+    constexpr int SUB_BUCKETS = 1 << LatencyHistogram::SUB_BUCKET_BITS;
+
+    int highestBit(uint64_t value) {
+        int bit = 0;
+
+        while(value >>= 1)
+            ++bit;
+
+        return bit;
+    }
+
+    // Values below SUB_BUCKETS get a bucket each, larger values are split into SUB_BUCKETS
+    // buckets per power of two
+    int bucketIndex(uint64_t value) {
+        if(value < SUB_BUCKETS)
+            return static_cast<int>(value);
+
+        const int bit = highestBit(value);
+        const int subBucket = static_cast<int>(value >> (bit - LatencyHistogram::SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+
+        return ((bit - LatencyHistogram::SUB_BUCKET_BITS + 1) << LatencyHistogram::SUB_BUCKET_BITS) + subBucket;
+    }
+
+    // Middle of the range of values that fall into a bucket
+    double bucketValue(int index) {
+        if(index < SUB_BUCKETS)
+            return index;
+
+        const int bit = (index >> LatencyHistogram::SUB_BUCKET_BITS) + LatencyHistogram::SUB_BUCKET_BITS - 1;
+        const int subBucket = index & (SUB_BUCKETS - 1);
+        const double width = static_cast<double>(uint64_t(1) << (bit - LatencyHistogram::SUB_BUCKET_BITS));
+
+        return (SUB_BUCKETS + subBucket) * width + width / 2;
+    }
+}
+
+const char* stageName(Stage stage) {
+    switch(stage) {
+        case Stage::QUEUE_WAIT:
+            return "queue wait";
+        case Stage::CONTAINER_READ:
+            return "container read";
+        case Stage::DECOMPRESS:
+            return "decompress";
+        case Stage::METADATA_PARSE:
+            return "metadata parse";
+        case Stage::PREPROCESS:
+            return "preprocess";
+        case Stage::PACK:
+            return "pack";
+        case Stage::HEADER_WRITE:
+            return "header write";
+        case Stage::REPLY:
+            return "reply";
+        default:
+            return "unknown";
+    }
+}
+
+const char* memoryName(Memory memory) {
+    switch(memory) {
+        case Memory::RENDERED_FRAMES:
+            return "rendered frames";
+        case Memory::DECODED_FRAMES:
+            return "decoded frames";
+        case Memory::DECODERS:
+            return "decoders";
+        case Memory::AUDIO:
+            return "audio";
+        case Memory::FILE_LIST:
+            return "file list";
+        case Memory::IN_FLIGHT:
+            return "in flight";
+        default:
+            return "unknown";
+    }
+}
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds) {
+    mBuckets[bucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mTotalNs.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    uint64_t maxNs = mMaxNs.load(std::memory_order_relaxed);
+    while(nanoseconds > maxNs && !mMaxNs.compare_exchange_weak(maxNs, nanoseconds, std::memory_order_relaxed))
+        ;
+}
+
+LatencyStats LatencyHistogram::stats() const {
+    std::array<uint64_t, NUM_BUCKETS> buckets;
+    uint64_t count = 0;
+
+    // Counted from the buckets, which may be ahead of mCount while reads are being recorded
+    for(int i = 0; i < NUM_BUCKETS; ++i) {
+        buckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+        count += buckets[i];
+    }
+
+    LatencyStats stats = {};
+
+    stats.count = count;
+    if(count == 0)
+        return stats;
+
+    stats.maxUs = mMaxNs.load(std::memory_order_relaxed) / 1000.0;
+    stats.meanUs = mTotalNs.load(std::memory_order_relaxed) / 1000.0 / (std::max)(mCount.load(std::memory_order_relaxed), uint64_t(1));
+
+    auto percentile = [&](double p) {
+        const auto rank = static_cast<uint64_t>(p * (count - 1));
+        uint64_t seen = 0;
+
+        for(int i = 0; i < NUM_BUCKETS; ++i) {
+            seen += buckets[i];
+
+            if(seen > rank)
+                return (std::min)(bucketValue(i) / 1000.0, stats.maxUs);
+        }
+
+        return stats.maxUs;
+    };
+
+    stats.p50Us = percentile(0.50);
+    stats.p95Us = percentile(0.95);
+    stats.p99Us = percentile(0.99);
+
+    return stats;
+}
+
+void LatencyHistogram::reset() {
+    for(auto& bucket : mBuckets)
+        bucket.store(0, std::memory_order_relaxed);
+
+    mCount = 0;
+    mTotalNs = 0;
+    mMaxNs = 0;
+}
+
+MemoryCounter::MemoryCounter() : mCurrent(0), mPeak(0) {
+}
+
+void MemoryCounter::add(int64_t bytes) {
+    const int64_t current = mCurrent.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+    int64_t peak = mPeak.load(std::memory_order_relaxed);
+    while(current > peak && !mPeak.compare_exchange_weak(peak, current, std::memory_order_relaxed))
+        ;
+}
+
+MemoryStats MemoryCounter::stats() const {
+    // Releases may briefly be counted before the matching allocation on another thread
+    const int64_t current = mCurrent.load(std::memory_order_relaxed);
+    const int64_t peak = mPeak.load(std::memory_order_relaxed);
+
+    return { static_cast<uint64_t>((std::max)(current, int64_t(0))), static_cast<uint64_t>((std::max)(peak, current)) };
+}
+
+void MemoryCounter::resetPeak() {
+    mPeak = mCurrent.load(std::memory_order_relaxed);
+}
+
+void Metrics::record(Stage stage, std::chrono::nanoseconds duration) {
+    mHistograms[static_cast<size_t>(stage)].record(static_cast<uint64_t>((std::max)(duration.count(), int64_t(0))));
+}
+
+LatencyStats Metrics::stats(Stage stage) const {
+    return mHistograms[static_cast<size_t>(stage)].stats();
+}
+
+void Metrics::addMemory(Memory memory, int64_t bytes) {
+    mMemory[static_cast<size_t>(memory)].add(bytes);
+
+    if(memory != Memory::IN_FLIGHT)
+        mTotalMemory.add(bytes);
+}
+
+MemoryStats Metrics::memory(Memory memory) const {
+    return mMemory[static_cast<size_t>(memory)].stats();
+}
+
+MemoryStats Metrics::totalMemory() const {
+    return mTotalMemory.stats();
+}
+
+void Metrics::reset() {
+    for(auto& histogram : mHistograms)
+        histogram.reset();
+
+    for(auto& counter : mMemory)
+        counter.resetPeak();
+
+    mTotalMemory.resetPeak();
+
+    mHttpResponses = 0;
+    mHttpBytes = 0;
+    mHttpNs = 0;
+}
+
+void Metrics::recordHttpResponse(uint64_t bytes, std::chrono::nanoseconds duration) {
+    mHttpResponses.fetch_add(1, std::memory_order_relaxed);
+    mHttpBytes.fetch_add(bytes, std::memory_order_relaxed);
+    mHttpNs.fetch_add(static_cast<uint64_t>((std::max)(duration.count(), std::chrono::nanoseconds::rep(0))), std::memory_order_relaxed);
+}
+
+TransferStats Metrics::httpResponses() const {
+    return {
+        mHttpResponses.load(std::memory_order_relaxed),
+        mHttpBytes.load(std::memory_order_relaxed),
+        mHttpNs.load(std::memory_order_relaxed) / 1e9
+    };
+}
+
+std::string Metrics::format() const {
+    std::string out = fmt::format("{:<16}{:>10}{:>12}{:>12}{:>12}{:>12}{:>12}\n", "stage", "count", "mean ms", "p50 ms", "p95 ms", "p99 ms", "max ms");
+
+    for(size_t i = 0; i < mHistograms.size(); ++i) {
+        const auto s = mHistograms[i].stats();
+        if(s.count == 0)
+            continue;
+
+        out += fmt::format("{:<16}{:>10}{:>12.3f}{:>12.3f}{:>12.3f}{:>12.3f}{:>12.3f}\n",
+                           stageName(static_cast<Stage>(i)), s.count,
+                           s.meanUs / 1000.0, s.p50Us / 1000.0, s.p95Us / 1000.0, s.p99Us / 1000.0, s.maxUs / 1000.0);
+    }
+
+    // Responses are sent one after another on a connection, so this is the rate of a single client
+    const auto http = httpResponses();
+
+    if(http.count > 0) {
+        out += fmt::format("\n{:<16}{:>10}{:>12}{:>12}\n", "http", "responses", "MB", "MB/s");
+        out += fmt::format("{:<16}{:>10}{:>12.1f}{:>12.1f}\n", "", http.count, http.bytes / (1024.0 * 1024.0),
+                           http.seconds > 0 ? http.bytes / (1024.0 * 1024.0) / http.seconds : 0.0);
+    }
+
+    auto formatMemory = [&out](const char* name, const MemoryStats& s) {
+        out += fmt::format("{:<16}{:>12.1f}{:>12.1f}\n", name, s.currentBytes / (1024.0 * 1024.0), s.peakBytes / (1024.0 * 1024.0));
+    };
+
+    out += fmt::format("\n{:<16}{:>12}{:>12}\n", "memory", "MB", "peak MB");
+
+    for(size_t i = 0; i < mMemory.size(); ++i)
+        formatMemory(memoryName(static_cast<Memory>(i)), mMemory[i].stats());
+
+    formatMemory("total", mTotalMemory.stats());
+
+    return out;
+}
+
+TrackedMemory::TrackedMemory(std::shared_ptr<Metrics> metrics, Memory memory, size_t bytes) :
+    mMetrics(std::move(metrics)), mMemory(memory), mBytes(mMetrics ? bytes : 0)
+{
+    if(mMetrics)
+        mMetrics->addMemory(mMemory, static_cast<int64_t>(mBytes));
+}
+
+TrackedMemory::~TrackedMemory() {
+    release();
+}
+
+TrackedMemory::TrackedMemory(TrackedMemory&& other) noexcept :
+    mMetrics(std::move(other.mMetrics)), mMemory(other.mMemory), mBytes(other.mBytes)
+{
+    other.mBytes = 0;
+}
+
+TrackedMemory& TrackedMemory::operator=(TrackedMemory&& other) noexcept {
+    if(this != &other) {
+        release();
+
+        mMetrics = std::move(other.mMetrics);
+        mMemory = other.mMemory;
+        mBytes = other.mBytes;
+
+        other.mBytes = 0;
+    }
+
+    return *this;
+}
+
+void TrackedMemory::release() {
+    if(mMetrics)
+        mMetrics->addMemory(mMemory, -static_cast<int64_t>(mBytes));
+
+    mMetrics.reset();
+    mBytes = 0;
+}
+
+} // namespace motioncam
@@ -0,0 +1,106 @@
+#include "RenderMemoryLimit.h"
+
+#include <algorithm>
+
+namespace motioncam {
+
+RenderMemoryLimit::RenderMemoryLimit(size_t limitBytes) :
+    mLimit(limitBytes), mUsed(0), mPeak(0), mNextTicket(0), mServing(0) {
+}
+
+void RenderMemoryLimit::setLimit(size_t limitBytes) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        mLimit = limitBytes;
+    }
+
+    mCondition.notify_all();
+}
+
+size_t RenderMemoryLimit::limit() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    return mLimit;
+}
+
+MemoryStats RenderMemoryLimit::usage() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    return { mUsed, mPeak };
+}
+
+bool RenderMemoryLimit::fits(size_t bytes) const {
+    return mLimit == 0 || mUsed == 0 || mUsed + bytes <= mLimit;
+}
+
+void RenderMemoryLimit::acquire(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    // Tickets keep a large frame from waiting forever behind smaller ones
+    const uint64_t ticket = mNextTicket++;
+
+    mCondition.wait(lock, [&] { return ticket == mServing && fits(bytes); });
+
+    ++mServing;
+    mUsed += bytes;
+    mPeak = (std::max)(mPeak, mUsed);
+
+    lock.unlock();
+
+    // The next reader in line may fit as well
+    mCondition.notify_all();
+}
+
+bool RenderMemoryLimit::tryAcquire(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // Reads that are waiting go first
+    if(mServing != mNextTicket || !fits(bytes))
+        return false;
+
+    mUsed += bytes;
+    mPeak = (std::max)(mPeak, mUsed);
+
+    return true;
+}
+
+void RenderMemoryLimit::release(size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        mUsed -= (std::min)(bytes, mUsed);
+    }
+
+    mCondition.notify_all();
+}
+
+RenderReservation::RenderReservation(RenderMemoryLimit* limit, std::shared_ptr<Metrics> metrics, size_t bytes, bool wait) :
+    mLimit(limit), mBytes(bytes), mAcquired(true)
+{
+    if(mLimit) {
+        if(wait)
+            mLimit->acquire(mBytes);
+        else
+            mAcquired = mLimit->tryAcquire(mBytes);
+    }
+
+    if(mAcquired)
+        mTracked = TrackedMemory(std::move(metrics), Memory::IN_FLIGHT, mBytes);
+}
+
+RenderReservation::~RenderReservation() {
+    release();
+}
+
+void RenderReservation::release() {
+    if(!mAcquired.exchange(false))
+        return;
+
+    if(mLimit)
+        mLimit->release(mBytes);
+
+    mTracked = TrackedMemory();
+}
+
+} // namespace motioncam
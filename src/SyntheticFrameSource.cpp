@@ -0,0 +1,430 @@
+#include "SyntheticFrameSource.h"
+#include "CameraFrameMetadata.h"
+
+#include <boost/algorithm/string.hpp>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+namespace motioncam {
+
+struct SyntheticClip {
+    SyntheticClipOptions options;
+    std::vector<Timestamp> frames;
+    nlohmann::json containerMetadata;
+    nlohmann::json frameMetadata;
+    std::vector<std::vector<uint8_t>> images;
+    std::vector<AudioChunk> audioChunks;
+};
+
+namespace {
+    constexpr Timestamp FIRST_TIMESTAMP = 1000000000LL;
+    constexpr unsigned short BLACK_LEVEL = 64;
+    constexpr int AUDIO_CHUNK_FRAMES = 1024;
+    constexpr double AUDIO_TONE_HZ = 440.0;
+    constexpr double PI = 3.14159265358979323846;
+
+    const std::array<float, 9> IDENTITY_MATRIX = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+
+    int toInt(const std::string& key, const std::string& value) {
+        try {
+            size_t pos = 0;
+            auto result = std::stoi(value, &pos);
+
+            if(pos == value.size())
+                return result;
+        }
+        catch(const std::exception&) {
+        }
+
+        throw std::runtime_error("Invalid value for " + key + " in synthetic clip: " + value);
+    }
+
+    float toFloat(const std::string& key, const std::string& value) {
+        try {
+            size_t pos = 0;
+            auto result = std::stof(value, &pos);
+
+            if(pos == value.size())
+                return result;
+        }
+        catch(const std::exception&) {
+        }
+
+        throw std::runtime_error("Invalid value for " + key + " in synthetic clip: " + value);
+    }
+
+    // Gain the lens shading map applies at a normalised position, rising towards the corners
+    float shadingGain(float x, float y) {
+        const float dx = x - 0.5f;
+        const float dy = y - 0.5f;
+
+        return 1.0f + 2.0f * (dx * dx + dy * dy);
+    }
+
+    // Cheap deterministic noise so that frames don't compress to nothing in the cache
+    uint32_t nextRandom(uint32_t& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        return state;
+    }
+
+    std::vector<uint8_t> generateImage(const SyntheticClipOptions& options, int index) {
+        const int width = options.width;
+        const int height = options.height;
+        const float whiteLevel = static_cast<float>((1 << options.bits) - 1);
+        const float range = whiteLevel - BLACK_LEVEL;
+
+        std::vector<uint8_t> data(sizeof(uint16_t) * width * height);
+        auto* pixels = reinterpret_cast<uint16_t*>(data.data());
+
+        uint32_t state = options.seed * 2654435761u + static_cast<uint32_t>(index) + 1;
+
+        // Diagonal gradient that moves between frames, darkened by the inverse of the shading map
+        for(int y = 0; y < height; ++y) {
+            const float fy = y / static_cast<float>(height);
+
+            for(int x = 0; x < width; ++x) {
+                const float fx = x / static_cast<float>(width);
+                const float gradient = std::fmod(fx * 0.5f + fy * 0.5f + index * 0.05f, 1.0f);
+                const float vignette = options.shadingMapWidth > 0 ? 1.0f / shadingGain(fx, fy) : 1.0f;
+                const float noise = (nextRandom(state) & 0xFF) / 255.0f * 0.02f;
+
+                const float value = BLACK_LEVEL + range * (0.05f + 0.8f * gradient * vignette + noise);
+
+                pixels[y * width + x] = static_cast<uint16_t>((std::min)(value, whiteLevel));
+            }
+        }
+
+        return data;
+    }
+
+    nlohmann::json generateContainerMetadata(const SyntheticClipOptions& options) {
+        const unsigned short whiteLevel = static_cast<unsigned short>((1 << options.bits) - 1);
+
+        return {
+            { "apertures", { 1.8f } },
+            { "blackLevel", { BLACK_LEVEL, BLACK_LEVEL, BLACK_LEVEL, BLACK_LEVEL } },
+            { "calibrationMatrix1", IDENTITY_MATRIX },
+            { "calibrationMatrix2", IDENTITY_MATRIX },
+            { "colorIlluminant1", "standarda" },
+            { "colorIlluminant2", "d65" },
+            { "colorMatrix1", IDENTITY_MATRIX },
+            { "colorMatrix2", IDENTITY_MATRIX },
+            { "focalLengths", { 4.7f } },
+            { "forwardMatrix1", IDENTITY_MATRIX },
+            { "forwardMatrix2", IDENTITY_MATRIX },
+            { "numSegments", 1 },
+            { "sensorArrangement", options.sensorArrangement },
+            { "whiteLevel", whiteLevel },
+            { "deviceSpecificProfile", {
+                { "cameraId", "0" },
+                { "deviceModel", "Synthetic" },
+                { "disableShadingMap", false }
+            } },
+            { "extraData", {
+                { "audioChannels", options.audioChannels },
+                { "audioSampleRate", options.audioSampleRate },
+                { "recordingType", "raw" },
+                { "postProcessSettings", {
+                    { "flipped", false },
+                    { "metadata", { { "build.model", "Synthetic" } } }
+                } }
+            } }
+        };
+    }
+
+    // Metadata shared by all frames, the timestamp is filled in when a frame is loaded
+    nlohmann::json generateFrameMetadata(const SyntheticClipOptions& options) {
+        const unsigned short whiteLevel = static_cast<unsigned short>((1 << options.bits) - 1);
+
+        auto shadingMap = nlohmann::json::array();
+
+        if(options.shadingMapWidth > 0) {
+            std::vector<float> channel(options.shadingMapWidth * options.shadingMapHeight);
+
+            for(int y = 0; y < options.shadingMapHeight; ++y) {
+                for(int x = 0; x < options.shadingMapWidth; ++x) {
+                    channel[y * options.shadingMapWidth + x] = shadingGain(
+                        x / static_cast<float>(options.shadingMapWidth - 1),
+                        y / static_cast<float>(options.shadingMapHeight - 1));
+                }
+            }
+
+            for(int c = 0; c < 4; ++c)
+                shadingMap.push_back(channel);
+        }
+
+        return {
+            { "asShotNeutral", { 0.5f, 1.0f, 0.6f } },
+            { "dynamicBlackLevel", { BLACK_LEVEL, BLACK_LEVEL, BLACK_LEVEL, BLACK_LEVEL } },
+            { "dynamicWhiteLevel", whiteLevel },
+            { "exposureTime", 1e9 / (2 * options.fps) },
+            { "iso", 100 },
+            { "width", options.width },
+            { "height", options.height },
+            { "originalWidth", options.width },
+            { "originalHeight", options.height },
+            { "rowStride", options.width * 2 },
+            { "orientation", static_cast<int>(ScreenOrientation::LANDSCAPE) },
+            { "lensShadingMap", shadingMap },
+            { "lensShadingMapWidth", options.shadingMapWidth },
+            { "lensShadingMapHeight", options.shadingMapHeight },
+            { "pixelFormat", "raw16" },
+            { "type", "raw" }
+        };
+    }
+
+    // Continuous tone covering the whole clip, starting with the first frame
+    std::vector<AudioChunk> generateAudio(const SyntheticClipOptions& options, const std::vector<Timestamp>& frames) {
+        std::vector<AudioChunk> chunks;
+
+        if(options.audioChannels <= 0 || frames.empty())
+            return chunks;
+
+        const double durationSeconds = (frames.back() - frames.front()) / 1e9 + 1.0 / options.fps;
+        const auto totalFrames = static_cast<int64_t>(durationSeconds * options.audioSampleRate);
+
+        for(int64_t start = 0; start < totalFrames; start += AUDIO_CHUNK_FRAMES) {
+            const auto numFrames = (std::min)(static_cast<int64_t>(AUDIO_CHUNK_FRAMES), totalFrames - start);
+            const auto timestamp = frames.front() + static_cast<Timestamp>(start * 1e9 / options.audioSampleRate);
+
+            std::vector<int16_t> samples(numFrames * options.audioChannels);
+
+            for(int64_t i = 0; i < numFrames; ++i) {
+                const double t = (start + i) / static_cast<double>(options.audioSampleRate);
+                const auto value = static_cast<int16_t>(8192 * std::sin(2 * PI * AUDIO_TONE_HZ * t));
+
+                for(int c = 0; c < options.audioChannels; ++c)
+                    samples[i * options.audioChannels + c] = value;
+            }
+
+            chunks.emplace_back(timestamp, std::move(samples));
+        }
+
+        return chunks;
+    }
+
+    std::shared_ptr<const SyntheticClip> generateClip(const SyntheticClipOptions& options) {
+        spdlog::info("Generating synthetic clip {}", options.toPath());
+
+        auto clip = std::make_shared<SyntheticClip>();
+
+        clip->options = options;
+
+        // Dropped frames leave a gap in the timestamps, like a recording that couldn't keep up
+        const double frameDuration = 1e9 / options.fps;
+
+        for(int64_t slot = 0; static_cast<int>(clip->frames.size()) < options.numFrames; ++slot) {
+            if(options.dropEvery > 0 && (slot + 1) % options.dropEvery == 0)
+                continue;
+
+            clip->frames.push_back(FIRST_TIMESTAMP + static_cast<Timestamp>(std::llround(slot * frameDuration)));
+        }
+
+        clip->containerMetadata = generateContainerMetadata(options);
+        clip->frameMetadata = generateFrameMetadata(options);
+
+        const auto numImages = (std::max)(1, (std::min)(options.distinctFrames, options.numFrames));
+
+        for(int i = 0; i < numImages; ++i)
+            clip->images.push_back(generateImage(options, i));
+
+        clip->audioChunks = generateAudio(options, clip->frames);
+
+        return clip;
+    }
+
+    // Clips are kept for as long as a source uses them
+    std::shared_ptr<const SyntheticClip> getClip(const SyntheticClipOptions& options) {
+        static std::mutex mutex;
+        static std::map<std::string, std::weak_ptr<const SyntheticClip>> clips;
+
+        const auto key = options.toPath();
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto clip = clips[key].lock();
+        if(!clip) {
+            clip = generateClip(options);
+            clips[key] = clip;
+        }
+
+        return clip;
+    }
+}
+
+SyntheticClipOptions SyntheticClipOptions::parse(const std::string& path) {
+    if(!SyntheticFrameSource::isSyntheticPath(path))
+        throw std::runtime_error("Not a synthetic clip: " + path);
+
+    SyntheticClipOptions options;
+
+    auto spec = path.substr(std::string(SyntheticFrameSource::PATH_PREFIX).size());
+    auto queryStart = spec.find('?');
+
+    if(queryStart != std::string::npos) {
+        const auto query = spec.substr(queryStart + 1);
+        std::vector<std::string> params;
+
+        boost::split(params, query, boost::is_any_of("&"), boost::token_compress_on);
+
+        for(auto& param : params) {
+            if(param.empty())
+                continue;
+
+            auto separator = param.find('=');
+            if(separator == std::string::npos)
+                throw std::runtime_error("Invalid parameter in synthetic clip: " + param);
+
+            const auto key = param.substr(0, separator);
+            const auto value = param.substr(separator + 1);
+
+            if(key == "width")
+                options.width = toInt(key, value);
+            else if(key == "height")
+                options.height = toInt(key, value);
+            else if(key == "frames")
+                options.numFrames = toInt(key, value);
+            else if(key == "fps")
+                options.fps = toFloat(key, value);
+            else if(key == "drop")
+                options.dropEvery = toInt(key, value);
+            else if(key == "audio")
+                options.audioChannels = toInt(key, value);
+            else if(key == "rate")
+                options.audioSampleRate = toInt(key, value);
+            else if(key == "cfa")
+                options.sensorArrangement = boost::to_lower_copy(value);
+            else if(key == "bits")
+                options.bits = toInt(key, value);
+            else if(key == "shading") {
+                // Width x height of the map, or 0 for none
+                auto x = value.find('x');
+
+                if(x == std::string::npos) {
+                    options.shadingMapWidth = toInt(key, value);
+                    options.shadingMapHeight = options.shadingMapWidth;
+                }
+                else {
+                    options.shadingMapWidth = toInt(key, value.substr(0, x));
+                    options.shadingMapHeight = toInt(key, value.substr(x + 1));
+                }
+            }
+            else if(key == "distinct")
+                options.distinctFrames = toInt(key, value);
+            else if(key == "seed")
+                options.seed = static_cast<unsigned int>(toInt(key, value));
+            else
+                throw std::runtime_error("Unknown parameter in synthetic clip: " + key);
+        }
+
+        spec = spec.substr(0, queryStart);
+    }
+
+    if(!spec.empty())
+        options.name = spec;
+
+    // Frames are processed in 2x2 Bayer blocks and packed 4 pixels at a time
+    if(options.width < 16 || options.height < 16 || options.width % 4 != 0 || options.height % 4 != 0)
+        throw std::runtime_error("Synthetic clip dimensions must be multiples of 4 and at least 16");
+
+    if(options.numFrames < 1 || options.fps <= 0 || options.dropEvery < 0 || options.dropEvery == 1 || options.distinctFrames < 1)
+        throw std::runtime_error("Invalid frame settings in synthetic clip");
+
+    if(options.audioChannels < 0 || (options.audioChannels > 0 && options.audioSampleRate <= 0))
+        throw std::runtime_error("Invalid audio settings in synthetic clip");
+
+    if(options.bits < 10 || options.bits > 16)
+        throw std::runtime_error("Synthetic clip bits must be between 10 and 16");
+
+    const auto& cfa = options.sensorArrangement;
+    if(cfa != "rggb" && cfa != "bggr" && cfa != "grbg" && cfa != "gbrg")
+        throw std::runtime_error("Invalid sensor arrangement in synthetic clip: " + cfa);
+
+    const bool hasShadingMap = options.shadingMapWidth > 0 || options.shadingMapHeight > 0;
+    if(hasShadingMap && (options.shadingMapWidth < 2 || options.shadingMapHeight < 2))
+        throw std::runtime_error("Synthetic clip shading map must be at least 2x2");
+
+    return options;
+}
+
+std::string SyntheticClipOptions::toPath() const {
+    std::ostringstream path;
+
+    path << SyntheticFrameSource::PATH_PREFIX << name
+         << "?width=" << width
+         << "&height=" << height
+         << "&frames=" << numFrames
+         << "&fps=" << fps
+         << "&drop=" << dropEvery
+         << "&audio=" << audioChannels
+         << "&rate=" << audioSampleRate
+         << "&cfa=" << sensorArrangement
+         << "&bits=" << bits
+         << "&shading=" << shadingMapWidth << "x" << shadingMapHeight
+         << "&distinct=" << distinctFrames
+         << "&seed=" << seed;
+
+    return path.str();
+}
+
+//
+
+bool SyntheticFrameSource::isSyntheticPath(const std::string& path) {
+    return boost::starts_with(path, PATH_PREFIX);
+}
+
+SyntheticFrameSource::SyntheticFrameSource(const SyntheticClipOptions& options) :
+    mClip(getClip(options))
+{
+}
+
+const std::vector<Timestamp>& SyntheticFrameSource::getFrames() const {
+    return mClip->frames;
+}
+
+const nlohmann::json& SyntheticFrameSource::getContainerMetadata() const {
+    return mClip->containerMetadata;
+}
+
+void SyntheticFrameSource::loadFrame(const Timestamp timestamp, std::vector<uint8_t>& outData, nlohmann::json& outMetadata) {
+    const auto& frames = mClip->frames;
+    const auto it = std::lower_bound(frames.begin(), frames.end(), timestamp);
+
+    if(it == frames.end() || *it != timestamp)
+        throw std::runtime_error("Frame " + std::to_string(timestamp) + " not found in synthetic clip");
+
+    const auto index = static_cast<size_t>(it - frames.begin());
+
+    outData = mClip->images[index % mClip->images.size()];
+
+    outMetadata = mClip->frameMetadata;
+    outMetadata["timestamp"] = std::to_string(timestamp);
+}
+
+int SyntheticFrameSource::audioSampleRateHz() const {
+    return mClip->options.audioSampleRate;
+}
+
+int SyntheticFrameSource::numAudioChannels() const {
+    return mClip->options.audioChannels;
+}
+
+void SyntheticFrameSource::loadAudio(std::vector<AudioChunk>& outAudioChunks) {
+    outAudioChunks = mClip->audioChunks;
+}
+
+size_t SyntheticFrameSource::memoryUsage() const {
+    return sizeof(*this);
+}
+
+} // namespace motioncam
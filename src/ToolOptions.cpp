@@ -0,0 +1,60 @@
+#include "ToolOptions.h"
+
+#include <stdexcept>
+
+namespace motioncam {
+namespace tools {
+
+int toInt(const std::string& option, const std::string& value, int minValue) {
+    int result;
+
+    try {
+        size_t pos = 0;
+        result = std::stoi(value, &pos);
+
+        if(pos != value.size())
+            throw std::invalid_argument(value);
+    }
+    catch(const std::exception&) {
+        throw std::runtime_error("Invalid value for " + option + ": " + value);
+    }
+
+    if(result < minValue)
+        throw std::runtime_error("Invalid value for " + option + ": " + value);
+
+    return result;
+}
+
+int toDraftScale(const std::string& option, const std::string& value) {
+    const int scale = toInt(option, value, 1);
+
+    if(scale != 2 && scale != 4 && scale != 8)
+        throw std::runtime_error("Draft scale must be 2, 4 or 8");
+
+    return scale;
+}
+
+bool parseRenderOption(const std::string& option, FileRenderOptions& renderOptions) {
+    if(option == "--vignette-correction")
+        renderOptions |= RENDER_OPT_APPLY_VIGNETTE_CORRECTION;
+    else if(option == "--normalize-shading-map")
+        renderOptions |= RENDER_OPT_NORMALIZE_SHADING_MAP;
+    else
+        return false;
+
+    return true;
+}
+
+nlohmann::json toJson(const LatencyStats& stats) {
+    return {
+        { "count", stats.count },
+        { "mean_ms", stats.meanUs / 1000.0 },
+        { "p50_ms", stats.p50Us / 1000.0 },
+        { "p95_ms", stats.p95Us / 1000.0 },
+        { "p99_ms", stats.p99Us / 1000.0 },
+        { "max_ms", stats.maxUs / 1000.0 }
+    };
+}
+
+} // namespace tools
+} // namespace motioncam
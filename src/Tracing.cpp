@@ -0,0 +1,174 @@
+#include "Tracing.h"
+
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace motioncam {
+
+namespace {
+    // Events kept per thread, later events are dropped so a forgotten trace can't use up memory
+    constexpr size_t MAX_EVENTS_PER_THREAD = 1 << 20;
+
+    struct TraceEvent {
+        const char* name;
+        int64_t startNs;
+        int64_t durationNs;
+        uint64_t readId;
+        TraceFlow flow;
+    };
+
+    // Only the owning thread adds events, the mutex is there for start() and write()
+    struct ThreadEvents {
+        std::mutex mutex;
+        std::vector<TraceEvent> events;
+        size_t numDropped = 0;
+        int tid = 0;
+    };
+
+    std::mutex gThreadsMutex;
+    std::vector<std::shared_ptr<ThreadEvents>> gThreads;   // Kept after threads exit
+    std::atomic<int64_t> gStartNs(0);
+    std::atomic<uint64_t> gNextReadId(1);
+
+    ThreadEvents& getThreadEvents() {
+        thread_local std::shared_ptr<ThreadEvents> threadEvents;
+
+        if(!threadEvents) {
+            threadEvents = std::make_shared<ThreadEvents>();
+
+            std::lock_guard<std::mutex> lock(gThreadsMutex);
+
+            threadEvents->tid = static_cast<int>(gThreads.size()) + 1;
+            gThreads.push_back(threadEvents);
+        }
+
+        return *threadEvents;
+    }
+
+    const char* flowPhase(TraceFlow flow) {
+        switch(flow) {
+            case TraceFlow::BEGIN:
+                return "s";
+            case TraceFlow::STEP:
+                return "t";
+            case TraceFlow::END:
+                return "f";
+            default:
+                return nullptr;
+        }
+    }
+}
+
+void Trace::start() {
+    {
+        std::lock_guard<std::mutex> lock(gThreadsMutex);
+
+        for(auto& thread : gThreads) {
+            std::lock_guard<std::mutex> threadLock(thread->mutex);
+
+            thread->events.clear();
+            thread->numDropped = 0;
+        }
+    }
+
+    gStartNs = TraceSpan::now();
+    sEnabled = true;
+
+    spdlog::info("Tracing started");
+}
+
+void Trace::stop() {
+    sEnabled = false;
+
+    spdlog::info("Tracing stopped");
+}
+
+void Trace::write(const std::string& path) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if(!out)
+        throw std::runtime_error("Failed to open " + path);
+
+    const int64_t startNs = gStartNs;
+    size_t numEvents = 0;
+    size_t numDropped = 0;
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << R"({"name":"process_name","ph":"M","pid":1,"tid":0,"args":{"name":"motioncam-fs"}})";
+
+    std::lock_guard<std::mutex> lock(gThreadsMutex);
+
+    for(auto& thread : gThreads) {
+        std::vector<TraceEvent> events;
+
+        {
+            std::lock_guard<std::mutex> threadLock(thread->mutex);
+
+            events = thread->events;
+            numDropped += thread->numDropped;
+        }
+
+        for(const auto& e : events) {
+            const double ts = (e.startNs - startNs) / 1000.0;
+
+            out << fmt::format(",\n{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}",
+                               e.name, thread->tid, ts, e.durationNs / 1000.0);
+
+            if(e.readId != 0)
+                out << fmt::format(",\"args\":{{\"read\":{}}}", e.readId);
+
+            out << "}";
+
+            // Flow events bind to the span they start in and draw an arrow between the spans of a read
+            const char* phase = flowPhase(e.flow);
+
+            if(phase && e.readId != 0) {
+                out << fmt::format(",\n{{\"name\":\"read\",\"cat\":\"read\",\"ph\":\"{}\",\"id\":{},\"pid\":1,\"tid\":{},\"ts\":{:.3f}{}}}",
+                                   phase, e.readId, thread->tid, ts, e.flow == TraceFlow::END ? ",\"bp\":\"e\"" : "");
+            }
+        }
+
+        numEvents += events.size();
+    }
+
+    out << "\n]}\n";
+    out.close();
+
+    if(!out)
+        throw std::runtime_error("Failed to write " + path);
+
+    spdlog::info("Wrote {} trace events to {} ({} dropped)", numEvents, path, numDropped);
+}
+
+uint64_t Trace::newReadId() {
+    if(!isEnabled())
+        return 0;
+
+    return gNextReadId.fetch_add(1, std::memory_order_relaxed);
+}
+
+int64_t TraceSpan::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void TraceSpan::record() {
+    const int64_t endNs = now();
+    auto& thread = getThreadEvents();
+
+    std::lock_guard<std::mutex> lock(thread.mutex);
+
+    if(thread.events.size() >= MAX_EVENTS_PER_THREAD) {
+        ++thread.numDropped;
+        return;
+    }
+
+    thread.events.push_back({ mName, mStartNs, endNs - mStartNs, mReadId, mFlow });
+}
+
+} // namespace motioncam
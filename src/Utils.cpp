@@ -6,6 +6,8 @@
 
 #include <algorithm>
 #include <cmath>
+#include <iomanip>
+#include <sstream>
 
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/device/back_inserter.hpp>
@@ -101,34 +103,8 @@ namespace {
             return lsUnknown;
     }
 
-    void normalizeShadingMap(std::vector<std::vector<float>>& shadingMap) {
-        if (shadingMap.empty() || shadingMap[0].empty()) {
-            return; // Handle empty case
-        }
-
-        // Find the maximum value
-        float maxValue = 0.0f;
-        for (const auto& row : shadingMap) {
-            for (float value : row) {
-                maxValue = std::max(maxValue, value);
-            }
-        }
-
-        // Avoid division by zero
-        if (maxValue == 0.0f) {
-            return;
-        }
-
-        // Normalize all values
-        for (auto& row : shadingMap) {
-            for (float& value : row) {
-                value /= maxValue;
-            }
-        }
-    }
-
     inline float getShadingMapValue(
-        float x, float y, int channel, const std::vector<std::vector<float>>& lensShadingMap, int lensShadingMapWidth, int lensShadingMapHeight)
+        float x, float y, const float* gains, int lensShadingMapWidth, int lensShadingMapHeight)
     {
         // Clamp input coordinates to [0, 1] range
         x = std::max(0.0f, std::min(1.0f, x));
@@ -149,10 +125,10 @@ namespace {
         const float wy = mapY - y0;  // Weight for y-direction interpolation
 
         // Get the four surrounding pixel values
-        const float val00 = lensShadingMap[channel][y0*lensShadingMapWidth+x0];  // Top-left
-        const float val01 = lensShadingMap[channel][y0*lensShadingMapWidth+x1];  // Top-right
-        const float val10 = lensShadingMap[channel][y1*lensShadingMapWidth+x0];  // Bottom-left
-        const float val11 = lensShadingMap[channel][y1*lensShadingMapWidth+x1];  // Bottom-right
+        const float val00 = gains[y0*lensShadingMapWidth+x0];  // Top-left
+        const float val01 = gains[y0*lensShadingMapWidth+x1];  // Top-right
+        const float val10 = gains[y1*lensShadingMapWidth+x0];  // Bottom-left
+        const float val11 = gains[y1*lensShadingMapWidth+x1];  // Bottom-right
 
         // Perform bilinear interpolation
         const float valTop = val00 * (1.0f - wx) + val01 * wx;     // Interpolation at y0
@@ -168,8 +144,6 @@ void encodeTo10Bit(
     uint32_t& width,
     uint32_t& height)
 {
-    Measure m("encodeTo10Bit");
-
     uint16_t* srcPtr = reinterpret_cast<uint16_t*>(data.data());
     uint8_t* dstPtr = data.data();
 
@@ -202,8 +176,6 @@ void encodeTo12Bit(
     uint32_t& width,
     uint32_t& height)
 {
-    Measure m("encodeTo12Bit");
-
     uint16_t* srcPtr = reinterpret_cast<uint16_t*>(data.data());
     uint8_t* dstPtr = data.data();
 
@@ -231,8 +203,6 @@ void encodeTo14Bit(
     uint32_t& width,
     uint32_t& height)
 {
-    Measure m("encodeTo14Bit");
-
     uint16_t* srcPtr = reinterpret_cast<uint16_t*>(data.data());
     uint8_t* dstPtr = data.data();
 
@@ -263,15 +233,15 @@ void encodeTo14Bit(
 }
 
 std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short> preprocessData(
-    std::vector<uint8_t>& data,
+    const std::vector<uint8_t>& data,
     uint32_t& inOutWidth,
     uint32_t& inOutHeight,
     const CameraFrameMetadata& metadata,
     const CameraConfiguration& cameraConfiguration,
     const std::array<uint8_t, 4>& cfa,
     uint32_t scale,
-    bool applyShadingMap=true,
-    bool normaliseShadingMap=false)
+    bool applyShadingMap,
+    bool normaliseShadingMap)
 {
     if (scale > 1) {
         // Ensure even scale for downscaling
@@ -303,9 +273,13 @@ std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short>
     std::array<unsigned short, 4> dstBlackLevel = srcBlackLevel;
     float dstWhiteLevel = srcWhiteLevel;
 
-    // Calculate shading map offsets
-    auto lensShadingMap = metadata.lensShadingMap;
+    // Frames without a usable shading map are rendered without one
+    const ShadingMap* lensShadingMap = metadata.lensShadingMap.get();
+
+    if(!lensShadingMap || lensShadingMap->numChannels < 4)
+        applyShadingMap = false;
 
+    // Calculate shading map offsets
     const int fullWidth = metadata.originalWidth;
     const int fullHeight = metadata.originalHeight;
 
@@ -315,17 +289,25 @@ std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short>
     const float shadingMapScaleX = 1.0f / static_cast<float>(fullWidth);
     const float shadingMapScaleY = 1.0f / static_cast<float>(fullHeight);
 
+    // Gain planes of the shared map, normalized ones are computed once per map
+    std::array<const float*, 4> shadingGains = {};
+    int shadingMapWidth = 0;
+    int shadingMapHeight = 0;
+
     // When applying shading map, increase precision
     if(applyShadingMap) {
+        for(int c = 0; c < 4; ++c)
+            shadingGains[c] = lensShadingMap->channel(c, normaliseShadingMap);
+
+        shadingMapWidth = lensShadingMap->width;
+        shadingMapHeight = lensShadingMap->height;
+
         int srcBits = bitsNeeded(static_cast<unsigned short>(cameraConfiguration.whiteLevel));
         int useBits = std::min(16, srcBits + 4);
 
         dstWhiteLevel = std::pow(2.0f, useBits) - 1;
         for(auto& v : dstBlackLevel)
             v <<= (useBits - srcBits);
-
-        if(normaliseShadingMap)
-            normalizeShadingMap(lensShadingMap);
     }
 
     //
@@ -336,7 +318,7 @@ std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short>
     uint32_t dstOffset = 0;
 
     // Reinterpret the input data as uint16_t for reading
-    uint16_t* srcData = reinterpret_cast<uint16_t*>(data.data());
+    const uint16_t* srcData = reinterpret_cast<const uint16_t*>(data.data());
 
     // Process the image by copying and packing 2x2 Bayer blocks
     std::array<float, 4> shadingMapVals { 1.0f, 1.0f, 1.0f, 1.0f };
@@ -363,10 +345,10 @@ std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short>
 
                 // Calculate shading map
                 shadingMapVals = {
-                    getShadingMapValue(sx, sy, 0, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight),
-                    getShadingMapValue(sx, sy, 1, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight),
-                    getShadingMapValue(sx, sy, 2, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight),
-                    getShadingMapValue(sx, sy, 3, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight)
+                    getShadingMapValue(sx, sy, shadingGains[0], shadingMapWidth, shadingMapHeight),
+                    getShadingMapValue(sx, sy, shadingGains[1], shadingMapWidth, shadingMapHeight),
+                    getShadingMapValue(sx, sy, shadingGains[2], shadingMapWidth, shadingMapHeight),
+                    getShadingMapValue(sx, sy, shadingGains[3], shadingMapWidth, shadingMapHeight)
                 };
             }
 
@@ -400,66 +382,89 @@ std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short>
     return std::make_tuple(dst, dstBlackLevel, static_cast<unsigned short>(dstWhiteLevel));
 }
 
+std::shared_ptr<const RenderConfig> makeRenderConfig(std::shared_ptr<const CameraConfiguration> cameraConfiguration) {
+    auto renderConfig = std::make_shared<RenderConfig>();
+    auto& cfa = renderConfig->cfa;
+
+    if(cameraConfiguration->sensorArrangement == "rggb")
+        cfa = { 0, 1, 1, 2 };
+    else if(cameraConfiguration->sensorArrangement == "bggr")
+        cfa = { 2, 1, 1, 0 };
+    else if(cameraConfiguration->sensorArrangement == "grbg")
+        cfa = { 1, 0, 2, 1 };
+    else if(cameraConfiguration->sensorArrangement == "gbrg")
+        cfa = { 1, 2, 0, 1 };
+    else
+        throw std::runtime_error("Invalid sensor arrangement");
+
+    renderConfig->colorIlluminant1 = getColorIlluminant(cameraConfiguration->colorIlluminant1);
+    renderConfig->colorIlluminant2 = getColorIlluminant(cameraConfiguration->colorIlluminant2);
+    renderConfig->cameraConfiguration = std::move(cameraConfiguration);
+
+    return renderConfig;
+}
+
 std::shared_ptr<std::vector<char>> generateDng(
-    std::vector<uint8_t>& data,
+    const std::vector<uint8_t>& data,
     const CameraFrameMetadata& metadata,
-    const CameraConfiguration& cameraConfiguration,
+    const RenderConfig& renderConfig,
     float recordingFps,
     int frameNumber,
     FileRenderOptions options,
-    int scale)
+    int scale,
+    Metrics* metrics)
 {
-    Measure m("generateDng");
-
     unsigned int width = metadata.width;
     unsigned int height = metadata.height;
 
-    std::array<uint8_t, 4> cfa;
-
-    if(cameraConfiguration.sensorArrangement == "rggb")
-        cfa = { 0, 1, 1, 2 };
-    else if(cameraConfiguration.sensorArrangement == "bggr")
-        cfa = { 2, 1, 1, 0 };
-    else if(cameraConfiguration.sensorArrangement == "grbg")
-        cfa = { 1, 0, 2, 1 };
-    else if(cameraConfiguration.sensorArrangement == "gbrg")
-        cfa = { 1, 2, 0, 1 };
-    else
-        throw std::runtime_error("Invalid sensor arrangement");
+    const auto& cameraConfiguration = *renderConfig.cameraConfiguration;
+    const auto& cfa = renderConfig.cfa;
 
     // Scale down if requested
     bool applyShadingMap = options & RENDER_OPT_APPLY_VIGNETTE_CORRECTION;
     bool normalizeShadingMap = options & RENDER_OPT_NORMALIZE_SHADING_MAP;
 
-    auto [processedData, dstBlackLevel, dstWhiteLevel] = utils::preprocessData(
-        data,
-        width, height,
-        metadata,
-        cameraConfiguration,
-        cfa,
-        scale,
-        applyShadingMap, normalizeShadingMap);
+    std::vector<uint8_t> processedData;
+    std::array<unsigned short, 4> dstBlackLevel;
+    unsigned short dstWhiteLevel;
+
+    {
+        Measure m(metrics, Stage::PREPROCESS);
+
+        std::tie(processedData, dstBlackLevel, dstWhiteLevel) = utils::preprocessData(
+            data,
+            width, height,
+            metadata,
+            cameraConfiguration,
+            cfa,
+            scale,
+            applyShadingMap, normalizeShadingMap);
+    }
 
-    spdlog::debug("New black level {},{},{},{} and white level {}",
+    SPDLOG_DEBUG("New black level {},{},{},{} and white level {}",
                   dstBlackLevel[0], dstBlackLevel[1], dstBlackLevel[2], dstBlackLevel[3], dstWhiteLevel);
 
     // Encode to reduce size in container
     auto encodeBits = bitsNeeded(dstWhiteLevel);
 
-    if(encodeBits <= 10) {
-        utils::encodeTo10Bit(processedData, width, height);
-        encodeBits = 10;
-    }
-    else if(encodeBits <= 12) {
-        utils::encodeTo12Bit(processedData, width, height);
-        encodeBits = 12;
-    }
-    else if(encodeBits <= 14) {
-        utils::encodeTo14Bit(processedData, width, height);
-        encodeBits = 14;
-    }
-    else {
-        encodeBits = 16;
+    {
+        Measure m(metrics, Stage::PACK);
+
+        if(encodeBits <= 10) {
+            utils::encodeTo10Bit(processedData, width, height);
+            encodeBits = 10;
+        }
+        else if(encodeBits <= 12) {
+            utils::encodeTo12Bit(processedData, width, height);
+            encodeBits = 12;
+        }
+        else if(encodeBits <= 14) {
+            utils::encodeTo14Bit(processedData, width, height);
+            encodeBits = 14;
+        }
+        else {
+            encodeBits = 16;
+        }
     }
 
     // Create first frame
@@ -519,19 +524,7 @@ std::shared_ptr<std::vector<char>> generateDng(
     dng.SetOrientation(dngOrientation);
 
     // Time code
-    float time = frameNumber / recordingFps;
-
-    int hours = (int) floor(time / 3600);
-    int minutes = ((int) floor(time / 60)) % 60;
-    int seconds = ((int) floor(time)) % 60;
-    int frames = recordingFps > 1 ? (frameNumber % static_cast<int>(std::round(recordingFps))) : 0;
-
-    std::vector<uint8_t> timeCode(8);
-
-    timeCode[0] = ToTimecodeByte(frames) & 0x3F;
-    timeCode[1] = ToTimecodeByte(seconds) & 0x7F;
-    timeCode[2] = ToTimecodeByte(minutes) & 0x7F;
-    timeCode[3] = ToTimecodeByte(hours) & 0x3F;
+    auto timeCode = getTimeCode(frameNumber, recordingFps);
 
     dng.SetTimeCode(timeCode.data());
     dng.SetFrameRate(recordingFps);
@@ -553,8 +546,8 @@ std::shared_ptr<std::vector<char>> generateDng(
 
     dng.SetAsShotNeutral(3, metadata.asShotNeutral.data());
 
-    dng.SetCalibrationIlluminant1(getColorIlluminant(cameraConfiguration.colorIlluminant1));
-    dng.SetCalibrationIlluminant2(getColorIlluminant(cameraConfiguration.colorIlluminant2));
+    dng.SetCalibrationIlluminant1(renderConfig.colorIlluminant1);
+    dng.SetCalibrationIlluminant2(renderConfig.colorIlluminant2);
 
     // Additional information
     const auto software = "MotionCam Tools";
@@ -583,11 +576,91 @@ std::shared_ptr<std::vector<char>> generateDng(
 
     utils::vector_ostream stream(*output);
 
-    writer.WriteToFile(stream, &err);
+    {
+        Measure m(metrics, Stage::HEADER_WRITE);
+
+        writer.WriteToFile(stream, &err);
+    }
 
     return output;
 }
 
+std::array<uint8_t, 8> getTimeCode(int frameNumber, float recordingFps) {
+    float time = frameNumber / recordingFps;
+
+    int hours = (int) floor(time / 3600);
+    int minutes = ((int) floor(time / 60)) % 60;
+    int seconds = ((int) floor(time)) % 60;
+    int frames = recordingFps > 1 ? (frameNumber % static_cast<int>(std::round(recordingFps))) : 0;
+
+    std::array<uint8_t, 8> timeCode = {};
+
+    timeCode[0] = ToTimecodeByte(frames) & 0x3F;
+    timeCode[1] = ToTimecodeByte(seconds) & 0x7F;
+    timeCode[2] = ToTimecodeByte(minutes) & 0x7F;
+    timeCode[3] = ToTimecodeByte(hours) & 0x3F;
+
+    return timeCode;
+}
+
+size_t findTagValueOffset(const std::vector<char>& dng, uint16_t tag) {
+    const auto* data = reinterpret_cast<const uint8_t*>(dng.data());
+    const size_t size = dng.size();
+
+    auto readU16 = [data](size_t pos) {
+        return static_cast<uint16_t>(data[pos] | (data[pos + 1] << 8));
+    };
+
+    auto readU32 = [data](size_t pos) {
+        return static_cast<uint32_t>(data[pos]) |
+               (static_cast<uint32_t>(data[pos + 1]) << 8) |
+               (static_cast<uint32_t>(data[pos + 2]) << 16) |
+               (static_cast<uint32_t>(data[pos + 3]) << 24);
+    };
+
+    // We only write little endian files
+    if(size < 8 || data[0] != 'I' || data[1] != 'I')
+        return 0;
+
+    const size_t ifdOffset = readU32(4);
+    if(ifdOffset + 2 > size)
+        return 0;
+
+    const uint16_t numEntries = readU16(ifdOffset);
+
+    for(uint16_t i = 0; i < numEntries; ++i) {
+        const size_t entryOffset = ifdOffset + 2 + i * 12;
+        if(entryOffset + 12 > size)
+            return 0;
+
+        if(readU16(entryOffset) != tag)
+            continue;
+
+        // Byte size of each TIFF field type
+        const uint16_t type = readU16(entryOffset + 2);
+        const uint32_t count = readU32(entryOffset + 4);
+
+        size_t typeSize;
+
+        switch(type) {
+            case 3: case 8: typeSize = 2; break;                 // SHORT, SSHORT
+            case 4: case 9: case 11: typeSize = 4; break;        // LONG, SLONG, FLOAT
+            case 5: case 10: case 12: typeSize = 8; break;       // RATIONAL, SRATIONAL, DOUBLE
+            default: typeSize = 1; break;                        // BYTE, ASCII, SBYTE, UNDEFINED
+        }
+
+        // Values that fit in four bytes are stored in the entry itself
+        if(count * typeSize <= 4)
+            return entryOffset + 8;
+
+        const size_t valueOffset = readU32(entryOffset + 8);
+
+        return valueOffset + count * typeSize <= size ? valueOffset : 0;
+    }
+
+    return 0;
+}
+
 int gcd(int a, int b) {
     while (b != 0) {
         int temp = b;
@@ -597,6 +670,102 @@ int gcd(int a, int b) {
     return a;
 }
 
+float calculateFrameRate(const std::vector<int64_t>& frames) {
+    // Need at least 2 frames to calculate frame rate
+    if (frames.size() < 2) {
+        return 0.0f;
+    }
+
+    // Use running average to prevent overflow
+    double avgDuration = 0.0;
+    int validFrames = 0;
+
+    for (size_t i = 1; i < frames.size(); ++i) {
+        double duration = static_cast<double>(frames[i] - frames[i-1]);
+
+        if (duration > 0) {
+            // Update running average
+            // new_avg = old_avg + (new_value - old_avg) / (count + 1)
+            avgDuration = avgDuration + (duration - avgDuration) / (validFrames + 1);
+            validFrames++;
+        }
+    }
+
+    if (validFrames == 0) {
+        return 0.0f;
+    }
+
+    return static_cast<float>(1000000000.0 / avgDuration);
+}
+
+int64_t getFrameNumberFromTimestamp(int64_t timestamp, int64_t referenceTimestamp, float frameRate) {
+    if (frameRate <= 0) {
+        return -1; // Invalid frame rate
+    }
+
+    int64_t timeDifference = timestamp - referenceTimestamp;
+    if (timeDifference < 0) {
+        return -1;
+    }
+
+    // Calculate microseconds per frame
+    double nanosecondsPerFrame = 1000000000.0 / frameRate;
+
+    // Calculate expected frame number
+    return static_cast<int64_t>(std::round(timeDifference / nanosecondsPerFrame));
+}
+
+std::vector<FrameInfo> listFrames(const std::vector<int64_t>& frames, float frameRate) {
+    std::vector<FrameInfo> result;
+    int64_t lastPts = 0;
+
+    result.reserve(frames.size());
+
+    for(auto& x : frames) {
+        auto pts = getFrameNumberFromTimestamp(x, frames[0], frameRate);
+
+        // Duplicate frames to account for dropped frames
+        while(lastPts < pts) {
+            result.push_back(FrameInfo { x, lastPts });
+            ++lastPts;
+        }
+    }
+
+    return result;
+}
+
+std::optional<Entry> findEntry(const std::vector<Entry>& entries, const std::string& fullPath) {
+    for(const auto& e : entries) {
+        if(boost::filesystem::path(fullPath).relative_path() == e.getFullPath())
+            return e;
+    }
+
+    return {};
+}
+
+std::string constructFrameFilename(
+    const std::string& baseName, int frameNumber, int padding, const std::string& extension)
+{
+    std::ostringstream oss;
+
+    // Add the base name
+    oss << baseName;
+
+    // Add the zero-padded frame number
+    oss << std::setfill('0') << std::setw(padding) << frameNumber;
+
+    // Add the extension if provided
+    if (!extension.empty()) {
+        // Check if extension already has a dot prefix
+        if (extension[0] != '.') {
+            oss << '.';
+        }
+        oss << extension;
+    }
+
+    return oss.str();
+}
+
 std::pair<int, int> toFraction(float frameRate, int base) {
     // Handle invalid input
     if (frameRate <= 0) {
@@ -4,8 +4,13 @@
 #include "Utils.h"
 #include "AudioWriter.h"
 #include "LRUCache.h"
-
-#include <motioncam/Decoder.hpp>
+#include "DecodedFrameCache.h"
+#include "IFrameSource.h"
+#include "Measure.h"
+#include "Logging.h"
+#include "Tracing.h"
+#include "AccessLog.h"
+#include "RenderMemoryLimit.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/regex.hpp>
@@ -16,12 +21,15 @@
 #include <audiofile/AudioFile.h>
 
 #include <algorithm>
-#include <sstream>
+#include <cerrno>
+#include <chrono>
+#include <future>
 #include <tuple>
 
 namespace motioncam {
 
 namespace {
+    constexpr auto DECODE_AHEAD_FRAMES = 4;
 
 #ifdef _WIN32
     constexpr std::string_view DESKTOP_INI = R"([.ShellClassInfo]
@@ -47,74 +55,6 @@ IconSize=16
         return p.stem().string();
     }
 
-    float calculateFrameRate(const std::vector<Timestamp>& frames) {
-        // Need at least 2 frames to calculate frame rate
-        if (frames.size() < 2) {
-            return 0.0f;
-        }
-
-        // Use running average to prevent overflow
-        double avgDuration = 0.0;
-        int validFrames = 0;
-
-        for (size_t i = 1; i < frames.size(); ++i) {
-            double duration = static_cast<double>(frames[i] - frames[i-1]);
-
-            if (duration > 0) {
-                // Update running average
-                // new_avg = old_avg + (new_value - old_avg) / (count + 1)
-                avgDuration = avgDuration + (duration - avgDuration) / (validFrames + 1);
-                validFrames++;
-            }
-        }
-
-        if (validFrames == 0) {
-            return 0.0f;
-        }
-
-        return static_cast<float>(1000000000.0 / avgDuration);
-    }
-
-    int64_t getFrameNumberFromTimestamp(Timestamp timestamp, Timestamp referenceTimestamp, float frameRate) {
-        if (frameRate <= 0) {
-            return -1; // Invalid frame rate
-        }
-
-        int64_t timeDifference = timestamp - referenceTimestamp;
-        if (timeDifference < 0) {
-            return -1;
-        }
-
-        // Calculate microseconds per frame
-        double nanosecondsPerFrame = 1000000000.0 / frameRate;
-
-        // Calculate expected frame number
-        return static_cast<int64_t>(std::round(timeDifference / nanosecondsPerFrame));
-    }
-
-    std::string constructFrameFilename(
-        const std::string& baseName, int frameNumber, int padding = 6, const std::string& extension = "")
-    {
-        std::ostringstream oss;
-
-        // Add the base name
-        oss << baseName;
-
-        // Add the zero-padded frame number
-        oss << std::setfill('0') << std::setw(padding) << frameNumber;
-
-        // Add the extension if provided
-        if (!extension.empty()) {
-            // Check if extension already has a dot prefix
-            if (extension[0] != '.') {
-                oss << '.';
-            }
-            oss << extension;
-        }
-
-        return oss.str();
-    }
-
     void syncAudio(Timestamp videoTimestamp, std::vector<AudioChunk>& audioChunks, int sampleRate, int numChannels) {
         // Calculate drift between the video and audio
         auto audioVideoDriftMs = (audioChunks[0].first - videoTimestamp) * 1e-6f;
@@ -177,46 +117,177 @@ IconSize=16
 
         return 1;
     }
+
+    struct OpenDecoder {
+        std::unique_ptr<IFrameSource> source;
+        TrackedMemory memory;   // Counted against the mount that opened it, until the thread exits
+    };
+
+    IFrameSource& getDecoder(const std::string& srcPath, const std::shared_ptr<Metrics>& metrics) {
+        thread_local std::map<std::string, OpenDecoder> decoders;
+
+        auto it = decoders.find(srcPath);
+        if(it == decoders.end()) {
+            auto source = openFrameSource(srcPath);
+            const auto memoryUsage = source->memoryUsage();
+
+            it = decoders.emplace(srcPath, OpenDecoder { std::move(source), TrackedMemory(metrics, Memory::DECODERS, memoryUsage) }).first;
+        }
+
+        return *it->second.source;
+    }
+
+    // Time a task spent in the queue of a thread pool
+    void recordQueueWait(Metrics& metrics, std::chrono::steady_clock::time_point queuedAt) {
+        metrics.record(Stage::QUEUE_WAIT, std::chrono::steady_clock::now() - queuedAt);
+    }
+
+    std::shared_ptr<const DecodedFrame> decodeFrame(IFrameSource& decoder, Timestamp timestamp, const std::shared_ptr<Metrics>& metrics) {
+        const auto& allFrames = decoder.getFrames();
+
+        // Make sure the frame exists
+        auto it = std::find(allFrames.begin(), allFrames.end(), timestamp);
+        if(it == allFrames.end()) {
+            spdlog::error("Frame {} not found", timestamp);
+            throw std::runtime_error("Failed to find frame");
+        }
+
+        auto frame = std::make_shared<DecodedFrame>();
+        nlohmann::json metadata;
+
+        {
+            Measure m(metrics.get(), Stage::CONTAINER_READ);
+
+            decoder.loadFrame(timestamp, frame->data, metadata);
+        }
+
+        {
+            Measure m(metrics.get(), Stage::METADATA_PARSE);
+
+            frame->metadata = CameraFrameMetadata::parseForRender(metadata);
+        }
+
+        frame->memory = TrackedMemory(metrics, Memory::DECODED_FRAMES, frame->data.capacity());
+
+        return frame;
+    }
+
+    // Decoded frame from the cache, otherwise read from the container
+    std::shared_ptr<const DecodedFrame> loadFrame(
+        DecodedFrameCache& decodedFrameCache, const std::string& srcPath, Timestamp timestamp, const std::shared_ptr<Metrics>& metrics)
+    {
+        DecodedFrameCache::Key key { srcPath, timestamp };
+
+        auto decodedFrame = decodedFrameCache.get(key);
+        if(decodedFrame)
+            return decodedFrame;
+
+        LOG_SAMPLED_DEBUG("Reading frame {}", timestamp);
+
+        try {
+            decodedFrame = decodeFrame(getDecoder(srcPath, metrics), timestamp, metrics);
+        }
+        catch(...) {
+            decodedFrameCache.markLoadFailed(key);
+            throw;
+        }
+
+        decodedFrameCache.put(key, decodedFrame);
+
+        return decodedFrame;
+    }
+
+    std::shared_ptr<CachedBuffer> makeCachedBuffer(std::shared_ptr<std::vector<char>> dngData, bool compress, const std::shared_ptr<Metrics>& metrics) {
+        const auto timeCodeOffset = utils::findTagValueOffset(*dngData, utils::DNG_TAG_TIMECODES);
+
+        auto buffer = compress ? CachedBuffer::compress(std::move(dngData)) : std::make_shared<CachedBuffer>(std::move(dngData));
+        buffer->setTimeCodeOffset(timeCodeOffset);
+        buffer->trackMemory(metrics);
+
+        return buffer;
+    }
+
+    // Read from a rendered frame that may be shared with other entries, patching in the time
+    // code of the entry that is being read
+    size_t readFrame(const CachedBuffer& buffer, const FrameInfo& frameInfo, float fps, size_t pos, size_t len, void* dst, Metrics* metrics) {
+        Measure m(metrics, buffer.isCompressed() ? Stage::DECOMPRESS : Stage::REPLY);
+
+        const size_t readBytes = buffer.read(pos, len, dst);
+        const size_t timeCodeOffset = buffer.timeCodeOffset();
+
+        if(timeCodeOffset == 0)
+            return readBytes;
+
+        const auto timeCode = utils::getTimeCode(static_cast<int>(frameInfo.frameNumber), fps);
+
+        const size_t start = (std::max)(pos, timeCodeOffset);
+        const size_t end = (std::min)(pos + readBytes, timeCodeOffset + timeCode.size());
+
+        if(start < end)
+            std::memcpy(static_cast<char*>(dst) + (start - pos), timeCode.data() + (start - timeCodeOffset), end - start);
+
+        return readBytes;
+    }
 }
 
 VirtualFileSystemImpl_MCRAW::VirtualFileSystemImpl_MCRAW(
         BS::thread_pool& ioThreadPool,
         BS::thread_pool& processingThreadPool,
         LRUCache& lruCache,
+        DecodedFrameCache& decodedFrameCache,
         FileRenderOptions options,
         int draftScale,
-        const std::string& file) :
+        const std::string& file,
+        std::shared_ptr<Metrics> metrics,
+        RenderMemoryLimit* renderMemoryLimit) :
         mCache(lruCache),
+        mDecodedFrameCache(decodedFrameCache),
         mIoThreadPool(ioThreadPool),
         mProcessingThreadPool(processingThreadPool),
+        mMetrics(metrics ? std::move(metrics) : std::make_shared<Metrics>()),
+        mRenderMemoryLimit(renderMemoryLimit),
         mSrcPath(file),
         mBaseName(extractFilenameWithoutExtension(file)),
-        mTypicalDngSize(0),
-        mFps(0),
-        mDraftScale(draftScale),
-        mOptions(options) {
+        mStopWarmUp(false),
+        mForegroundReads(0),
+        mLastAccessedFrame(-1) {
 
-    init(options);
+    mListing = createListing(options, draftScale, 0);
 }
 
 VirtualFileSystemImpl_MCRAW::~VirtualFileSystemImpl_MCRAW() {
+    stopWarmUp();
+
     spdlog::info("Destroying VirtualFileSystemImpl_MCRAW({})", mSrcPath);
 }
 
-void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options) {
-    Decoder decoder(mSrcPath);
+std::shared_ptr<const VirtualFileSystemImpl_MCRAW::Listing> VirtualFileSystemImpl_MCRAW::getListing() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    return mListing;
+}
+
+std::shared_ptr<const VirtualFileSystemImpl_MCRAW::Listing> VirtualFileSystemImpl_MCRAW::createListing(
+    FileRenderOptions options, int draftScale, uint64_t generation) const
+{
+    auto listing = std::make_shared<Listing>();
+
+    listing->options = options;
+    listing->draftScale = draftScale;
+    listing->generation = generation;
+
+    auto frameSource = openFrameSource(mSrcPath);
+    auto& decoder = *frameSource;
     auto frames = decoder.getFrames();
     std::sort(frames.begin(), frames.end());
 
     if(frames.empty())
-        return;
+        return listing;
 
-    spdlog::debug("VirtualFileSystemImpl_MCRAW::init(options={})", optionsToString(options));
+    SPDLOG_DEBUG("VirtualFileSystemImpl_MCRAW::createListing(options={})", optionsToString(options));
 
-    // Clear everything
-    mFiles.clear();
-
-    mFps = calculateFrameRate(frames);
+    listing->frames.assign(frames.begin(), frames.end());
+    listing->fps = utils::calculateFrameRate(frames);
 
     // Calculate typical DNG size that we can use for all files
     std::vector<uint8_t> data;
@@ -224,24 +295,37 @@ void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options) {
 
     decoder.loadFrame(frames[0], data, metadata);
 
-    auto cameraConfig = CameraConfiguration::parse(decoder.getContainerMetadata());
-    auto cameraFrameMetadata = CameraFrameMetadata::parse(metadata);
+    // The container metadata is the same for the life of the mount, frames share what is parsed here
+    auto previous = getListing();
+
+    if(previous && previous->renderConfig) {
+        listing->renderConfig = previous->renderConfig;
+    }
+    else {
+        listing->renderConfig = utils::makeRenderConfig(
+            std::make_shared<const CameraConfiguration>(CameraConfiguration::parse(decoder.getContainerMetadata())));
+    }
+
+    auto cameraFrameMetadata = CameraFrameMetadata::parseForRender(metadata);
 
     auto dngData = utils::generateDng(
         data,
         cameraFrameMetadata,
-        cameraConfig,
-        mFps,
+        *listing->renderConfig,
+        listing->fps,
         0,
         options,
-        getScaleFromOptions(options, mDraftScale));
+        getScaleFromOptions(options, draftScale));
 
-    mTypicalDngSize = dngData->size();
+    listing->typicalDngSize = dngData->size();
+
+    // A render holds the decoded frame and the DNG until it is cached
+    listing->renderMemorySize = data.size() + dngData->size();
 
     // Generate file entries
-    int lastPts = 0;
+    auto& files = listing->files;
 
-    mFiles.reserve(frames.size()*2);
+    files.reserve(frames.size()*2);
 
 // Disable icon previews in Windows/MacOS
 #ifdef _WIN32
@@ -251,7 +335,7 @@ void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options) {
     desktopIni.size = DESKTOP_INI.size();
     desktopIni.name = "desktop.ini";
 
-    mFiles.emplace_back(desktopIni);
+    files.emplace_back(desktopIni);
 #endif
 
     // Generate and add audio (TODO: We're loading all the audio into memory)
@@ -261,8 +345,8 @@ void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options) {
     decoder.loadAudio(audioChunks);
 
     if(!audioChunks.empty()) {
-        auto fpsFraction = utils::toFraction(mFps);
-        AudioWriter audioWriter(mAudioFile, decoder.numAudioChannels(), decoder.audioSampleRateHz(), fpsFraction.first, fpsFraction.second);
+        auto fpsFraction = utils::toFraction(listing->fps);
+        AudioWriter audioWriter(listing->audioFile, decoder.numAudioChannels(), decoder.audioSampleRateHz(), fpsFraction.first, fpsFraction.second);
 
         // Sync the audio to the video
         syncAudio(
@@ -275,50 +359,52 @@ void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options) {
             audioWriter.write(x.second, x.second.size() / decoder.numAudioChannels());
     }
 
-    if(!mAudioFile.empty()) {
+    if(!listing->audioFile.empty()) {
         audioEntry.type = EntryType::FILE_ENTRY;
-        audioEntry.size = mAudioFile.size();
+        audioEntry.size = listing->audioFile.size();
         audioEntry.name = "audio.wav";
 
-        mFiles.emplace_back(audioEntry);
+        files.emplace_back(audioEntry);
     }
 
     // Add video frames
-    for(auto& x : frames) {
-        int pts = getFrameNumberFromTimestamp(x, frames[0], mFps);
+    for(auto& frameInfo : utils::listFrames(frames, listing->fps)) {
+        Entry entry;
+
+        entry.type = EntryType::FILE_ENTRY;
+        entry.size = listing->typicalDngSize;
+        entry.name = utils::constructFrameFilename("frame-", static_cast<int>(frameInfo.frameNumber), 6, "dng");
+        entry.userData = frameInfo;
 
-        // Duplicate frames to account for dropped frames
-        while(lastPts < pts) {
-            Entry entry;
+        files.emplace_back(entry);
+    }
 
-            // Add main entry
-            entry.type = EntryType::FILE_ENTRY;
-            entry.size = mTypicalDngSize;
-            entry.name = constructFrameFilename("frame-", lastPts, 6, "dng");
-            entry.userData = x;
+    size_t fileListMemory = files.capacity() * sizeof(Entry) + listing->frames.capacity() * sizeof(int64_t);
 
-            mFiles.emplace_back(entry);
+    for(const auto& e : files) {
+        fileListMemory += e.name.capacity() + e.pathParts.capacity() * sizeof(std::string);
 
-            ++lastPts;
-        }
+        for(const auto& part : e.pathParts)
+            fileListMemory += part.capacity();
     }
+
+    listing->audioMemory = TrackedMemory(mMetrics, Memory::AUDIO, listing->audioFile.capacity());
+    listing->fileListMemory = TrackedMemory(mMetrics, Memory::FILE_LIST, fileListMemory);
+
+    return listing;
 }
 
 std::vector<Entry> VirtualFileSystemImpl_MCRAW::listFiles(const std::string& filter) const {
     // TODO: Use filter
-    return mFiles;
+    return getListing()->files;
 }
 
 std::optional<Entry> VirtualFileSystemImpl_MCRAW::findEntry(const std::string& fullPath) const {
-    for(const auto& e : mFiles) {
-        if(boost::filesystem::path(fullPath).relative_path() == e.getFullPath())
-            return e;
-    }
-
-    return {};
+    return utils::findEntry(getListing()->files, fullPath);
 }
 
 size_t VirtualFileSystemImpl_MCRAW::generateFrame(
+    const Listing& listing,
     const Entry& entry,
     const size_t pos,
     const size_t len,
@@ -326,114 +412,185 @@ size_t VirtualFileSystemImpl_MCRAW::generateFrame(
     std::function<void(size_t, int)> result,
     bool async)
 {
-    using FrameData = std::tuple<size_t, CameraConfiguration, CameraFrameMetadata, std::shared_ptr<std::vector<uint8_t>>>;
+    // A synchronous read waits for the answer to an asynchronous one
+    if(!async) {
+        std::promise<size_t> done;
+        auto doneFuture = done.get_future();
 
-    // Try to get from cache first
-    auto cacheEntry = mCache.get(entry);
-    if(cacheEntry && pos < cacheEntry->size()) {
-        // Calculate length to copy
-        const size_t actualLen = (std::min)(len, cacheEntry->size() - pos);
+        const size_t readBytes = generateFrame(listing, entry, pos, len, dst, [&done](size_t readBytes, int errorCode) {
+            done.set_value(errorCode == 0 ? readBytes : 0);
+        }, true);
 
-        // Copy the data from cache
-        std::memcpy(dst, cacheEntry->data() + pos, actualLen);
+        return readBytes > 0 ? readBytes : doneFuture.get();
+    }
 
-        // Push entry to front
-        mCache.put(entry, cacheEntry);
+    const auto frameInfo = std::get<FrameInfo>(entry.userData);
+    const auto fps = listing.fps;
+    const auto renderConfig = listing.renderConfig;
 
-        return actualLen;
-    }
+    const auto readId = Trace::newReadId();
+    TraceSpan span("readFile", readId, TraceFlow::BEGIN);
 
-    // Use IO thread pool to decode frame
-    auto frameDataFuture = mIoThreadPool.submit_task([entry, &srcPath = mSrcPath, &options = mOptions]() -> FrameData {
-        thread_local std::map<std::string, std::unique_ptr<Decoder>> decoders;
+    // Any foreground read stops the warm up
+    ++mForegroundReads;
+    mLastAccessedFrame = frameInfo.frameNumber;
 
-        auto timestamp = std::get<Timestamp>(entry.userData);
+    // Entries duplicated for dropped frames map to the same key and share the rendered frame
+    const CacheKey cacheKey = getCacheKey(listing, frameInfo);
 
-        spdlog::debug("Reading frame {} with options {}", timestamp, optionsToString(options));
+    auto metrics = mMetrics;
 
-        if(decoders.find(srcPath) == decoders.end()) {
-            decoders[srcPath] = std::make_unique<Decoder>(srcPath);
-        }
+    // Never waits for a frame that is already being rendered, e.g. by openFile() or another
+    // read of the same frame. The read is answered by the thread that finishes the render.
+    std::shared_ptr<CachedBuffer> cacheEntry;
+    LRUCache::Lookup lookup;
 
-        auto& decoder = decoders[srcPath];
-        auto data = std::make_shared<std::vector<uint8_t>>();
+    {
+        TraceSpan cacheSpan("LRUCache.lookup", readId);
 
-        nlohmann::json metadata;
-        auto allFrames = decoder->getFrames();
+        lookup = mCache.lookup(cacheKey, cacheEntry, [frameInfo, fps, pos, len, dst, result, metrics](std::shared_ptr<CachedBuffer> buffer) {
+            if(!buffer) {
+                result(0, -EIO);
+                return;
+            }
 
-        // Find the frame (index)
-        auto it = std::find(allFrames.begin(), allFrames.end(), timestamp);
-        if(it == allFrames.end()) {
-            spdlog::error("Frame {} not found", timestamp);
-            throw std::runtime_error("Failed to find frame");
-        }
+            result(readFrame(*buffer, frameInfo, fps, pos, len, dst, metrics.get()), 0);
+        });
+    }
 
-        decoder->loadFrame(timestamp, *data, metadata);
+    if(lookup == LRUCache::Lookup::PENDING)
+        return 0;
 
-        size_t frameIndex = std::distance(allFrames.begin(), it);
+    // lookup() has already moved the entry to the front. Putting it back could replace the
+    // compressed copy stored once the frame was rendered.
+    if(lookup == LRUCache::Lookup::HIT) {
+        const size_t readBytes = readFrame(*cacheEntry, frameInfo, fps, pos, len, dst, metrics.get());
 
-        return std::make_tuple(
-            frameIndex, CameraConfiguration::parse(decoder->getContainerMetadata()), CameraFrameMetadata::parse(metadata), std::move(data));
-    });
+        // Only reads that return data are answered by the return value
+        if(readBytes == 0)
+            result(0, 0);
+
+        return readBytes;
+    }
+
+    // Waits here rather than in the pools, so tasks of earlier reads can always finish and free up memory
+    auto reservation = std::make_shared<RenderReservation>(mRenderMemoryLimit, metrics, listing.renderMemorySize, true);
+
+    const auto queuedAt = std::chrono::steady_clock::now();
+
+    // Use IO thread pool to decode frame, unless it is still in the decoded frame cache
+    auto frameDataFuture = mIoThreadPool.submit_task(
+        [frameInfo, metrics, queuedAt, readId, &srcPath = mSrcPath, &decodedFrameCache = mDecodedFrameCache]() {
+            recordQueueWait(*metrics, queuedAt);
+
+            TraceSpan ioSpan("io.loadFrame", readId, TraceFlow::STEP);
+
+            return loadFrame(decodedFrameCache, srcPath, frameInfo.timestamp, metrics);
+        });
 
+    decodeAhead(listing, frameInfo.timestamp);
 
     // Use processing thread pool to generate DNG
     auto sharableFuture = frameDataFuture.share();
 
-    const auto fps = mFps;
-    const auto draftScale = mDraftScale;
+    auto generateTask = [&cache = mCache, entry, cacheKey, frameInfo, sharableFuture, renderConfig, fps, pos, len, dst, result, metrics, reservation, queuedAt, readId]() {
+        recordQueueWait(*metrics, queuedAt);
 
-    auto generateTask = [&options = mOptions, &cache = mCache, entry, sharableFuture, fps, draftScale, pos, len, dst, result]() {
         size_t readBytes = 0;
-        int errorCode = -1;
+        std::shared_ptr<std::vector<char>> dngData;
+        std::shared_ptr<CachedBuffer> buffer;
 
         try {
-            auto decodedFrame = sharableFuture.get();
-            auto [frameIndex, containerMetadata, frameMetadata, frameData] = std::move(decodedFrame);
+            TraceSpan processingSpan("processing.generateDng", readId, TraceFlow::STEP);
 
-            spdlog::debug("Generating {}", entry.name);
+            std::shared_ptr<const DecodedFrame> decodedFrame;
 
-            auto dngData = utils::generateDng(
-                *frameData,
-                frameMetadata,
-                containerMetadata,
-                fps,
-                frameIndex,
-                options,
-                getScaleFromOptions(options, draftScale));
+            {
+                TraceSpan waitSpan("processing.waitForFrame", readId);
 
-            if(dngData && pos < dngData->size()) {
-                // Calculate length to copy
-                const size_t actualLen = (std::min)(len, dngData->size() - pos);
+                decodedFrame = sharableFuture.get();
+            }
 
-                std::memcpy(dst, dngData->data() + pos, actualLen);
+            LOG_SAMPLED_DEBUG("Generating {}", entry.name);
 
-                readBytes = actualLen;
-                errorCode = 0;
-            }
+            dngData = utils::generateDng(
+                decodedFrame->data,
+                decodedFrame->metadata,
+                *renderConfig,
+                fps,
+                static_cast<int>(frameInfo.frameNumber),
+                cacheKey.options,
+                cacheKey.scale,
+                metrics.get());
+
+            buffer = makeCachedBuffer(dngData, false, metrics);
 
             // Add to cache
-            cache.put(entry, dngData);
+            cache.put(cacheKey, buffer);
         }
-        catch(std::runtime_error& e) {
+        catch(std::exception& e) {
             spdlog::error("Failed to generate DNG (error: {})", e.what());
-            cache.markLoadFailed(entry);
+            cache.markLoadFailed(cacheKey);
+        }
+        catch(...) {
+            spdlog::error("Failed to generate DNG (unknown error)");
+            cache.markLoadFailed(cacheKey);
         }
 
-        result(readBytes, errorCode);
+        // The frame is accounted for by the cache from here on
+        reservation->release();
 
-        return readBytes;
-    };
+        {
+            Measure m(metrics.get(), Stage::REPLY);
+            TraceSpan replySpan("reply", readId, TraceFlow::END);
 
+            if(buffer && pos < buffer->size())
+                readBytes = buffer->read(pos, len, dst);
 
-    auto processFuture = mProcessingThreadPool.submit_task(generateTask);
-    if(!async)
-        return processFuture.get();
+            // Always answer the read, even when rendering failed
+            result(readBytes, buffer ? 0 : -EIO);
+        }
+
+        // Compress after replying so the read isn't delayed, the uncompressed copy is served until then
+        if(dngData && cache.isCompressionEnabled())
+            cache.put(cacheKey, makeCachedBuffer(dngData, true, metrics));
+    };
+
+    mProcessingThreadPool.detach_task(generateTask);
 
     return 0;
 }
 
+void VirtualFileSystemImpl_MCRAW::decodeAhead(const Listing& listing, int64_t timestamp) {
+    const auto& frames = listing.frames;
+
+    auto it = std::lower_bound(frames.begin(), frames.end(), timestamp);
+    if(it == frames.end() || *it != timestamp)
+        return;
+
+    // Decode the next few frames so they are ready when the player asks for them
+    for(int i = 0; i < DECODE_AHEAD_FRAMES && ++it != frames.end(); ++i) {
+        DecodedFrameCache::Key key { mSrcPath, *it };
+
+        if(!mDecodedFrameCache.beginPrefetch(key))
+            continue;
+
+        mIoThreadPool.detach_task([key, metrics = mMetrics, &decodedFrameCache = mDecodedFrameCache]() {
+            TraceSpan span("io.decodeAhead");
+
+            try {
+                decodedFrameCache.put(key, decodeFrame(getDecoder(key.srcPath, metrics), key.timestamp, metrics));
+            }
+            catch(std::exception& e) {
+                spdlog::warn("Failed to decode frame {} ahead (error: {})", key.timestamp, e.what());
+                decodedFrameCache.markLoadFailed(key);
+            }
+        });
+    }
+}
+
 size_t VirtualFileSystemImpl_MCRAW::generateAudio(
+    const Listing& listing,
     const Entry& entry,
     const size_t pos,
     const size_t len,
@@ -441,13 +598,14 @@ size_t VirtualFileSystemImpl_MCRAW::generateAudio(
     std::function<void(size_t, int)> result,
     bool async)
 {
+    const auto& audioFile = listing.audioFile;
     size_t readBytes = 0;
 
-    if(pos < mAudioFile.size()) {
+    if(pos < audioFile.size()) {
         // Calculate length to copy
-        const size_t actualLen = (std::min)(len, mAudioFile.size() - pos);
+        const size_t actualLen = (std::min)(len, audioFile.size() - pos);
 
-        std::memcpy(dst, mAudioFile.data() + pos, actualLen);
+        std::memcpy(dst, audioFile.data() + pos, actualLen);
 
         readBytes = actualLen;
     }
@@ -464,6 +622,27 @@ int VirtualFileSystemImpl_MCRAW::readFile(
     std::function<void(size_t, int)> result,
     bool async) {
 
+    recordAccess(entry, pos, len);
+
+    auto listing = getListing();
+
+    return readEntry(*listing, entry, pos, len, dst, result, async);
+}
+
+void VirtualFileSystemImpl_MCRAW::recordAccess(const Entry& entry, const size_t pos, const size_t len) const {
+    if(AccessLog::isRecording())
+        AccessLog::record(mSrcPath, entry.getFullPath().generic_string(), pos, len);
+}
+
+int VirtualFileSystemImpl_MCRAW::readEntry(
+    const Listing& listing,
+    const Entry& entry,
+    const size_t pos,
+    const size_t len,
+    void* dst,
+    std::function<void(size_t, int)> result,
+    bool async) {
+
     #ifdef _WIN32
         if(entry.name == "desktop.ini") {
             const size_t actualLen = (std::min)(len, DESKTOP_INI.size() - pos);
@@ -475,21 +654,359 @@ int VirtualFileSystemImpl_MCRAW::readFile(
 
     // Requestion audio?
     if(boost::ends_with(entry.name, "wav")) {
-        return generateAudio(entry, pos, len, dst, result, async);
+        return generateAudio(listing, entry, pos, len, dst, result, async);
     }
     else if(boost::ends_with(entry.name, "dng")) {
-        return generateFrame(entry, pos, len, dst, result, async);
+        return generateFrame(listing, entry, pos, len, dst, result, async);
     }
 
     return -1;
 }
 
 void VirtualFileSystemImpl_MCRAW::updateOptions(FileRenderOptions options, int draftScale) {
-    mDraftScale = draftScale;
-    mOptions = options;
+    stopWarmUp();
+
+    // Built while reads carry on with the current listing, open handles move to the new one
+    // on their next read
+    auto listing = createListing(options, draftScale, getListing()->generation + 1);
 
-    init(options);
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mListing = std::move(listing);
 }
 
-} // namespace motioncam
+std::unique_ptr<FileHandle> VirtualFileSystemImpl_MCRAW::openFile(const Entry& entry) {
+    auto listing = getListing();
+    auto handle = std::make_unique<FileHandle>();
+
+    handle->entry = entry;
+    handle->generation = listing->generation;
+
+    if(auto* frameInfo = std::get_if<FrameInfo>(&entry.userData)) {
+        handle->frame = mCache.peek(getCacheKey(*listing, *frameInfo));
+
+        // Start rendering before the first read arrives
+        if(!handle->frame)
+            renderInBackground(*listing, *frameInfo);
+    }
+
+    return handle;
+}
+
+int VirtualFileSystemImpl_MCRAW::readFile(FileHandle& handle, const size_t pos, const size_t len, void* dst) {
+    auto listing = getListing();
+    auto [entry, frame] = resolveHandle(handle, *listing);
+
+    recordAccess(entry, pos, len);
+
+    auto* frameInfo = std::get_if<FrameInfo>(&entry.userData);
+    if(!frameInfo)
+        return readEntry(*listing, entry, pos, len, dst, [](auto a, auto b) {}, false);
+
+    if(frame)
+        return static_cast<int>(readPinnedFrame(*frame, *frameInfo, listing->fps, pos, len, dst));
+
+    int readBytes = readEntry(*listing, entry, pos, len, dst, [](auto a, auto b) {}, false);
+
+    pinFrame(handle, *listing, *frameInfo);
+
+    return readBytes;
+}
+
+void VirtualFileSystemImpl_MCRAW::readFileAsync(
+    FileHandle& handle, const size_t pos, const size_t len, void* dst, std::function<void(size_t, int)> result)
+{
+    auto listing = getListing();
+    auto [entry, frame] = resolveHandle(handle, *listing);
+
+    recordAccess(entry, pos, len);
+
+    auto* frameInfo = std::get_if<FrameInfo>(&entry.userData);
+    if(!frameInfo) {
+        int readBytes = readEntry(*listing, entry, pos, len, dst, [](auto a, auto b) {}, false);
+
+        result(readBytes < 0 ? 0 : readBytes, readBytes < 0 ? -1 : 0);
+        return;
+    }
+
+    if(frame) {
+        result(readPinnedFrame(*frame, *frameInfo, listing->fps, pos, len, dst), 0);
+        return;
+    }
+
+    // The handle outlives the read, the kernel only releases it once all reads have been answered
+    const FrameInfo renderedFrame = *frameInfo;
+
+    auto onRendered = [this, &handle, renderedFrame, listing, result](size_t readBytes, int errorCode) {
+        pinFrame(handle, *listing, renderedFrame);
+        result(readBytes, errorCode);
+    };
+
+    // Cache hits complete straight away and return the number of bytes read
+    auto readBytes = generateFrame(*listing, entry, pos, len, dst, onRendered, true);
+    if(readBytes > 0)
+        onRendered(readBytes, 0);
+}
+
+std::pair<Entry, std::shared_ptr<CachedBuffer>> VirtualFileSystemImpl_MCRAW::resolveHandle(FileHandle& handle, const Listing& listing) {
+    std::lock_guard<std::mutex> lock(handle.mutex);
+
+    // Options changed since the handle was opened, the pinned frame and size are stale
+    if(handle.generation != listing.generation) {
+        auto currentEntry = utils::findEntry(listing.files, handle.entry.getFullPath().string());
+        if(currentEntry.has_value())
+            handle.entry = currentEntry.value();
+
+        handle.frame.reset();
+        handle.generation = listing.generation;
+    }
+
+    return { handle.entry, handle.frame };
+}
+
+std::shared_ptr<CachedBuffer> VirtualFileSystemImpl_MCRAW::pinFrame(FileHandle& handle, const Listing& listing, const FrameInfo& frameInfo) {
+    auto frame = mCache.peek(getCacheKey(listing, frameInfo));
+    if(!frame)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(handle.mutex);
+
+    if(handle.generation == listing.generation)
+        handle.frame = frame;
+
+    return frame;
+}
+
+bool VirtualFileSystemImpl_MCRAW::sliceFile(FileHandle& handle, const size_t pos, const size_t len, FrameSlice& slice) {
+    auto listing = getListing();
+    auto [entry, frame] = resolveHandle(handle, *listing);
+
+    auto* frameInfo = std::get_if<FrameInfo>(&entry.userData);
+    if(!frameInfo)
+        return false;
+
+    if(!frame)
+        frame = pinFrame(handle, *listing, *frameInfo);
+
+    if(!frame || frame->isCompressed())
+        return false;
+
+    // Reads that can't be sliced are recorded by readFileAsync() instead
+    recordAccess(entry, pos, len);
 
+    ++mForegroundReads;
+    mLastAccessedFrame = frameInfo->frameNumber;
+
+    slice.frame = frame;
+    slice.numSegments = 0;
+
+    if(pos >= frame->size())
+        return true;
+
+    const char* data = frame->data();
+    const size_t end = (std::min)(pos + len, frame->size());
+    const size_t timeCodeOffset = frame->timeCodeOffset();
+
+    auto addSegment = [&slice](const char* segmentData, size_t size) {
+        slice.segments[slice.numSegments++] = { segmentData, size };
+    };
+
+    if(timeCodeOffset == 0 || timeCodeOffset + slice.timeCode.size() <= pos || timeCodeOffset >= end) {
+        addSegment(data + pos, end - pos);
+        return true;
+    }
+
+    // Read covers the time code, which differs between entries that share the frame
+    slice.timeCode = utils::getTimeCode(static_cast<int>(frameInfo->frameNumber), listing->fps);
+
+    const size_t timeCodeStart = (std::max)(pos, timeCodeOffset);
+    const size_t timeCodeEnd = (std::min)(end, timeCodeOffset + slice.timeCode.size());
+
+    if(pos < timeCodeStart)
+        addSegment(data + pos, timeCodeStart - pos);
+
+    addSegment(reinterpret_cast<const char*>(slice.timeCode.data()) + (timeCodeStart - timeCodeOffset), timeCodeEnd - timeCodeStart);
+
+    if(timeCodeEnd < end)
+        addSegment(data + timeCodeEnd, end - timeCodeEnd);
+
+    return true;
+}
+
+size_t VirtualFileSystemImpl_MCRAW::readPinnedFrame(
+    const CachedBuffer& frame, const FrameInfo& frameInfo, float fps, const size_t pos, const size_t len, void* dst)
+{
+    TraceSpan span("readPinnedFrame");
+
+    ++mForegroundReads;
+    mLastAccessedFrame = frameInfo.frameNumber;
+
+    if(pos >= frame.size())
+        return 0;
+
+    return readFrame(frame, frameInfo, fps, pos, len, dst, mMetrics.get());
+}
+
+CacheKey VirtualFileSystemImpl_MCRAW::getCacheKey(const Listing& listing, const FrameInfo& frameInfo) const {
+    return CacheKey { mSrcPath, frameInfo.timestamp, listing.options, getScaleFromOptions(listing.options, listing.draftScale) };
+}
+
+void VirtualFileSystemImpl_MCRAW::renderInBackground(const Listing& listing, const FrameInfo& frameInfo) {
+    const CacheKey cacheKey = getCacheKey(listing, frameInfo);
+
+    // Skipped when the memory is needed for reads, the frame is rendered when it is read.
+    // Reserved before the key is marked in progress, so reads never wait on a render that
+    // doesn't start.
+    auto reservation = std::make_shared<RenderReservation>(mRenderMemoryLimit, mMetrics, listing.renderMemorySize, false);
+
+    if(!reservation->isAcquired() || !mCache.beginPrefetch(cacheKey))
+        return;
+
+    const auto fps = listing.fps;
+    const auto renderConfig = listing.renderConfig;
+    const auto queuedAt = std::chrono::steady_clock::now();
+
+    // Tasks only hold on to the shared caches, pools, metrics and memory limit, the file system may be gone before they run
+    mIoThreadPool.detach_task(
+        [&cache = mCache, &decodedFrameCache = mDecodedFrameCache, &processingThreadPool = mProcessingThreadPool, metrics = mMetrics, reservation, renderConfig, cacheKey, frameInfo, fps, queuedAt]() {
+            recordQueueWait(*metrics, queuedAt);
+
+            TraceSpan span("io.renderInBackground");
+
+            try {
+                auto decodedFrame = loadFrame(decodedFrameCache, cacheKey.srcPath, frameInfo.timestamp, metrics);
+
+                processingThreadPool.detach_task([&cache, metrics, reservation, renderConfig, cacheKey, frameInfo, fps, decodedFrame, decodedAt = std::chrono::steady_clock::now()]() {
+                    recordQueueWait(*metrics, decodedAt);
+
+                    TraceSpan span("processing.renderInBackground");
+
+                    try {
+                        auto dngData = utils::generateDng(
+                            decodedFrame->data,
+                            decodedFrame->metadata,
+                            *renderConfig,
+                            fps,
+                            static_cast<int>(frameInfo.frameNumber),
+                            cacheKey.options,
+                            cacheKey.scale,
+                            metrics.get());
+
+                        cache.put(cacheKey, makeCachedBuffer(dngData, cache.isCompressionEnabled(), metrics));
+                    }
+                    catch(std::exception& e) {
+                        spdlog::warn("Failed to render frame {} (error: {})", frameInfo.frameNumber, e.what());
+                        cache.markLoadFailed(cacheKey);
+                    }
+                    catch(...) {
+                        spdlog::warn("Failed to render frame {} (unknown error)", frameInfo.frameNumber);
+                        cache.markLoadFailed(cacheKey);
+                    }
+                });
+            }
+            catch(std::exception& e) {
+                spdlog::warn("Failed to load frame {} (error: {})", frameInfo.frameNumber, e.what());
+                cache.markLoadFailed(cacheKey);
+            }
+            catch(...) {
+                spdlog::warn("Failed to load frame {} (unknown error)", frameInfo.frameNumber);
+                cache.markLoadFailed(cacheKey);
+            }
+        });
+}
+
+void VirtualFileSystemImpl_MCRAW::warmUp(int64_t startFrame, int numFrames) {
+    stopWarmUp();
+
+    auto listing = getListing();
+    std::vector<FrameInfo> frames;
+
+    for(const auto& e : listing->files) {
+        auto* frameInfo = std::get_if<FrameInfo>(&e.userData);
+
+        if(frameInfo && frameInfo->frameNumber >= startFrame && frameInfo->frameNumber < startFrame + numFrames)
+            frames.push_back(*frameInfo);
+    }
+
+    if(frames.empty())
+        return;
+
+    spdlog::info("Warming up cache for {} (frames {} to {})", mSrcPath, frames.front().frameNumber, frames.back().frameNumber);
+
+    const auto foregroundReads = mForegroundReads.load();
+    const auto fps = listing->fps;
+    const auto options = listing->options;
+    const auto scale = getScaleFromOptions(listing->options, listing->draftScale);
+
+    // Frames are rendered one at a time on a separate thread so foreground reads never queue behind them
+    mWarmUpThread = std::thread([this, listing, frames, foregroundReads, fps, options, scale]() {
+        size_t numRendered = 0;
+
+        for(const auto& frameInfo : frames) {
+            if(mStopWarmUp || mForegroundReads != foregroundReads)
+                break;
+
+            const CacheKey cacheKey { mSrcPath, frameInfo.timestamp, options, scale };
+
+            if(!mCache.beginPrefetch(cacheKey))
+                continue;
+
+            TraceSpan span("warmUp.render");
+
+            // The warm up has a thread of its own, it can wait its turn like a read
+            RenderReservation reservation(mRenderMemoryLimit, mMetrics, listing->renderMemorySize, true);
+
+            try {
+                auto decodedFrame = loadFrame(mDecodedFrameCache, mSrcPath, frameInfo.timestamp, mMetrics);
+
+                auto dngData = utils::generateDng(
+                    decodedFrame->data,
+                    decodedFrame->metadata,
+                    *listing->renderConfig,
+                    fps,
+                    static_cast<int>(frameInfo.frameNumber),
+                    options,
+                    scale,
+                    mMetrics.get());
+
+                mCache.put(cacheKey, makeCachedBuffer(dngData, mCache.isCompressionEnabled(), mMetrics));
+
+                ++numRendered;
+            }
+            // Skip frames that fail, an exception escaping the thread would terminate the app
+            catch(std::exception& e) {
+                spdlog::warn("Failed to warm up frame {} (error: {})", frameInfo.frameNumber, e.what());
+                mCache.markLoadFailed(cacheKey);
+            }
+            catch(...) {
+                spdlog::warn("Failed to warm up frame {} (unknown error)", frameInfo.frameNumber);
+                mCache.markLoadFailed(cacheKey);
+            }
+        }
+
+        spdlog::info("Cache warm up for {} finished, rendered {} frames", mSrcPath, numRendered);
+    });
+}
+
+void VirtualFileSystemImpl_MCRAW::stopWarmUp() {
+    mStopWarmUp = true;
+
+    if(mWarmUpThread.joinable())
+        mWarmUpThread.join();
+
+    mStopWarmUp = false;
+}
+
+int64_t VirtualFileSystemImpl_MCRAW::lastAccessedFrame() const {
+    return mLastAccessedFrame;
+}
+
+float VirtualFileSystemImpl_MCRAW::frameRate() const {
+    return getListing()->fps;
+}
+
+std::shared_ptr<Metrics> VirtualFileSystemImpl_MCRAW::getMetrics() const {
+    return mMetrics;
+}
+
+} // namespace motioncam
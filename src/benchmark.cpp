@@ -0,0 +1,807 @@
+#include "CachedBuffer.h"
+#include "CameraFrameMetadata.h"
+#include "CameraMetadata.h"
+#include "DecodedFrameCache.h"
+#include "LRUCache.h"
+#include "Logging.h"
+#include "SyntheticFrameSource.h"
+#include "ToolOptions.h"
+#include "Tracing.h"
+#include "Types.h"
+#include "Utils.h"
+#include "VirtualFileSystemImpl_MCRAW.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <BS_thread_pool.hpp>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+using json = nlohmann::json;
+
+namespace {
+    using motioncam::tools::toInt;
+
+    constexpr int DEFAULT_WIDTH = 4032;
+    constexpr int DEFAULT_HEIGHT = 3024;
+    constexpr int DEFAULT_ENTRIES = 100000;
+    constexpr double DEFAULT_MIN_TIME_SECONDS = 1.0;
+    constexpr int MIN_ITERATIONS = 3;
+    constexpr int MAX_ITERATIONS = 100000;
+
+    constexpr unsigned short BLACK_LEVEL = 64;
+    constexpr unsigned short WHITE_LEVEL = 1023;
+    constexpr int SHADING_MAP_WIDTH = 17;
+    constexpr int SHADING_MAP_HEIGHT = 13;
+
+    constexpr size_t CACHE_KEYS = 512;
+    constexpr size_t CACHE_VALUE_SIZE = 64 * 1024;
+    constexpr size_t CACHE_OPS = 200000;
+    constexpr size_t ENTRY_LOOKUPS = 64;
+
+    constexpr int PIPELINE_FRAMES = 32;
+    constexpr int PIPELINE_IO_THREADS = 4;
+    constexpr size_t PIPELINE_CACHE_SIZE = size_t(4096) * 1024 * 1024;
+    constexpr size_t PIPELINE_DECODED_CACHE_SIZE = size_t(1024) * 1024 * 1024;
+
+    struct Options {
+        int width = DEFAULT_WIDTH;
+        int height = DEFAULT_HEIGHT;
+        int entries = DEFAULT_ENTRIES;
+        double minTimeSeconds = DEFAULT_MIN_TIME_SECONDS;
+        std::string filter;
+        std::string outputFile;
+        std::string clip;
+        std::string traceFile;
+    };
+
+    // A benchmark is timed over repeated calls of run(), setup() is called before each one
+    // outside of the timing. Each call processes the given number of bytes and items.
+    struct Benchmark {
+        std::string name;
+        json params;
+        std::function<void()> setup;
+        std::function<void()> run;
+        size_t bytesPerRun;
+        size_t itemsPerRun;
+    };
+
+    void printUsage(const char* program) {
+        std::cout <<
+            "Usage: " << program << " [options]\n"
+            "\n"
+            "Times the render and cache hot paths on synthetic data and writes the results as\n"
+            "JSON, to compare builds and machines.\n"
+            "\n"
+            "Synthetic clips are generated in memory, they measure rendering, the caches and the\n"
+            "thread pools only. MCRAW parsing, decompression and disk reads are left out unless\n"
+            "--clip names an MCRAW file.\n"
+            "\n"
+            "Options:\n"
+            "      --filter <text>           Only run benchmarks whose name contains <text>\n"
+            "  -o, --output <file>           Write the JSON to <file> instead of stdout\n"
+            "      --width <n>               Frame width (default: 4032)\n"
+            "      --height <n>              Frame height (default: 3024)\n"
+            "      --entries <n>             Entries in the listing searched by findEntry (default: 100000)\n"
+            "      --clip <path>             Clip rendered by the pipeline benchmarks, an MCRAW file or a\n"
+            "                                synthetic:name?key=value&... clip (default: 32 synthetic\n"
+            "                                frames, render only)\n"
+            "      --min-time <seconds>      Minimum time spent in each benchmark (default: 1)\n"
+            "      --trace <file>            Record a Chrome trace of the benchmarks to <file>\n"
+            "  -h, --help                    Show this help\n";
+    }
+
+    // Returns false if only the help should be shown
+    bool parseArgs(int argc, char* argv[], Options& options) {
+        for(int i = 1; i < argc; ++i) {
+            const std::string arg(argv[i]);
+
+            auto nextValue = [&]() -> std::string {
+                if(i + 1 >= argc)
+                    throw std::runtime_error("Missing value for " + arg);
+
+                return argv[++i];
+            };
+
+            if(arg == "-h" || arg == "--help")
+                return false;
+            else if(arg == "--filter")
+                options.filter = nextValue();
+            else if(arg == "-o" || arg == "--output")
+                options.outputFile = nextValue();
+            else if(arg == "--trace")
+                options.traceFile = nextValue();
+            else if(arg == "--width")
+                options.width = toInt(arg, nextValue(), 16);
+            else if(arg == "--height")
+                options.height = toInt(arg, nextValue(), 16);
+            else if(arg == "--entries")
+                options.entries = toInt(arg, nextValue(), 1);
+            else if(arg == "--clip")
+                options.clip = nextValue();
+            else if(arg == "--min-time") {
+                try {
+                    options.minTimeSeconds = std::stod(nextValue());
+                }
+                catch(const std::exception&) {
+                    throw std::runtime_error("Invalid value for " + arg);
+                }
+            }
+            else
+                throw std::runtime_error("Unknown option " + arg);
+        }
+
+        // Keeps whole groups of 4 pixels for the encoders at every scale
+        options.width = (options.width / 32) * 32;
+        options.height = (options.height / 32) * 32;
+
+        if(options.clip.empty()) {
+            motioncam::SyntheticClipOptions clip;
+
+            clip.name = "benchmark";
+            clip.width = options.width;
+            clip.height = options.height;
+            clip.numFrames = PIPELINE_FRAMES;
+            clip.audioChannels = 0;
+
+            options.clip = clip.toPath();
+        }
+
+        return true;
+    }
+
+    //
+    // Synthetic inputs
+    //
+
+    std::vector<uint8_t> generateRawData(int width, int height) {
+        std::vector<uint8_t> data(sizeof(uint16_t) * width * height);
+        auto* pixels = reinterpret_cast<uint16_t*>(data.data());
+
+        std::mt19937 rng(1234);
+        std::uniform_int_distribution<int> dist(BLACK_LEVEL, WHITE_LEVEL);
+
+        for(size_t i = 0; i < static_cast<size_t>(width) * height; ++i)
+            pixels[i] = static_cast<uint16_t>(dist(rng));
+
+        return data;
+    }
+
+    // Data as it is before packing, filling the whole 16 bits
+    std::vector<uint8_t> generatePackInput(int width, int height, int bits) {
+        auto data = generateRawData(width, height);
+        auto* pixels = reinterpret_cast<uint16_t*>(data.data());
+
+        for(size_t i = 0; i < static_cast<size_t>(width) * height; ++i)
+            pixels[i] = static_cast<uint16_t>(pixels[i] & ((1 << bits) - 1));
+
+        return data;
+    }
+
+    motioncam::CameraFrameMetadata generateMetadata(int width, int height) {
+        motioncam::CameraFrameMetadata metadata{};
+
+        metadata.asShotNeutral = { 0.5f, 1.0f, 0.6f };
+        metadata.dynamicBlackLevel = { BLACK_LEVEL, BLACK_LEVEL, BLACK_LEVEL, BLACK_LEVEL };
+        metadata.dynamicWhiteLevel = WHITE_LEVEL;
+        metadata.exposureTime = 1e9 / 50;
+        metadata.iso = 100;
+        metadata.width = width;
+        metadata.height = height;
+        metadata.originalWidth = width;
+        metadata.originalHeight = height;
+        metadata.orientation = motioncam::ScreenOrientation::LANDSCAPE;
+
+        // Gains rise towards the corners like a real lens
+        std::vector<float> gains(4 * SHADING_MAP_WIDTH * SHADING_MAP_HEIGHT);
+
+        for(int c = 0; c < 4; ++c) {
+            float* channel = gains.data() + c * SHADING_MAP_WIDTH * SHADING_MAP_HEIGHT;
+
+            for(int y = 0; y < SHADING_MAP_HEIGHT; ++y) {
+                for(int x = 0; x < SHADING_MAP_WIDTH; ++x) {
+                    const float dx = x / float(SHADING_MAP_WIDTH - 1) - 0.5f;
+                    const float dy = y / float(SHADING_MAP_HEIGHT - 1) - 0.5f;
+
+                    channel[y * SHADING_MAP_WIDTH + x] = 1.0f + 2.0f * (dx * dx + dy * dy);
+                }
+            }
+        }
+
+        metadata.lensShadingMap = motioncam::ShadingMap::intern(SHADING_MAP_WIDTH, SHADING_MAP_HEIGHT, std::move(gains));
+
+        return metadata;
+    }
+
+    motioncam::CameraConfiguration generateCameraConfiguration() {
+        motioncam::CameraConfiguration config{};
+
+        const std::array<float, 9> identity = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+
+        config.blackLevel = { BLACK_LEVEL, BLACK_LEVEL, BLACK_LEVEL, BLACK_LEVEL };
+        config.whiteLevel = WHITE_LEVEL;
+        config.sensorArrangement = "rggb";
+        config.colorIlluminant1 = "standarda";
+        config.colorIlluminant2 = "d65";
+        config.colorMatrix1 = identity;
+        config.colorMatrix2 = identity;
+        config.forwardMatrix1 = identity;
+        config.forwardMatrix2 = identity;
+        config.calibrationMatrix1 = identity;
+        config.calibrationMatrix2 = identity;
+        config.extraData.postProcessSettings.metadata.buildModel = "Benchmark";
+
+        return config;
+    }
+
+    // Listing laid out like a mount, an audio file followed by the frames
+    std::vector<motioncam::Entry> generateEntries(int numEntries) {
+        std::vector<motioncam::Entry> entries;
+
+        entries.reserve(numEntries);
+
+        motioncam::Entry audio;
+
+        audio.type = motioncam::EntryType::FILE_ENTRY;
+        audio.name = "audio.wav";
+        audio.size = 0;
+
+        entries.push_back(audio);
+
+        for(int i = 1; i < numEntries; ++i) {
+            motioncam::Entry entry;
+
+            entry.type = motioncam::EntryType::FILE_ENTRY;
+            entry.size = 24 * 1024 * 1024;
+            entry.name = motioncam::utils::constructFrameFilename("frame-", i - 1, 6, "dng");
+            entry.userData = motioncam::FrameInfo{ i * 33333333LL, i - 1 };
+
+            entries.push_back(entry);
+        }
+
+        return entries;
+    }
+
+    //
+    // Benchmarks
+    //
+
+    void addPreprocessBenchmarks(std::vector<Benchmark>& benchmarks, const Options& options) {
+        auto data = std::make_shared<std::vector<uint8_t>>(generateRawData(options.width, options.height));
+        auto metadata = std::make_shared<motioncam::CameraFrameMetadata>(generateMetadata(options.width, options.height));
+        auto config = std::make_shared<motioncam::CameraConfiguration>(generateCameraConfiguration());
+
+        const std::array<uint8_t, 4> cfa = { 0, 1, 1, 2 };
+
+        for(bool applyShadingMap : { false, true }) {
+            for(uint32_t scale : { 1, 2, 4, 8 }) {
+                Benchmark b;
+
+                b.name = "preprocessData";
+                b.params = { { "scale", scale }, { "shadingMap", applyShadingMap } };
+                b.bytesPerRun = data->size();
+                b.itemsPerRun = static_cast<size_t>(options.width) * options.height;
+
+                b.run = [=, width = options.width, height = options.height] {
+                    uint32_t w = width;
+                    uint32_t h = height;
+
+                    auto result = motioncam::utils::preprocessData(
+                        *data, w, h, *metadata, *config, cfa, scale, applyShadingMap, false);
+
+                    if(std::get<0>(result).empty())
+                        throw std::runtime_error("preprocessData returned no data");
+                };
+
+                benchmarks.push_back(std::move(b));
+            }
+        }
+    }
+
+    void addEncodeBenchmarks(std::vector<Benchmark>& benchmarks, const Options& options) {
+        using EncodeFunction = void (*)(std::vector<uint8_t>&, uint32_t&, uint32_t&);
+
+        const std::vector<std::pair<int, EncodeFunction>> encoders = {
+            { 10, &motioncam::utils::encodeTo10Bit },
+            { 12, &motioncam::utils::encodeTo12Bit },
+            { 14, &motioncam::utils::encodeTo14Bit }
+        };
+
+        for(auto& [bits, encode] : encoders) {
+            auto input = std::make_shared<std::vector<uint8_t>>(generatePackInput(options.width, options.height, bits));
+            auto buffer = std::make_shared<std::vector<uint8_t>>();
+
+            Benchmark b;
+
+            b.name = "encodeTo" + std::to_string(bits) + "Bit";
+            b.params = json::object();
+            b.bytesPerRun = input->size();
+            b.itemsPerRun = static_cast<size_t>(options.width) * options.height;
+
+            // Encoding happens in place, start from the same input each time
+            b.setup = [input, buffer] { *buffer = *input; };
+            b.run = [buffer, encode = encode, width = options.width, height = options.height] {
+                uint32_t w = width;
+                uint32_t h = height;
+
+                encode(*buffer, w, h);
+            };
+
+            benchmarks.push_back(std::move(b));
+        }
+    }
+
+    void addGenerateDngBenchmarks(std::vector<Benchmark>& benchmarks, const Options& options) {
+        auto data = std::make_shared<std::vector<uint8_t>>(generateRawData(options.width, options.height));
+        auto metadata = std::make_shared<motioncam::CameraFrameMetadata>(generateMetadata(options.width, options.height));
+        auto config = motioncam::utils::makeRenderConfig(std::make_shared<const motioncam::CameraConfiguration>(generateCameraConfiguration()));
+
+        const std::vector<std::pair<std::string, motioncam::FileRenderOptions>> renderOptions = {
+            { "none", motioncam::RENDER_OPT_NONE },
+            { "vignetteCorrection", motioncam::RENDER_OPT_APPLY_VIGNETTE_CORRECTION },
+            { "normalizeShadingMap", motioncam::RENDER_OPT_APPLY_VIGNETTE_CORRECTION | motioncam::RENDER_OPT_NORMALIZE_SHADING_MAP }
+        };
+
+        for(auto& [optionsName, renderOption] : renderOptions) {
+            for(int scale : { 1, 2, 4 }) {
+                Benchmark b;
+
+                b.name = "generateDng";
+                b.params = { { "options", optionsName }, { "scale", scale } };
+                b.bytesPerRun = data->size();
+                b.itemsPerRun = 1;
+
+                b.run = [=, renderOption = renderOption] {
+                    auto dng = motioncam::utils::generateDng(*data, *metadata, *config, 30.0f, 0, renderOption, scale);
+
+                    if(!dng || dng->empty())
+                        throw std::runtime_error("generateDng returned no data");
+                };
+
+                benchmarks.push_back(std::move(b));
+            }
+        }
+    }
+
+    // Metadata of a frame as the container holds it, with a 17x13 shading map
+    void addMetadataBenchmarks(std::vector<Benchmark>& benchmarks) {
+        using ParseFunction = motioncam::CameraFrameMetadata (*)(const nlohmann::json&);
+
+        motioncam::SyntheticClipOptions clip;
+
+        clip.name = "metadata";
+        clip.width = 64;
+        clip.height = 64;
+        clip.numFrames = 1;
+        clip.audioChannels = 0;
+
+        auto source = motioncam::openFrameSource(clip.toPath());
+        auto metadata = std::make_shared<nlohmann::json>();
+        std::vector<uint8_t> data;
+
+        source->loadFrame(source->getFrames().front(), data, *metadata);
+
+        const std::vector<std::pair<std::string, ParseFunction>> parsers = {
+            { "parseFrameMetadata", &motioncam::CameraFrameMetadata::parse },
+            { "parseFrameMetadataForRender", &motioncam::CameraFrameMetadata::parseForRender }
+        };
+
+        for(auto& [name, parse] : parsers) {
+            Benchmark b;
+
+            b.name = name;
+            b.params = json::object();
+            b.bytesPerRun = metadata->dump().size();
+            b.itemsPerRun = 1;
+
+            b.run = [metadata, parse = parse] {
+                auto frame = parse(*metadata);
+
+                if(!frame.lensShadingMap)
+                    throw std::runtime_error("Shading map was not parsed");
+            };
+
+            benchmarks.push_back(std::move(b));
+        }
+    }
+
+    // Threads share the cache and do get() followed by put() on a miss, the way a mount
+    // fills it. Half of the keys fit so there is a steady mix of hits, misses and evictions.
+    void addCacheBenchmarks(std::vector<Benchmark>& benchmarks) {
+        auto value = std::make_shared<motioncam::CachedBuffer>(
+            std::make_shared<std::vector<char>>(CACHE_VALUE_SIZE));
+
+        const auto cacheSize = value->memoryUsage() * (CACHE_KEYS / 2);
+
+        for(int numThreads : { 1, 2, 4, 8, 16, 32, 64 }) {
+            auto cache = std::make_shared<motioncam::LRUCache>(cacheSize);
+
+            Benchmark b;
+
+            b.name = "LRUCache.getPut";
+            b.params = { { "threads", numThreads } };
+            b.bytesPerRun = 0;
+            b.itemsPerRun = CACHE_OPS;
+
+            b.setup = [cache] { cache->clear(); };
+            b.run = [cache, value, numThreads] {
+                std::vector<std::thread> threads;
+                const size_t opsPerThread = CACHE_OPS / numThreads;
+
+                for(int t = 0; t < numThreads; ++t) {
+                    threads.emplace_back([&, t] {
+                        std::mt19937 rng(t);
+                        std::uniform_int_distribution<size_t> dist(0, CACHE_KEYS - 1);
+
+                        motioncam::CacheKey key{ "benchmark.mcraw", 0, motioncam::RENDER_OPT_NONE, 1 };
+
+                        for(size_t i = 0; i < opsPerThread; ++i) {
+                            key.timestamp = static_cast<int64_t>(dist(rng));
+
+                            if(!cache->get(key))
+                                cache->put(key, value);
+                        }
+                    });
+                }
+
+                for(auto& thread : threads)
+                    thread.join();
+            };
+
+            benchmarks.push_back(std::move(b));
+        }
+    }
+
+    // Looks up paths spread over the whole listing plus one that doesn't exist
+    void addFindEntryBenchmarks(std::vector<Benchmark>& benchmarks, const Options& options) {
+        auto entries = std::make_shared<std::vector<motioncam::Entry>>(generateEntries(options.entries));
+        auto paths = std::make_shared<std::vector<std::string>>();
+
+        for(size_t i = 0; i < ENTRY_LOOKUPS - 1; ++i)
+            paths->push_back("/" + (*entries)[(i * entries->size()) / (ENTRY_LOOKUPS - 1)].name);
+
+        paths->push_back("/missing.dng");
+
+        Benchmark b;
+
+        b.name = "findEntry";
+        b.params = { { "entries", entries->size() } };
+        b.bytesPerRun = 0;
+        b.itemsPerRun = paths->size();
+
+        b.run = [entries, paths] {
+            size_t found = 0;
+
+            for(auto& path : *paths) {
+                if(motioncam::utils::findEntry(*entries, path).has_value())
+                    ++found;
+            }
+
+            if(found != paths->size() - 1)
+                throw std::runtime_error("findEntry did not find all entries");
+        };
+
+        benchmarks.push_back(std::move(b));
+    }
+
+    // Everything a mount needs to render frames
+    struct Pipeline {
+        BS::thread_pool ioThreadPool;
+        BS::thread_pool processingThreadPool;
+        motioncam::LRUCache cache;
+        motioncam::DecodedFrameCache decodedFrameCache;
+        std::unique_ptr<motioncam::VirtualFileSystemImpl_MCRAW> fs;
+
+        Pipeline(const std::string& clip, motioncam::FileRenderOptions options) :
+            ioThreadPool(PIPELINE_IO_THREADS),
+            processingThreadPool(0),
+            cache(PIPELINE_CACHE_SIZE),
+            decodedFrameCache(PIPELINE_DECODED_CACHE_SIZE)
+        {
+            fs = std::make_unique<motioncam::VirtualFileSystemImpl_MCRAW>(
+                ioThreadPool, processingThreadPool, cache, decodedFrameCache, options, 2, clip);
+        }
+
+        // Torn down like a mount, tasks still running can't outlive the pools
+        ~Pipeline() {
+            fs.reset();
+
+            ioThreadPool.wait();
+            processingThreadPool.wait();
+        }
+
+        // Start from cold caches so that every frame is read from the clip and rendered
+        void clearCaches() {
+            cache.clear();
+
+            decodedFrameCache.resize(0);
+            decodedFrameCache.resize(PIPELINE_DECODED_CACHE_SIZE);
+        }
+    };
+
+    // Reads every frame of the clip through readFile() at once, the way an NLE fills its
+    // buffers, and waits for all of them
+    void addPipelineBenchmarks(std::vector<Benchmark>& benchmarks, const Options& options) {
+        const std::string name = "pipeline.readFrames";
+
+        // Opening the clip renders a frame, skip it unless the benchmark is going to run
+        if(!options.filter.empty() && name.find(options.filter) == std::string::npos)
+            return;
+
+        const std::vector<std::pair<std::string, motioncam::FileRenderOptions>> renderOptions = {
+            { "none", motioncam::RENDER_OPT_NONE },
+            { "draft", motioncam::RENDER_OPT_DRAFT },
+            { "vignetteCorrection", motioncam::RENDER_OPT_APPLY_VIGNETTE_CORRECTION }
+        };
+
+        for(auto& [optionsName, renderOption] : renderOptions) {
+            auto pipeline = std::make_shared<Pipeline>(options.clip, renderOption);
+            auto frames = std::make_shared<std::vector<motioncam::Entry>>();
+            auto buffers = std::make_shared<std::vector<std::vector<char>>>();
+
+            size_t totalBytes = 0;
+
+            for(auto& entry : pipeline->fs->listFiles()) {
+                if(std::holds_alternative<motioncam::FrameInfo>(entry.userData)) {
+                    frames->push_back(entry);
+                    buffers->emplace_back(entry.size);
+
+                    totalBytes += entry.size;
+                }
+            }
+
+            if(frames->empty())
+                throw std::runtime_error("No frames in " + options.clip);
+
+            Benchmark b;
+
+            b.name = name;
+            b.params = { { "options", optionsName }, { "clip", options.clip } };
+            b.bytesPerRun = totalBytes;
+            b.itemsPerRun = frames->size();
+
+            b.setup = [pipeline] { pipeline->clearCaches(); };
+            b.run = [pipeline, frames, buffers] {
+                std::mutex mutex;
+                std::condition_variable done;
+                size_t pending = frames->size();
+                bool failed = false;
+
+                auto complete = [&](bool success) {
+                    std::lock_guard<std::mutex> lock(mutex);
+
+                    failed |= !success;
+                    if(--pending == 0)
+                        done.notify_one();
+                };
+
+                for(size_t i = 0; i < frames->size(); ++i) {
+                    const auto& entry = (*frames)[i];
+
+                    const auto result = pipeline->fs->readFile(
+                        entry, 0, entry.size, (*buffers)[i].data(),
+                        [&complete](size_t readBytes, int errorCode) { complete(errorCode == 0 && readBytes > 0); });
+
+                    // Answered from the cache without calling back
+                    if(result != 0)
+                        complete(result > 0);
+                }
+
+                std::unique_lock<std::mutex> lock(mutex);
+                done.wait(lock, [&] { return pending == 0; });
+
+                if(failed)
+                    throw std::runtime_error("Failed to read frames from the clip");
+            };
+
+            benchmarks.push_back(std::move(b));
+        }
+    }
+
+    //
+    // Runner
+    //
+
+    double percentile(const std::vector<double>& sorted, double p) {
+        const auto index = static_cast<size_t>(std::ceil(p * sorted.size())) - 1;
+        return sorted[(std::min)(index, sorted.size() - 1)];
+    }
+
+    json runBenchmark(const Benchmark& b, double minTimeSeconds) {
+        using clock = std::chrono::steady_clock;
+
+        std::vector<double> samples;
+        double totalSeconds = 0;
+
+        // First run warms up caches and allocators and is not counted
+        if(b.setup)
+            b.setup();
+        b.run();
+
+        while((samples.size() < MIN_ITERATIONS || totalSeconds < minTimeSeconds) && samples.size() < MAX_ITERATIONS) {
+            if(b.setup)
+                b.setup();
+
+            const auto start = clock::now();
+            b.run();
+            const auto end = clock::now();
+
+            const auto seconds = std::chrono::duration<double>(end - start).count();
+
+            samples.push_back(seconds * 1e9);
+            totalSeconds += seconds;
+        }
+
+        std::sort(samples.begin(), samples.end());
+
+        const auto n = static_cast<double>(samples.size());
+        const auto mean = std::accumulate(samples.begin(), samples.end(), 0.0) / n;
+
+        double variance = 0;
+        for(auto s : samples)
+            variance += (s - mean) * (s - mean);
+
+        json result = {
+            { "name", b.name },
+            { "params", b.params },
+            { "iterations", samples.size() },
+            { "mean_ns", mean },
+            { "median_ns", percentile(samples, 0.5) },
+            { "p95_ns", percentile(samples, 0.95) },
+            { "min_ns", samples.front() },
+            { "max_ns", samples.back() },
+            { "stddev_ns", std::sqrt(variance / n) }
+        };
+
+        // Rates from the median so that outliers don't skew comparisons
+        const auto medianSeconds = percentile(samples, 0.5) / 1e9;
+
+        if(b.bytesPerRun > 0)
+            result["bytes_per_second"] = b.bytesPerRun / medianSeconds;
+
+        if(b.itemsPerRun > 0)
+            result["items_per_second"] = b.itemsPerRun / medianSeconds;
+
+        return result;
+    }
+
+    json getContext(const Options& options) {
+        const auto now = std::time(nullptr);
+        char date[32];
+
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+        json context = {
+            { "date", date },
+            { "hardware_concurrency", std::thread::hardware_concurrency() },
+            { "width", options.width },
+            { "height", options.height },
+            { "min_time_seconds", options.minTimeSeconds },
+#ifdef NDEBUG
+            { "build_type", "release" },
+#else
+            { "build_type", "debug" },
+#endif
+        };
+
+#if defined(__clang__)
+        context["compiler"] = "clang " __clang_version__;
+#elif defined(__GNUC__)
+        context["compiler"] = "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+        context["compiler"] = "msvc " + std::to_string(_MSC_FULL_VER);
+#endif
+
+        return context;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+
+    try {
+        if(!parseArgs(argc, argv, options)) {
+            printUsage(argv[0]);
+            return 0;
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << "\n\n";
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    motioncam::setupLogging("");
+
+    // Keep the debug timings of Measure and the cache out of the results
+    spdlog::set_level(spdlog::level::warn);
+
+    std::vector<Benchmark> benchmarks;
+
+    addPreprocessBenchmarks(benchmarks, options);
+    addEncodeBenchmarks(benchmarks, options);
+    addGenerateDngBenchmarks(benchmarks, options);
+    addMetadataBenchmarks(benchmarks);
+    addCacheBenchmarks(benchmarks);
+    addFindEntryBenchmarks(benchmarks, options);
+
+    try {
+        addPipelineBenchmarks(benchmarks, options);
+    }
+    catch(const std::exception& e) {
+        std::cerr << "Failed to open " << options.clip << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    json results = json::array();
+
+    if(!options.traceFile.empty())
+        motioncam::Trace::start();
+
+    for(auto& b : benchmarks) {
+        if(!options.filter.empty() && b.name.find(options.filter) == std::string::npos)
+            continue;
+
+        std::cerr << "Running " << b.name << " " << b.params.dump() << std::endl;
+
+        try {
+            results.push_back(runBenchmark(b, options.minTimeSeconds));
+        }
+        catch(const std::exception& e) {
+            std::cerr << "Failed: " << e.what() << std::endl;
+            return 1;
+        }
+
+        // Frees the inputs and caches held by the benchmark before the next one
+        b.setup = nullptr;
+        b.run = nullptr;
+    }
+
+    if(!options.traceFile.empty()) {
+        motioncam::Trace::stop();
+
+        try {
+            motioncam::Trace::write(options.traceFile);
+        }
+        catch(const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    const json output = {
+        { "context", getContext(options) },
+        { "benchmarks", results }
+    };
+
+    if(options.outputFile.empty()) {
+        std::cout << output.dump(2) << std::endl;
+    }
+    else {
+        std::ofstream file(options.outputFile);
+
+        file << output.dump(2) << std::endl;
+
+        if(!file) {
+            std::cerr << "Failed to write " << options.outputFile << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
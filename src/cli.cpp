@@ -0,0 +1,399 @@
+#include "IFuseFileSystem.h"
+#include "AccessLog.h"
+#include "Exporter.h"
+#include "Logging.h"
+#include "Metrics.h"
+#include "ToolOptions.h"
+#include "Tracing.h"
+
+#ifdef _WIN32
+#include "win/FuseFileSystemImpl_Win.h"
+#elif __APPLE__
+#include "macos/FuseFileSystemImpl_MacOS.h"
+#elif __linux__
+#include "linux/FuseFileSystemImpl_Linux.h"
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <csignal>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+#include <spdlog/spdlog.h>
+
+namespace fs = boost::filesystem;
+
+namespace {
+    using motioncam::tools::toDraftScale;
+    using motioncam::tools::toInt;
+    using motioncam::tools::parseRenderOption;
+
+    constexpr auto DEFAULT_CACHE_SIZE_MB = 1024;
+    constexpr auto POLL_INTERVAL = std::chrono::milliseconds(200);
+
+    std::atomic_bool stopRequested(false);
+    std::atomic_bool traceToggleRequested(false);
+
+    struct Options {
+        std::vector<std::string> files;
+        std::string mountRoot;
+        std::string exportRoot;
+        motioncam::FileRenderOptions renderOptions = motioncam::RENDER_OPT_NONE;
+        int draftScale = 2;
+        int cacheSizeMb = DEFAULT_CACHE_SIZE_MB;
+        bool compressCache = false;
+        int renderMemoryMb = -1;        // -1 keeps the default
+        unsigned int ioThreads = 0;
+        unsigned int processingThreads = 0;
+        unsigned int writerThreads = 0;
+        int warmUpFrames = 0;
+        int statsIntervalSeconds = 0;
+        std::string traceFile;
+        std::string accessLogFile;
+        bool verbose = false;
+    };
+
+    void onSignal(int) {
+        stopRequested = true;
+    }
+
+    void onToggleTrace(int) {
+        traceToggleRequested = true;
+    }
+
+    void printUsage(const char* program) {
+        std::cout <<
+            "Usage: " << program << " [options] <file.mcraw|folder>...\n"
+            "\n"
+            "Mounts each file as a folder of DNG frames until interrupted. A folder is mounted\n"
+            "as a library at <name>_dng with a subdirectory for each MCRAW file in it.\n"
+            "\n"
+            "With --export the frames are written to disk instead, into <dir>/<name> for\n"
+            "each file. An interrupted export continues where it stopped when run again.\n"
+            "\n"
+            "Options:\n"
+            "  -m, --mount-root <dir>        Mount under <dir>/<name> instead of next to each file\n"
+            "  -e, --export <dir>            Export DNG sequences to <dir> and exit\n"
+            "  -d, --draft                   Render draft quality frames\n"
+            "  -s, --draft-scale <2|4|8>     Downscale factor in draft mode (default: 2)\n"
+            "      --vignette-correction     Apply vignette correction\n"
+            "      --normalize-shading-map   Normalize the shading map\n"
+            "  -c, --cache-size <MB>         Render cache size, 0 follows free memory (default: 1024)\n"
+            "      --compress-cache          Store cached frames compressed\n"
+            "      --render-memory <MB>      Memory frames being rendered may hold at once, reads\n"
+            "                                wait beyond it, 0 for no limit (default: 2048)\n"
+            "      --io-threads <n>          Threads reading from the files (default: 4, 2 when exporting)\n"
+            "      --processing-threads <n>  Threads rendering frames (default: one per core)\n"
+            "      --writer-threads <n>      Threads writing exported frames (default: 2)\n"
+            "      --warm-up <frames>        Render the first frames of each file after mounting,\n"
+            "                                not done for libraries\n"
+            "      --stats <seconds>         Print stage latencies and memory every <seconds> while\n"
+            "                                mounted, they are always printed when unmounting\n"
+            "      --trace <file>            Record a Chrome trace of the reads to <file>. Where\n"
+            "                                supported SIGUSR1 writes it and starts a new one.\n"
+            "      --record-access <file>    Record every read to <file>, to be replayed with\n"
+            "                                motioncam-fs-replay\n"
+            "  -v, --verbose                 Log debug messages, when compiled in (see\n"
+            "                                MOTIONCAM_FS_LOG_LEVEL)\n"
+            "  -h, --help                    Show this help\n";
+    }
+
+    // Returns false if only the help should be shown
+    bool parseArgs(int argc, char* argv[], Options& options) {
+        for(int i = 1; i < argc; ++i) {
+            const std::string arg(argv[i]);
+
+            auto nextValue = [&]() -> std::string {
+                if(i + 1 >= argc)
+                    throw std::runtime_error("Missing value for " + arg);
+
+                return argv[++i];
+            };
+
+            if(arg == "-h" || arg == "--help")
+                return false;
+            else if(arg == "-m" || arg == "--mount-root")
+                options.mountRoot = nextValue();
+            else if(arg == "-e" || arg == "--export")
+                options.exportRoot = nextValue();
+            else if(arg == "-d" || arg == "--draft")
+                options.renderOptions |= motioncam::RENDER_OPT_DRAFT;
+            else if(arg == "-s" || arg == "--draft-scale")
+                options.draftScale = toDraftScale(arg, nextValue());
+            else if(parseRenderOption(arg, options.renderOptions))
+                continue;
+            else if(arg == "-c" || arg == "--cache-size")
+                options.cacheSizeMb = toInt(arg, nextValue(), 0);
+            else if(arg == "--compress-cache")
+                options.compressCache = true;
+            else if(arg == "--render-memory")
+                options.renderMemoryMb = toInt(arg, nextValue(), 0);
+            else if(arg == "--io-threads")
+                options.ioThreads = toInt(arg, nextValue(), 1);
+            else if(arg == "--processing-threads")
+                options.processingThreads = toInt(arg, nextValue(), 1);
+            else if(arg == "--writer-threads")
+                options.writerThreads = toInt(arg, nextValue(), 1);
+            else if(arg == "--warm-up")
+                options.warmUpFrames = toInt(arg, nextValue(), 0);
+            else if(arg == "--stats")
+                options.statsIntervalSeconds = toInt(arg, nextValue(), 1);
+            else if(arg == "--trace")
+                options.traceFile = nextValue();
+            else if(arg == "--record-access")
+                options.accessLogFile = nextValue();
+            else if(arg == "-v" || arg == "--verbose")
+                options.verbose = true;
+            else if(!arg.empty() && arg[0] == '-')
+                throw std::runtime_error("Unknown option " + arg);
+            else
+                options.files.push_back(arg);
+        }
+
+        if(options.files.empty())
+            throw std::runtime_error("No files to mount");
+
+        return true;
+    }
+
+    std::string getMountPath(const Options& options, const std::string& file, bool isLibrary) {
+        fs::path srcPath = fs::absolute(file);
+
+        // Trailing separators would leave the folder without a name
+        if(isLibrary && !srcPath.has_filename())
+            srcPath = srcPath.parent_path();
+
+        fs::path root = options.mountRoot.empty() ? srcPath.parent_path() : fs::absolute(options.mountRoot);
+
+        if(isLibrary)
+            return (root / (srcPath.filename().string() + "_dng")).string();
+
+        return (root / srcPath.stem()).string();
+    }
+
+    // Files to export, folders are expanded to the MCRAW files in them
+    std::vector<std::string> getExportFiles(const Options& options) {
+        std::vector<std::string> result;
+
+        for(const auto& file : options.files) {
+            if(!fs::is_directory(file)) {
+                result.push_back(file);
+                continue;
+            }
+
+            std::vector<std::string> folderFiles;
+
+            for(auto& it : fs::directory_iterator(file)) {
+                if(fs::is_regular_file(it.path()) && boost::iequals(it.path().extension().string(), ".mcraw"))
+                    folderFiles.push_back(it.path().string());
+            }
+
+            std::sort(folderFiles.begin(), folderFiles.end());
+            result.insert(result.end(), folderFiles.begin(), folderFiles.end());
+        }
+
+        return result;
+    }
+
+    void printStats(motioncam::IFuseFileSystem& fuseFilesystem, const std::vector<std::pair<std::string, motioncam::MountId>>& mounts) {
+        for(const auto& [name, mountId] : mounts) {
+            auto metrics = fuseFilesystem.getMetrics(mountId);
+            if(!metrics)
+                continue;
+
+            std::cout << "\n" << name << ":\n" << metrics->format() << std::flush;
+        }
+    }
+
+    void writeTrace(const std::string& path) {
+        try {
+            motioncam::Trace::stop();
+            motioncam::Trace::write(path);
+        }
+        catch(const std::exception& e) {
+            spdlog::error("Failed to write trace (error: {})", e.what());
+        }
+    }
+
+    int exportFiles(const Options& options) {
+        int numFailed = 0;
+
+        for(const auto& file : getExportFiles(options)) {
+            if(stopRequested)
+                break;
+
+            const auto name = fs::path(file).stem().string();
+            const auto dstFolder = (fs::absolute(options.exportRoot) / name).string();
+
+            try {
+                motioncam::Exporter exporter(
+                    file,
+                    dstFolder,
+                    options.renderOptions,
+                    options.draftScale,
+                    options.ioThreads,
+                    options.processingThreads,
+                    options.writerThreads);
+
+                exporter.run([&](const motioncam::ExportProgress& progress) {
+                    if(stopRequested)
+                        exporter.cancel();
+
+                    std::cout << "\r" << name << ": " << progress.framesDone << "/" << progress.totalFrames << " frames"
+                              << std::fixed << std::setprecision(1)
+                              << ", " << progress.framesPerSecond << " frames/s"
+                              << ", " << progress.megabytesPerSecond << " MB/s" << std::flush;
+                });
+
+                std::cout << "\n";
+            }
+            catch(const std::exception& e) {
+                std::cout << "\n";
+                spdlog::error("Failed to export {} (error: {})", file, e.what());
+
+                ++numFailed;
+            }
+        }
+
+        return numFailed > 0 ? 1 : 0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+
+    try {
+        if(!parseArgs(argc, argv, options)) {
+            printUsage(argv[0]);
+            return 0;
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << "\n\n";
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    motioncam::setupLogging("");
+
+    if(options.verbose)
+        spdlog::set_level(spdlog::level::debug);
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    if(!options.exportRoot.empty())
+        return exportFiles(options);
+
+#ifdef _WIN32
+    auto fuseFilesystem = std::make_unique<motioncam::FuseFileSystemImpl_Win>(options.ioThreads, options.processingThreads);
+#elif __APPLE__
+    auto fuseFilesystem = std::make_unique<motioncam::FuseFileSystemImpl_MacOs>(options.ioThreads, options.processingThreads);
+#elif __linux__
+    auto fuseFilesystem = std::make_unique<motioncam::FuseFileSystemImpl_Linux>(options.ioThreads, options.processingThreads);
+#endif
+
+    // In adaptive mode the cache starts from the default size and follows free memory
+    const auto cacheSizeMb = options.cacheSizeMb == 0 ? DEFAULT_CACHE_SIZE_MB : options.cacheSizeMb;
+
+    fuseFilesystem->setCacheSize(static_cast<size_t>(cacheSizeMb) * 1024 * 1024, options.cacheSizeMb == 0);
+    fuseFilesystem->setCacheCompression(options.compressCache);
+
+    if(options.renderMemoryMb >= 0)
+        fuseFilesystem->setRenderMemoryLimit(static_cast<size_t>(options.renderMemoryMb) * 1024 * 1024);
+
+    if(!options.accessLogFile.empty()) {
+        try {
+            motioncam::AccessLog::start(options.accessLogFile);
+        }
+        catch(const std::exception& e) {
+            spdlog::error("Failed to record reads (error: {})", e.what());
+            return 1;
+        }
+    }
+
+    std::vector<std::pair<std::string, motioncam::MountId>> mounts;
+
+    for(const auto& file : options.files) {
+        boost::system::error_code ec;
+
+        const bool isLibrary = fs::is_directory(file, ec);
+        const auto dstPath = getMountPath(options, file, isLibrary);
+
+        try {
+            if(isLibrary) {
+                auto mountId = fuseFilesystem->mountLibrary(options.renderOptions, options.draftScale, file, dstPath);
+
+                spdlog::info("Mounted library {} at {}", file, dstPath);
+                mounts.emplace_back(file, mountId);
+
+                continue;
+            }
+
+            auto mountId = fuseFilesystem->mount(options.renderOptions, options.draftScale, file, dstPath);
+
+            if(options.warmUpFrames > 0)
+                fuseFilesystem->warmCache(mountId, 0, options.warmUpFrames);
+
+            spdlog::info("Mounted {} at {}", file, dstPath);
+            mounts.emplace_back(file, mountId);
+        }
+        catch(const std::exception& e) {
+            spdlog::error("Failed to mount {} (error: {})", file, e.what());
+        }
+    }
+
+    if(mounts.empty())
+        return 1;
+
+    spdlog::info("Serving {} files (options: {}), send SIGTERM or press Ctrl+C to unmount",
+                 mounts.size(), motioncam::optionsToString(options.renderOptions));
+
+    auto nextStats = std::chrono::steady_clock::now() + std::chrono::seconds(options.statsIntervalSeconds);
+
+    if(!options.traceFile.empty()) {
+        motioncam::Trace::start();
+
+#ifdef SIGUSR1
+        std::signal(SIGUSR1, onToggleTrace);
+#endif
+    }
+
+    while(!stopRequested) {
+        std::this_thread::sleep_for(POLL_INTERVAL);
+
+        if(options.statsIntervalSeconds > 0 && std::chrono::steady_clock::now() >= nextStats) {
+            printStats(*fuseFilesystem, mounts);
+            nextStats += std::chrono::seconds(options.statsIntervalSeconds);
+        }
+
+        if(traceToggleRequested.exchange(false)) {
+            writeTrace(options.traceFile);
+            motioncam::Trace::start();
+        }
+    }
+
+    printStats(*fuseFilesystem, mounts);
+
+    if(!options.traceFile.empty())
+        writeTrace(options.traceFile);
+
+    motioncam::AccessLog::stop();
+
+    spdlog::info("Unmounting");
+
+    // Unmounts everything and waits for renders in flight
+    fuseFilesystem.reset();
+
+    return 0;
+}
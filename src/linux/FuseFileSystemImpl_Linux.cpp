@@ -0,0 +1,1145 @@
+#include "linux/FuseFileSystemImpl_Linux.h"
+#include "VirtualFileSystemImpl_MCRAW.h"
+#include "LRUCache.h"
+#include "CacheBudget.h"
+#include "DecodedFrameCache.h"
+#include "RenderMemoryLimit.h"
+#include "Measure.h"
+#include "Logging.h"
+#include "Tracing.h"
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <BS_thread_pool.hpp>
+
+#include <fuse_lowlevel.h>
+
+// Logging
+#include <spdlog/spdlog.h>
+
+namespace fs = boost::filesystem;
+
+namespace motioncam {
+
+constexpr auto DEFAULT_CACHE_SIZE = 1024 * 1024 * 1024; // 1 GB cache size until configured
+constexpr auto DECODED_FRAME_CACHE_SIZE = 512 * 1024 * 1024; // Raw frames kept for re-rendering and decoding ahead
+constexpr size_t DEFAULT_RENDER_MEMORY_LIMIT = size_t(2048) * 1024 * 1024; // Frames being rendered at once, reads wait beyond this
+constexpr auto IO_THREADS = 4;
+
+// Attributes and names only change with the render options, which invalidates them explicitly
+constexpr double ENTRY_TIMEOUT = 3600.0;
+constexpr double ATTR_TIMEOUT = 3600.0;
+
+// Largest read request and readahead asked of the kernel
+constexpr unsigned int MAX_READ = 1024 * 1024;
+constexpr unsigned int MAX_READAHEAD = 1024 * 1024;
+
+// Frame files use FIRST_FRAME_INODE + frame number, any other files are numbered from FUSE_ROOT_ID + 1
+constexpr fuse_ino_t FIRST_FRAME_INODE = 1024;
+
+// In a library each clip gets its own range of inodes, the clip index + 1 goes in the upper bits
+constexpr int CLIP_INODE_SHIFT = 40;
+constexpr fuse_ino_t CLIP_INODE_MASK = (fuse_ino_t(1) << CLIP_INODE_SHIFT) - 1;
+
+// Clips of a library that have not been used for a while are closed
+constexpr auto CLIP_IDLE_TIMEOUT = std::chrono::minutes(5);
+constexpr auto CLIP_IDLE_CHECK_INTERVAL = std::chrono::seconds(30);
+
+//
+
+namespace {
+    // Files of a clip, keyed by their inode number within the clip
+    struct InodeTable {
+        std::unordered_map<fuse_ino_t, Entry> entries;
+        std::unordered_map<std::string, fuse_ino_t> inodesByName;
+        std::vector<fuse_ino_t> directory; // Listing order
+    };
+
+    struct LoadedClip {
+        std::shared_ptr<VirtualFileSystemImpl_MCRAW> fs;
+        InodeTable inodes;
+    };
+
+    struct Clip {
+        std::string name;       // Directory name in a library, empty when the clip is the root of the mount
+        std::string srcFile;
+        fuse_ino_t base;        // Added to the inode numbers within the clip
+
+        std::mutex mutex;       // Held while the clip is loaded, updated or closed
+        std::shared_ptr<const LoadedClip> loaded;
+
+        std::atomic<int> openFiles{0};
+        std::atomic<int64_t> lastAccess{0};
+    };
+
+    // Kept in fuse_file_info::fh, holds on to the file system of the clip while the file is open
+    struct OpenFile {
+        Clip* clip;
+        std::shared_ptr<VirtualFileSystemImpl_MCRAW> fs;
+        std::unique_ptr<FileHandle> handle;
+    };
+
+    int64_t steadyNow() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    const Entry* findEntry(const std::shared_ptr<const LoadedClip>& loaded, fuse_ino_t localIno) {
+        if(!loaded)
+            return nullptr;
+
+        auto it = loaded->inodes.entries.find(localIno);
+
+        return it != loaded->inodes.entries.end() ? &it->second : nullptr;
+    }
+
+    // Assigns inode numbers to the files of a clip
+    InodeTable buildInodeTable(const VirtualFileSystemImpl_MCRAW& fs) {
+        InodeTable table;
+        fuse_ino_t nextInode = FUSE_ROOT_ID + 1;
+
+        for(auto& entry : fs.listFiles("/")) {
+            fuse_ino_t ino;
+
+            // Frames keep their inode when the options change, as long as the frame number stays the same
+            if(auto* frameInfo = std::get_if<FrameInfo>(&entry.userData))
+                ino = FIRST_FRAME_INODE + static_cast<fuse_ino_t>(frameInfo->frameNumber);
+            else if(nextInode < FIRST_FRAME_INODE)
+                ino = nextInode++;
+            else {
+                spdlog::warn("Too many files, not listing {}", entry.name);
+                continue;
+            }
+
+            if(ino > CLIP_INODE_MASK) {
+                spdlog::warn("Too many frames, not listing {}", entry.name);
+                continue;
+            }
+
+            table.inodesByName[entry.name] = ino;
+            table.directory.push_back(ino);
+            table.entries[ino] = std::move(entry);
+        }
+
+        return table;
+    }
+}
+
+class Session {
+public:
+    // A single file is mounted as the root directory. A library mounts each file as a
+    // subdirectory and only opens it once it is used.
+    Session(
+        const std::vector<std::string>& srcFiles,
+        const std::string& dstPath,
+        bool library,
+        FileRenderOptions options,
+        int draftScale,
+        ClipLoader loader);
+    ~Session();
+
+    void updateOptions(FileRenderOptions options, int draftScale);
+    void warmUp(int64_t startFrame, int numFrames);
+    int64_t lastAccessedFrame() const;
+
+    // File system of a mounted file, nullptr for libraries
+    std::shared_ptr<VirtualFileSystemImpl_MCRAW> getFileSystem();
+
+    // Shared by all clips of the session, so it survives clips being closed when idle
+    std::shared_ptr<Metrics> getMetrics() const;
+
+private:
+    void init();
+
+    void fuseMain();
+    void idleMain();
+
+    bool isLibraryRoot(fuse_ino_t ino) const;
+    fuse_ino_t clipRoot(const Clip& clip) const;
+
+    // Returns the clip an inode belongs to and sets localIno to the inode number within the clip
+    Clip* getClip(fuse_ino_t ino, fuse_ino_t& localIno) const;
+
+    // Opens the clip if needed, returns nullptr if it can't be read
+    std::shared_ptr<const LoadedClip> loadClip(Clip& clip);
+    void unloadIdleClips();
+
+    void fillAttr(fuse_ino_t ino, const Entry& entry, struct stat* stbuf) const;
+    void fillDirAttr(fuse_ino_t ino, struct stat* stbuf) const;
+    void readDirectory(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, bool plus);
+
+    // Reads are answered from the processing pool, the session has to outlive them
+    void beginRequest();
+    void endRequest();
+    void waitForRequests();
+
+    static Session* getSession(fuse_req_t req);
+    static void replySlice(fuse_req_t req, const FrameSlice& slice);
+
+    static void fuseInit(void* userdata, struct fuse_conn_info* conn);
+    static void fuseLookup(fuse_req_t req, fuse_ino_t parent, const char* name);
+    static void fuseGetattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+    static void fuseReaddir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi);
+    static void fuseReaddirPlus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi);
+    static void fuseOpen(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+    static void fuseRead(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi);
+    static void fuseRelease(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+
+private:
+    std::string mDstPath;
+    bool mLibrary;
+    ClipLoader mLoader;
+    std::shared_ptr<Metrics> mMetrics;
+    std::unique_ptr<std::thread> mThread;
+    struct fuse_session* mSession;
+    bool mMounted;
+    time_t mMountTime;
+
+    std::vector<std::unique_ptr<Clip>> mClips;
+    std::unordered_map<std::string, Clip*> mClipsByName;
+
+    std::mutex mOptionsMutex;
+    FileRenderOptions mOptions;
+    int mDraftScale;
+    std::atomic<uint64_t> mOptionsGeneration;
+
+    std::mutex mRequestMutex;
+    std::condition_variable mRequestCondition;
+    int mPendingRequests;
+
+    std::thread mIdleThread;
+    std::mutex mIdleMutex;
+    std::condition_variable mIdleCondition;
+    bool mStopping;
+
+    std::mutex mPageCacheMutex;
+    std::unordered_map<fuse_ino_t, uint64_t> mPageCacheGeneration; // Options generation of the last open
+
+    // Files the kernel hasn't released, no release arrives for them once unmounted
+    std::mutex mOpenFilesMutex;
+    std::unordered_set<OpenFile*> mOpenFiles;
+};
+
+
+Session::Session(
+    const std::vector<std::string>& srcFiles,
+    const std::string& dstPath,
+    bool library,
+    FileRenderOptions options,
+    int draftScale,
+    ClipLoader loader) :
+    mDstPath(dstPath),
+    mLibrary(library),
+    mLoader(std::move(loader)),
+    mMetrics(std::make_shared<Metrics>()),
+    mSession(nullptr),
+    mMounted(false),
+    mMountTime(time(NULL)),
+    mOptions(options),
+    mDraftScale(draftScale),
+    mOptionsGeneration(0),
+    mPendingRequests(0),
+    mStopping(false)
+{
+    for(auto& srcFile : srcFiles) {
+        auto clip = std::make_unique<Clip>();
+
+        clip->srcFile = srcFile;
+
+        if(mLibrary) {
+            clip->name = fs::path(srcFile).stem().string();
+
+            if(mClipsByName.find(clip->name) != mClipsByName.end()) {
+                spdlog::warn("Skipping {}, a clip named {} already exists", srcFile, clip->name);
+                continue;
+            }
+
+            clip->base = static_cast<fuse_ino_t>(mClips.size() + 1) << CLIP_INODE_SHIFT;
+            mClipsByName[clip->name] = clip.get();
+        }
+        else {
+            clip->base = 0;
+        }
+
+        mClips.push_back(std::move(clip));
+    }
+
+    // A single file is opened up front so that mounting fails if it can't be read
+    if(!mLibrary) {
+        if(mClips.size() != 1)
+            throw std::runtime_error("Expected a single file");
+
+        auto& clip = *mClips.front();
+        auto loaded = std::make_shared<LoadedClip>();
+
+        loaded->fs = mLoader(clip.srcFile, options, draftScale, mMetrics);
+        loaded->inodes = buildInodeTable(*loaded->fs);
+
+        clip.loaded = std::move(loaded);
+    }
+
+    init();
+
+    if(mLibrary)
+        mIdleThread = std::thread(&Session::idleMain, this);
+}
+
+Session::~Session() {
+    if(mIdleThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mIdleMutex);
+            mStopping = true;
+        }
+
+        mIdleCondition.notify_all();
+        mIdleThread.join();
+    }
+
+    if(mSession) {
+        // Unmounting makes the worker threads of the session loop return
+        fuse_session_exit(mSession);
+
+        if(mMounted)
+            fuse_session_unmount(mSession);
+
+        if(mThread && mThread->joinable())
+            mThread->join();
+
+        waitForRequests();
+
+        // Files still open when unmounted hold on to their file systems, which use the
+        // caches and pools of the owner
+        std::lock_guard<std::mutex> lock(mOpenFilesMutex);
+
+        if(!mOpenFiles.empty())
+            spdlog::info("Closing {} files left open in {}", mOpenFiles.size(), mDstPath);
+
+        for(auto* openFile : mOpenFiles)
+            delete openFile;
+
+        mOpenFiles.clear();
+
+        fuse_session_destroy(mSession);
+    }
+
+    boost::system::error_code ec;
+
+    if(!fs::remove(mDstPath, ec) || ec)
+        spdlog::warn("Failed to remove {}", mDstPath);
+
+    SPDLOG_DEBUG("Exiting session for {}", mDstPath);
+}
+
+void Session::init() {
+    // FUSE operations structure
+    struct fuse_lowlevel_ops ops = {};
+
+    ops.init = fuseInit;
+    ops.lookup = fuseLookup;
+    ops.getattr = fuseGetattr;
+    ops.readdir = fuseReaddir;
+    ops.readdirplus = fuseReaddirPlus;
+    ops.open = fuseOpen;
+    ops.read = fuseRead;
+    ops.release = fuseRelease;
+
+    struct fuse_args args = FUSE_ARGS_INIT(0, nullptr);
+
+    // Program name, followed by read only mount options
+    fuse_opt_add_arg(&args, "motioncam-fs");
+    fuse_opt_add_arg(&args, "-o");
+    fuse_opt_add_arg(&args, "ro");
+    fuse_opt_add_arg(&args, "-o");
+    fuse_opt_add_arg(&args, "fsname=motioncam-fs");
+    fuse_opt_add_arg(&args, "-o");
+    fuse_opt_add_arg(&args, ("max_read=" + std::to_string(MAX_READ)).c_str());
+
+    struct fuse_session* session = fuse_session_new(&args, &ops, sizeof(ops), this);
+
+    // Clean up
+    fuse_opt_free_args(&args);
+
+    if (session == nullptr)
+        throw std::runtime_error("Failed to create fuse session (path: " + mDstPath + ")");
+
+    if (fuse_session_mount(session, mDstPath.c_str()) != 0) {
+        fuse_session_destroy(session);
+
+        throw std::runtime_error("Failed to create mount point (path: " + mDstPath + ")");
+    }
+
+    mSession = session;
+    mMounted = true;
+
+    // Start fuse thread
+    mThread = std::make_unique<std::thread>(&Session::fuseMain, this);
+}
+
+bool Session::isLibraryRoot(fuse_ino_t ino) const {
+    return mLibrary && ino == FUSE_ROOT_ID;
+}
+
+fuse_ino_t Session::clipRoot(const Clip& clip) const {
+    return clip.base + FUSE_ROOT_ID;
+}
+
+Clip* Session::getClip(fuse_ino_t ino, fuse_ino_t& localIno) const {
+    if(!mLibrary) {
+        localIno = ino;
+        return mClips.front().get();
+    }
+
+    const auto index = static_cast<size_t>(ino >> CLIP_INODE_SHIFT);
+
+    if(index == 0 || index > mClips.size())
+        return nullptr;
+
+    localIno = ino & CLIP_INODE_MASK;
+
+    return mClips[index - 1].get();
+}
+
+std::shared_ptr<const LoadedClip> Session::loadClip(Clip& clip) {
+    clip.lastAccess = steadyNow();
+
+    std::lock_guard<std::mutex> lock(clip.mutex);
+
+    if(clip.loaded)
+        return clip.loaded;
+
+    FileRenderOptions options;
+    int draftScale;
+
+    {
+        std::lock_guard<std::mutex> optionsLock(mOptionsMutex);
+
+        options = mOptions;
+        draftScale = mDraftScale;
+    }
+
+    try {
+        auto loaded = std::make_shared<LoadedClip>();
+
+        loaded->fs = mLoader(clip.srcFile, options, draftScale, mMetrics);
+        loaded->inodes = buildInodeTable(*loaded->fs);
+
+        clip.loaded = std::move(loaded);
+    }
+    catch(std::exception& e) {
+        spdlog::error("Failed to open {} (error: {})", clip.srcFile, e.what());
+        return nullptr;
+    }
+
+    spdlog::info("Opened clip {}", clip.srcFile);
+
+    return clip.loaded;
+}
+
+void Session::unloadIdleClips() {
+    const auto idleSince = steadyNow() - std::chrono::duration_cast<std::chrono::milliseconds>(CLIP_IDLE_TIMEOUT).count();
+
+    for(auto& clip : mClips) {
+        if(clip->openFiles > 0 || clip->lastAccess > idleSince)
+            continue;
+
+        std::shared_ptr<const LoadedClip> unloaded;
+
+        {
+            std::lock_guard<std::mutex> lock(clip->mutex);
+
+            if(!clip->loaded || clip->openFiles > 0)
+                continue;
+
+            unloaded = std::move(clip->loaded);
+        }
+
+        spdlog::info("Closing idle clip {}", clip->srcFile);
+
+        // Drop what the kernel knows about the files of the clip, they are looked up again
+        // once the clip is reopened and it may be with different options by then
+        fuse_lowlevel_notify_inval_entry(mSession, FUSE_ROOT_ID, clip->name.c_str(), clip->name.size());
+    }
+}
+
+void Session::idleMain() {
+    std::unique_lock<std::mutex> lock(mIdleMutex);
+
+    while(!mIdleCondition.wait_for(lock, CLIP_IDLE_CHECK_INTERVAL, [this] { return mStopping; })) {
+        lock.unlock();
+        unloadIdleClips();
+        lock.lock();
+    }
+}
+
+void Session::updateOptions(FileRenderOptions options, int draftScale) {
+    {
+        std::lock_guard<std::mutex> lock(mOptionsMutex);
+
+        mOptions = options;
+        mDraftScale = draftScale;
+    }
+
+    std::vector<fuse_ino_t> inodes;
+    std::vector<std::pair<fuse_ino_t, std::string>> removedNames;
+
+    for(auto& clip : mClips) {
+        std::lock_guard<std::mutex> lock(clip->mutex);
+
+        // Clips that are not open pick up the options when they are opened
+        if(!clip->loaded)
+            continue;
+
+        auto loaded = std::make_shared<LoadedClip>();
+
+        loaded->fs = clip->loaded->fs;
+        loaded->fs->updateOptions(options, draftScale);
+        loaded->inodes = buildInodeTable(*loaded->fs);
+
+        // Only frames depend on the render options
+        for(auto ino : loaded->inodes.directory) {
+            if(std::holds_alternative<FrameInfo>(loaded->inodes.entries.at(ino).userData))
+                inodes.push_back(clip->base + ino);
+        }
+
+        for(auto& it : clip->loaded->inodes.inodesByName) {
+            if(loaded->inodes.inodesByName.find(it.first) == loaded->inodes.inodesByName.end())
+                removedNames.emplace_back(clipRoot(*clip), it.first);
+        }
+
+        clip->loaded = std::move(loaded);
+    }
+
+    ++mOptionsGeneration;
+
+    // Sizes and contents have changed, drop the attributes and pages the kernel holds.
+    // Inodes the kernel has not seen return an error which can be ignored.
+    for(auto ino : inodes)
+        fuse_lowlevel_notify_inval_inode(mSession, ino, 0, 0);
+
+    for(auto& it : removedNames)
+        fuse_lowlevel_notify_inval_entry(mSession, it.first, it.second.c_str(), it.second.size());
+}
+
+void Session::warmUp(int64_t startFrame, int numFrames) {
+    // Clips of a library are only opened when used
+    if(mLibrary)
+        return;
+
+    if(auto loaded = loadClip(*mClips.front()))
+        loaded->fs->warmUp(startFrame, numFrames);
+}
+
+int64_t Session::lastAccessedFrame() const {
+    if(mLibrary)
+        return -1;
+
+    std::lock_guard<std::mutex> lock(mClips.front()->mutex);
+
+    return mClips.front()->loaded->fs->lastAccessedFrame();
+}
+
+std::shared_ptr<VirtualFileSystemImpl_MCRAW> Session::getFileSystem() {
+    if(mLibrary)
+        return nullptr;
+
+    auto loaded = loadClip(*mClips.front());
+
+    return loaded ? loaded->fs : nullptr;
+}
+
+std::shared_ptr<Metrics> Session::getMetrics() const {
+    return mMetrics;
+}
+
+void Session::fuseMain() {
+    int res = fuse_session_loop_mt(mSession, 0);
+
+    spdlog::info("Fuse has exited with code {}", res);
+}
+
+void Session::beginRequest() {
+    std::lock_guard<std::mutex> lock(mRequestMutex);
+
+    ++mPendingRequests;
+}
+
+void Session::endRequest() {
+    std::lock_guard<std::mutex> lock(mRequestMutex);
+
+    if(--mPendingRequests == 0)
+        mRequestCondition.notify_all();
+}
+
+void Session::waitForRequests() {
+    std::unique_lock<std::mutex> lock(mRequestMutex);
+
+    mRequestCondition.wait(lock, [this] { return mPendingRequests == 0; });
+}
+
+void Session::fillAttr(fuse_ino_t ino, const Entry& entry, struct stat* stbuf) const {
+    memset(stbuf, 0, sizeof(struct stat));
+
+    stbuf->st_ino = ino;
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+
+    // Keep the times fixed, a changing mtime makes the kernel drop cached pages
+    stbuf->st_mtime = stbuf->st_ctime = mMountTime;
+
+    if(entry.type == EntryType::DIRECTORY_ENTRY) {
+        stbuf->st_mode = S_IFDIR | 0755;
+        stbuf->st_nlink = 2;
+        stbuf->st_size = 4096;
+    }
+    else {
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = entry.size;
+    }
+}
+
+void Session::fillDirAttr(fuse_ino_t ino, struct stat* stbuf) const {
+    Entry dirEntry;
+    dirEntry.type = EntryType::DIRECTORY_ENTRY;
+
+    fillAttr(ino, dirEntry, stbuf);
+}
+
+void Session::readDirectory(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, bool plus) {
+    Clip* clip = nullptr;
+    std::shared_ptr<const LoadedClip> loaded;
+    size_t numFiles;
+
+    // The library root lists the clips without opening them, a clip is opened when its own
+    // directory is listed
+    if(isLibraryRoot(ino)) {
+        numFiles = mClips.size();
+    }
+    else {
+        fuse_ino_t localIno;
+        clip = getClip(ino, localIno);
+
+        if(!clip || localIno != FUSE_ROOT_ID) {
+            fuse_reply_err(req, ENOTDIR);
+            return;
+        }
+
+        loaded = loadClip(*clip);
+
+        if(!loaded) {
+            fuse_reply_err(req, EIO);
+            return;
+        }
+
+        numFiles = loaded->inodes.directory.size();
+    }
+
+    std::vector<char> buf(size);
+    size_t used = 0;
+
+    // Offsets 0 and 1 are "." and "..", the files follow
+    for(size_t i = static_cast<size_t>(offset); i < numFiles + 2; ++i) {
+        struct fuse_entry_param e = {};
+        const char* name;
+
+        if(i < 2) {
+            name = i == 0 ? "." : "..";
+            fillDirAttr(ino, &e.attr);
+        }
+        else {
+            e.attr_timeout = ATTR_TIMEOUT;
+            e.entry_timeout = ENTRY_TIMEOUT;
+
+            if(loaded) {
+                const auto localIno = loaded->inodes.directory[i - 2];
+                const auto& entry = loaded->inodes.entries.at(localIno);
+
+                name = entry.name.c_str();
+                e.ino = clip->base + localIno;
+
+                fillAttr(e.ino, entry, &e.attr);
+            }
+            else {
+                const auto& libraryClip = *mClips[i - 2];
+
+                name = libraryClip.name.c_str();
+                e.ino = clipRoot(libraryClip);
+
+                fillDirAttr(e.ino, &e.attr);
+            }
+        }
+
+        const size_t entrySize = plus ?
+            fuse_add_direntry_plus(req, buf.data() + used, size - used, name, &e, i + 1) :
+            fuse_add_direntry(req, buf.data() + used, size - used, name, &e.attr, i + 1);
+
+        if(entrySize > size - used)
+            break;
+
+        used += entrySize;
+    }
+
+    fuse_reply_buf(req, buf.data(), used);
+}
+
+Session* Session::getSession(fuse_req_t req) {
+    return reinterpret_cast<Session*>(fuse_req_userdata(req));
+}
+
+void Session::fuseInit(void* userdata, struct fuse_conn_info* conn) {
+    // Always list directories with attributes so the kernel doesn't look up every file
+    if(conn->capable & FUSE_CAP_READDIRPLUS) {
+        conn->want |= FUSE_CAP_READDIRPLUS;
+        conn->want &= ~FUSE_CAP_READDIRPLUS_AUTO;
+    }
+
+    // Fewer, larger requests per frame. max_read must match the mount option, the kernel's
+    // readahead is an upper bound that can only be lowered here.
+    conn->max_read = MAX_READ;
+    conn->max_readahead = (std::min)(conn->max_readahead, MAX_READAHEAD);
+}
+
+void Session::fuseLookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    LOG_SAMPLED_DEBUG("fuse_lookup(parent: {}, name: {})", parent, name);
+
+    auto* session = getSession(req);
+    struct fuse_entry_param e = {};
+
+    // Negative entries are cached as well, files are only added or removed when the options change
+    e.attr_timeout = ATTR_TIMEOUT;
+    e.entry_timeout = ENTRY_TIMEOUT;
+
+    if(session->isLibraryRoot(parent)) {
+        auto it = session->mClipsByName.find(name);
+
+        if(it != session->mClipsByName.end()) {
+            e.ino = session->clipRoot(*it->second);
+            session->fillDirAttr(e.ino, &e.attr);
+        }
+    }
+    else {
+        fuse_ino_t localIno;
+        auto* clip = session->getClip(parent, localIno);
+
+        if(clip && localIno == FUSE_ROOT_ID) {
+            auto loaded = session->loadClip(*clip);
+
+            if(!loaded) {
+                fuse_reply_err(req, EIO);
+                return;
+            }
+
+            auto it = loaded->inodes.inodesByName.find(name);
+
+            if(it != loaded->inodes.inodesByName.end()) {
+                e.ino = clip->base + it->second;
+                session->fillAttr(e.ino, loaded->inodes.entries.at(it->second), &e.attr);
+            }
+        }
+    }
+
+    fuse_reply_entry(req, &e);
+}
+
+void Session::fuseGetattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    LOG_SAMPLED_DEBUG("fuse_get_attr(ino: {})", ino);
+
+    auto* session = getSession(req);
+    struct stat stbuf;
+
+    fuse_ino_t localIno;
+    auto* clip = session->getClip(ino, localIno);
+
+    // Root directory, or the directory of a clip
+    if(session->isLibraryRoot(ino) || (clip && localIno == FUSE_ROOT_ID)) {
+        session->fillDirAttr(ino, &stbuf);
+        fuse_reply_attr(req, &stbuf, ATTR_TIMEOUT);
+
+        return;
+    }
+
+    auto loaded = clip ? session->loadClip(*clip) : nullptr;
+    auto* entry = findEntry(loaded, localIno);
+
+    if(!entry) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    session->fillAttr(ino, *entry, &stbuf);
+    fuse_reply_attr(req, &stbuf, ATTR_TIMEOUT);
+}
+
+void Session::fuseReaddir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi) {
+    LOG_SAMPLED_DEBUG("fuse_read_dir(ino: {}, offset: {})", ino, offset);
+
+    getSession(req)->readDirectory(req, ino, size, offset, false);
+}
+
+void Session::fuseReaddirPlus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi) {
+    LOG_SAMPLED_DEBUG("fuse_read_dir_plus(ino: {}, offset: {})", ino, offset);
+
+    getSession(req)->readDirectory(req, ino, size, offset, true);
+}
+
+void Session::fuseOpen(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    LOG_SAMPLED_DEBUG("fuse_open(ino: {})", ino);
+
+    auto* session = getSession(req);
+
+    fuse_ino_t localIno;
+    auto* clip = session->getClip(ino, localIno);
+    auto loaded = clip ? session->loadClip(*clip) : nullptr;
+    auto* entry = findEntry(loaded, localIno);
+
+    if(!entry) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    // Only allow read access
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        fuse_reply_err(req, EACCES);
+        return;
+    }
+
+    const uint64_t generation = session->mOptionsGeneration;
+
+    // Freed in fuseRelease()
+    auto openFile = std::make_unique<OpenFile>();
+
+    openFile->clip = clip;
+    openFile->fs = loaded->fs;
+    openFile->handle = loaded->fs->openFile(*entry);
+
+    fi->fh = reinterpret_cast<uint64_t>(openFile.get());
+
+    // Pages the kernel holds for a frame are still valid if the options haven't changed
+    // since it was last opened, other files never change
+    if(!std::holds_alternative<FrameInfo>(entry->userData)) {
+        fi->keep_cache = 1;
+    }
+    else {
+        std::lock_guard<std::mutex> lock(session->mPageCacheMutex);
+
+        auto generationIt = session->mPageCacheGeneration.find(ino);
+
+        fi->keep_cache = generationIt != session->mPageCacheGeneration.end() && generationIt->second == generation;
+
+        session->mPageCacheGeneration[ino] = generation;
+    }
+
+    ++clip->openFiles;
+
+    {
+        std::lock_guard<std::mutex> lock(session->mOpenFilesMutex);
+        session->mOpenFiles.insert(openFile.get());
+    }
+
+    if(fuse_reply_open(req, fi) == 0) {
+        openFile.release();
+        return;
+    }
+
+    --clip->openFiles;
+
+    std::lock_guard<std::mutex> lock(session->mOpenFilesMutex);
+    session->mOpenFiles.erase(openFile.get());
+}
+
+void Session::fuseRead(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi) {
+    LOG_SAMPLED_DEBUG("fuse_read(ino: {}, size: {}, offset: {})", ino, size, offset);
+
+    TraceSpan span("fuse.read");
+
+    auto* session = getSession(req);
+    auto* openFile = reinterpret_cast<OpenFile*>(fi->fh);
+    auto& handle = *openFile->handle;
+
+    openFile->clip->lastAccess = steadyNow();
+
+    // Rendered frames are sent straight from the cache
+    FrameSlice slice;
+
+    if(openFile->fs->sliceFile(handle, offset, size, slice)) {
+        Measure m(session->mMetrics.get(), Stage::REPLY);
+
+        replySlice(req, slice);
+        return;
+    }
+
+    // The request is answered once the frame has been rendered, leaving this thread free to
+    // take the next request
+    auto buffer = std::make_shared<std::vector<char>>(size);
+
+    session->beginRequest();
+
+    openFile->fs->readFileAsync(
+        handle,
+        offset,
+        size,
+        buffer->data(),
+        [session, req, buffer](size_t readBytes, int errorCode) {
+            if(errorCode != 0)
+                fuse_reply_err(req, EIO);
+            else
+                fuse_reply_buf(req, buffer->data(), readBytes);
+
+            session->endRequest();
+        });
+}
+
+void Session::replySlice(fuse_req_t req, const FrameSlice& slice) {
+    if(slice.numSegments == 0) {
+        fuse_reply_buf(req, nullptr, 0);
+        return;
+    }
+
+    // fuse_bufvec ends in a single fuse_buf, the extra buffers must directly follow it, so it is
+    // built in raw storage large enough for all of them
+    constexpr size_t MAX_SEGMENTS = std::tuple_size<decltype(slice.segments)>::value;
+
+    alignas(struct fuse_bufvec) char storage[sizeof(struct fuse_bufvec) + (MAX_SEGMENTS - 1) * sizeof(struct fuse_buf)];
+
+    auto* vec = new (storage) fuse_bufvec{};
+    auto* bufs = reinterpret_cast<struct fuse_buf*>(storage + offsetof(struct fuse_bufvec, buf));
+
+    vec->count = slice.numSegments;
+
+    for(int i = 0; i < slice.numSegments; ++i) {
+        auto* buf = new (bufs + i) fuse_buf{};
+
+        buf->mem = const_cast<char*>(slice.segments[i].data);
+        buf->size = slice.segments[i].size;
+        buf->fd = -1;
+    }
+
+    fuse_reply_data(req, vec, static_cast<fuse_buf_copy_flags>(0));
+}
+
+void Session::fuseRelease(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    auto* session = getSession(req);
+    auto* openFile = reinterpret_cast<OpenFile*>(fi->fh);
+
+    openFile->clip->lastAccess = steadyNow();
+    --openFile->clip->openFiles;
+
+    {
+        std::lock_guard<std::mutex> lock(session->mOpenFilesMutex);
+        session->mOpenFiles.erase(openFile);
+    }
+
+    delete openFile;
+
+    fuse_reply_err(req, 0);
+}
+
+//
+
+FuseFileSystemImpl_Linux::FuseFileSystemImpl_Linux(unsigned int ioThreads, unsigned int processingThreads) :
+    mNextMountId(0),
+    mIoThreadPool(std::make_unique<BS::thread_pool>(ioThreads > 0 ? ioThreads : IO_THREADS)),
+    mProcessingThreadPool(std::make_unique<BS::thread_pool>(processingThreads)),
+    mCache(std::make_unique<LRUCache>(DEFAULT_CACHE_SIZE)),
+    mCacheBudget(std::make_unique<CacheBudget>(*mCache, DEFAULT_CACHE_SIZE, false)),
+    mDecodedFrameCache(std::make_unique<DecodedFrameCache>(DECODED_FRAME_CACHE_SIZE)),
+    mRenderMemoryLimit(std::make_unique<RenderMemoryLimit>(DEFAULT_RENDER_MEMORY_LIMIT))
+{
+}
+
+FuseFileSystemImpl_Linux::~FuseFileSystemImpl_Linux() {
+    mMountedFiles.clear();
+
+    // Wait for tasks to complete before we destroy ourselves
+    mIoThreadPool->wait();
+
+    mProcessingThreadPool->wait();
+
+    spdlog::info("Destroying FuseFileSystemImpl_Linux()");
+}
+
+MountId FuseFileSystemImpl_Linux::mount(
+    FileRenderOptions options, int draftScale, const std::string& srcFile, const std::string& dstPath)
+{
+    fs::path srcPath(srcFile);
+    std::string extension = srcPath.extension().string();
+
+    SPDLOG_DEBUG("Mounting file {} to {}", srcFile, dstPath);
+
+    if(!boost::iequals(extension, ".mcraw")) {
+        spdlog::error("Failed to mount {} to {}, invalid file format", srcFile, dstPath);
+
+        throw std::runtime_error("Invalid format");
+    }
+
+    createMountPoint(dstPath);
+
+    auto mountId = mNextMountId++;
+
+    try {
+        mMountedFiles[mountId] = std::make_unique<Session>(
+            std::vector<std::string>{ srcFile }, dstPath, false, options, draftScale, getClipLoader());
+    }
+    catch(std::runtime_error& e) {
+        spdlog::error("Failed to mount {} to {} (error: {})", srcFile, dstPath, e.what());
+
+        throw std::runtime_error(e.what());
+    }
+
+    return mountId;
+}
+
+MountId FuseFileSystemImpl_Linux::mountLibrary(
+    FileRenderOptions options, int draftScale, const std::string& srcFolder, const std::string& dstPath)
+{
+    SPDLOG_DEBUG("Mounting library {} to {}", srcFolder, dstPath);
+
+    boost::system::error_code ec;
+
+    if(!fs::is_directory(srcFolder, ec))
+        throw std::runtime_error("Not a folder: " + srcFolder);
+
+    if(fs::equivalent(srcFolder, dstPath, ec))
+        throw std::runtime_error("A library can't be mounted over its own folder");
+
+    // Sorted so that clips keep their inode numbers from one mount to the next
+    std::vector<std::string> srcFiles;
+
+    for(auto& it : fs::directory_iterator(srcFolder, ec)) {
+        if(fs::is_regular_file(it.path(), ec) && boost::iequals(it.path().extension().string(), ".mcraw"))
+            srcFiles.push_back(it.path().string());
+    }
+
+    if(ec)
+        throw std::runtime_error("Failed to list " + srcFolder + " (error: " + ec.message() + ")");
+
+    if(srcFiles.empty())
+        throw std::runtime_error("No MCRAW files in " + srcFolder);
+
+    std::sort(srcFiles.begin(), srcFiles.end());
+
+    createMountPoint(dstPath);
+
+    auto mountId = mNextMountId++;
+
+    try {
+        mMountedFiles[mountId] = std::make_unique<Session>(
+            srcFiles, dstPath, true, options, draftScale, getClipLoader());
+    }
+    catch(std::runtime_error& e) {
+        spdlog::error("Failed to mount {} to {} (error: {})", srcFolder, dstPath, e.what());
+
+        throw std::runtime_error(e.what());
+    }
+
+    spdlog::info("Mounted library of {} clips at {}", srcFiles.size(), dstPath);
+
+    return mountId;
+}
+
+void FuseFileSystemImpl_Linux::createMountPoint(const std::string& dstPath) {
+    boost::system::error_code ec;
+
+    if(!fs::exists(dstPath, ec)) {
+        spdlog::info("Creating path {}", dstPath);
+
+        if(!fs::create_directories(dstPath, ec) || ec) {
+            spdlog::error("Could not create path {}", dstPath);
+
+            throw std::runtime_error("Failed to create " + dstPath);
+        }
+    }
+}
+
+ClipLoader FuseFileSystemImpl_Linux::getClipLoader() {
+    return [this](const std::string& srcFile, FileRenderOptions options, int draftScale, std::shared_ptr<Metrics> metrics) {
+        return std::make_unique<VirtualFileSystemImpl_MCRAW>(
+            *mIoThreadPool,
+            *mProcessingThreadPool,
+            *mCache,
+            *mDecodedFrameCache,
+            options,
+            draftScale,
+            srcFile,
+            std::move(metrics),
+            mRenderMemoryLimit.get());
+    };
+}
+
+void FuseFileSystemImpl_Linux::unmount(MountId mountId) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        mMountedFiles.erase(it);
+    }
+}
+
+void FuseFileSystemImpl_Linux::updateOptions(MountId mountId, FileRenderOptions options, int draftScale) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        it->second->updateOptions(options, draftScale);
+    }
+}
+
+void FuseFileSystemImpl_Linux::warmCache(MountId mountId, int64_t startFrame, int numFrames) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        it->second->warmUp(startFrame, numFrames);
+    }
+}
+
+int64_t FuseFileSystemImpl_Linux::lastAccessedFrame(MountId mountId) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        return it->second->lastAccessedFrame();
+    }
+
+    return -1;
+}
+
+std::shared_ptr<IVirtualFileSystem> FuseFileSystemImpl_Linux::getFileSystem(MountId mountId) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        return it->second->getFileSystem();
+    }
+
+    return nullptr;
+}
+
+std::shared_ptr<Metrics> FuseFileSystemImpl_Linux::getMetrics(MountId mountId) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        return it->second->getMetrics();
+    }
+
+    return nullptr;
+}
+
+void FuseFileSystemImpl_Linux::setCacheSize(size_t sizeBytes, bool adaptive) {
+    mCacheBudget->configure(sizeBytes, adaptive);
+}
+
+void FuseFileSystemImpl_Linux::setCacheCompression(bool enabled) {
+    spdlog::info("Cache compression {}", enabled ? "enabled" : "disabled");
+
+    mCache->setCompressionEnabled(enabled);
+}
+
+void FuseFileSystemImpl_Linux::setRenderMemoryLimit(size_t limitBytes) {
+    spdlog::info("Render memory limit {} MB", limitBytes / (1024 * 1024));
+
+    mRenderMemoryLimit->setLimit(limitBytes);
+}
+
+} // namespace motioncam
@@ -1,6 +1,11 @@
 #include "macos/FuseFileSystemImpl_MacOS.h"
 #include "VirtualFileSystemImpl_MCRAW.h"
 #include "LRUCache.h"
+#include "CacheBudget.h"
+#include "DecodedFrameCache.h"
+#include "RenderMemoryLimit.h"
+#include "Tracing.h"
+#include "Logging.h"
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem.hpp>
@@ -10,73 +15,36 @@
 
 #include <fuse_t/fuse_t.h>
 
-#include <QDir>
-
 // Logging
 #include <spdlog/spdlog.h>
-#include <spdlog/sinks/basic_file_sink.h>
-#include <spdlog/sinks/stdout_color_sinks.h>
 
 namespace fs = boost::filesystem;
 
 namespace motioncam {
 
-constexpr auto CACHE_SIZE = 1024 * 1024 * 1024; // 1 GB cache size
+constexpr auto DEFAULT_CACHE_SIZE = 1024 * 1024 * 1024; // 1 GB cache size until configured
+constexpr auto DECODED_FRAME_CACHE_SIZE = 512 * 1024 * 1024; // Raw frames kept for re-rendering and decoding ahead
+constexpr size_t DEFAULT_RENDER_MEMORY_LIMIT = size_t(2048) * 1024 * 1024; // Frames being rendered at once, reads wait beyond this
 constexpr auto IO_THREADS = 4;
 
-namespace {
-
-void setupLogging() {
-    try {
-        // Create a vector of sinks
-        std::vector<spdlog::sink_ptr> sinks;
-
-        // Regular console output
-        sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
-
-        // File sink
-        sinks.push_back(std::make_shared<spdlog::sinks::basic_file_sink_mt>("logs/logfile.txt", true));
-
-        // Create a logger with all sinks
-        auto logger = std::make_shared<spdlog::logger>("multi_sink", sinks.begin(), sinks.end());
-
-        // Set as default logger
-        spdlog::set_default_logger(logger);
-
-        // Set log level
-#ifdef NDEBUG
-        spdlog::set_level(spdlog::level::info);
-#else
-        spdlog::set_level(spdlog::level::debug);
-#endif
-
-        // Flush on info level messages
-        spdlog::flush_on(spdlog::level::info);
-
-    }
-    catch (const spdlog::spdlog_ex& ex) {
-        std::cerr << "Log initialization failed: " << ex.what() << std::endl;
-    }
-}
-
-} // namespace
-
 //
 
 struct FuseContext {
-    VirtualFileSystemImpl_MCRAW* fs;
-    std::atomic_int nextFileHandle;
+    std::shared_ptr<VirtualFileSystemImpl_MCRAW> fs;
 };
 
 class Session {
 public:
-    Session(const std::string& srcFile, const std::string& dstPath, VirtualFileSystemImpl_MCRAW* fs);
+    Session(const std::string& srcFile, const std::string& dstPath, std::shared_ptr<VirtualFileSystemImpl_MCRAW> fs);
     ~Session();
 
     void updateOptions(FileRenderOptions options, int draftScale);
+    void warmUp(int64_t startFrame, int numFrames);
+    int64_t lastAccessedFrame() const;
+    std::shared_ptr<VirtualFileSystemImpl_MCRAW> getFileSystem() const;
 
 private:
-    void init(VirtualFileSystemImpl_MCRAW* fs);
+    void init(std::shared_ptr<VirtualFileSystemImpl_MCRAW> fs);
 
     void fuseMain(struct fuse_chan* ch, struct fuse* fuse);
 
@@ -92,13 +60,13 @@ private:
     std::string mSrcFile;
     std::string mDstPath;
     std::unique_ptr<std::thread> mThread;
-    VirtualFileSystemImpl_MCRAW* mFs;
+    std::shared_ptr<VirtualFileSystemImpl_MCRAW> mFs;
     struct fuse_chan* mFuseCh;
     struct fuse* mFuse;
 };
 
 
-Session::Session(const std::string& srcFile, const std::string& dstPath, VirtualFileSystemImpl_MCRAW* fs) :
+Session::Session(const std::string& srcFile, const std::string& dstPath, std::shared_ptr<VirtualFileSystemImpl_MCRAW> fs) :
     mSrcFile(srcFile),
     mDstPath(dstPath),
     mFs(fs),
@@ -115,15 +83,15 @@ Session::~Session() {
     if(mThread && mThread->joinable())
         mThread->join();
 
-    QDir dst;
+    boost::system::error_code ec;
 
-    if(!dst.rmdir(mDstPath.c_str()))
+    if(!fs::remove(mDstPath, ec) || ec)
         spdlog::warn("Failed to remove {}", mDstPath);
 
-    spdlog::debug("Exiting session for {}", mSrcFile);
+    SPDLOG_DEBUG("Exiting session for {}", mSrcFile);
 }
 
-void Session::init(VirtualFileSystemImpl_MCRAW* fs) {
+void Session::init(std::shared_ptr<VirtualFileSystemImpl_MCRAW> fs) {
     // FUSE operations structure
     struct fuse_operations ops = {};
 
@@ -155,7 +123,6 @@ void Session::init(VirtualFileSystemImpl_MCRAW* fs) {
     auto* context = new FuseContext();
 
     context->fs = fs;
-    context->nextFileHandle = 0;
 
     struct fuse_chan* ch = fuse_mount(mDstPath.c_str(), &args);
     struct fuse* fuse = fuse_new(ch, &args, &ops, sizeof(ops), context);
@@ -179,8 +146,21 @@ void Session::init(VirtualFileSystemImpl_MCRAW* fs) {
 void Session::updateOptions(FileRenderOptions options, int draftScale) {
     mFs->updateOptions(options, draftScale);
 
-    fuse_invalidate_path(mFuse, mDstPath.c_str());
+    // Only the files change, drop what is cached for each of them
+    for(auto& entry : mFs->listFiles("/"))
+        fuse_invalidate_path(mFuse, ("/" + entry.getFullPath().string()).c_str());
+}
+
+void Session::warmUp(int64_t startFrame, int numFrames) {
+    mFs->warmUp(startFrame, numFrames);
+}
 
+int64_t Session::lastAccessedFrame() const {
+    return mFs->lastAccessedFrame();
+}
+
+std::shared_ptr<VirtualFileSystemImpl_MCRAW> Session::getFileSystem() const {
+    return mFs;
 }
 
 void Session::fuseMain(struct fuse_chan* ch, struct fuse* fuse) {
@@ -204,19 +184,11 @@ void* Session::fuseInit(struct fuse_conn_info* conn) {
 }
 
 void Session::fuseDestroy(void* privateData) {
-    auto* context = reinterpret_cast<FuseContext*>(privateData);
-
-    if(context->fs)
-        delete context->fs;
-
-    context->fs = nullptr;
-    context->nextFileHandle = INT_MIN;
-
-    delete context;
+    delete reinterpret_cast<FuseContext*>(privateData);
 }
 
 int Session::fuseGetattr(const char* path, struct stat* stbuf) {
-    spdlog::debug("fuse_get_attr(path: {})", path);
+    LOG_SAMPLED_DEBUG("fuse_get_attr(path: {})", path);
 
     memset(stbuf, 0, sizeof(struct stat));
 
@@ -259,7 +231,7 @@ int Session::fuseGetattr(const char* path, struct stat* stbuf) {
 }
 
 int Session::fuseReaddir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info* fi) {
-    spdlog::debug("fuse_read_dir(path: {})", path);
+    LOG_SAMPLED_DEBUG("fuse_read_dir(path: {})", path);
 
     auto* context = fuseGetContext();
     std::string pathStr(path);
@@ -280,7 +252,7 @@ int Session::fuseReaddir(const char* path, void* buf, fuse_fill_dir_t filler, of
 }
 
 int Session::fuseOpen(const char* path, struct fuse_file_info* fi) {
-    spdlog::debug("fuse_open(path: {})", path);
+    LOG_SAMPLED_DEBUG("fuse_open(path: {})", path);
 
     auto* context = fuseGetContext();
     std::string pathStr(path);
@@ -295,46 +267,45 @@ int Session::fuseOpen(const char* path, struct fuse_file_info* fi) {
         return -EACCES;
 
 
-    // Set file handle
-    fi->fh = ++context->nextFileHandle;
+    // Handle is freed in fuseRelease()
+    fi->fh = reinterpret_cast<uint64_t>(context->fs->openFile(entry.value()).release());
 
     return 0;
 }
 
 int Session::fuseRead(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
-    spdlog::debug("fuse_read(path: {}, size: {}, offset: {})", path, size, offset);
+    LOG_SAMPLED_DEBUG("fuse_read(path: {}, size: {}, offset: {})", path, size, offset);
 
-    auto* context = fuseGetContext();
-    std::string pathStr(path);
+    TraceSpan span("fuse.read");
 
-    auto entry = context->fs->findEntry(pathStr);
+    auto* context = fuseGetContext();
+    auto* handle = reinterpret_cast<FileHandle*>(fi->fh);
 
-    if(!entry.has_value())
-        return -ENOENT;
+    if(!handle)
+        return -EBADF;
 
-    return context->fs->readFile(
-        entry.value(),
-        offset,
-        size,
-        buf,
-        [](auto a, auto b) {},
-        false
-        );
+    return context->fs->readFile(*handle, offset, size, buf);
 }
 
 int Session::fuseRelease(const char* path, struct fuse_file_info* fi) {
+    delete reinterpret_cast<FileHandle*>(fi->fh);
+
+    fi->fh = 0;
+
     return 0;
 }
 
 //
 
-FuseFileSystemImpl_MacOs::FuseFileSystemImpl_MacOs() :
+FuseFileSystemImpl_MacOs::FuseFileSystemImpl_MacOs(unsigned int ioThreads, unsigned int processingThreads) :
     mNextMountId(0),
-    mIoThreadPool(std::make_unique<BS::thread_pool>(IO_THREADS)),
-    mProcessingThreadPool(std::make_unique<BS::thread_pool>()),
-    mCache(std::make_unique<LRUCache>(CACHE_SIZE))
+    mIoThreadPool(std::make_unique<BS::thread_pool>(ioThreads > 0 ? ioThreads : IO_THREADS)),
+    mProcessingThreadPool(std::make_unique<BS::thread_pool>(processingThreads)),
+    mCache(std::make_unique<LRUCache>(DEFAULT_CACHE_SIZE)),
+    mCacheBudget(std::make_unique<CacheBudget>(*mCache, DEFAULT_CACHE_SIZE, false)),
+    mDecodedFrameCache(std::make_unique<DecodedFrameCache>(DECODED_FRAME_CACHE_SIZE)),
+    mRenderMemoryLimit(std::make_unique<RenderMemoryLimit>(DEFAULT_RENDER_MEMORY_LIMIT))
 {
-    setupLogging();
 }
 
 FuseFileSystemImpl_MacOs::~FuseFileSystemImpl_MacOs() {
@@ -354,14 +325,14 @@ MountId FuseFileSystemImpl_MacOs::mount(
     fs::path srcPath(srcFile);
     std::string extension = srcPath.extension().string();
 
-    spdlog::debug("Mounting file {} to {}", srcFile, dstPath);
+    SPDLOG_DEBUG("Mounting file {} to {}", srcFile, dstPath);
 
-    QDir dst(dstPath.c_str());
+    boost::system::error_code ec;
 
-    if(!dst.exists()) {
+    if(!fs::exists(dstPath, ec)) {
         spdlog::info("Creating path {}", dstPath);
 
-        if(!dst.mkpath(dstPath.c_str())) {
+        if(!fs::create_directories(dstPath, ec) || ec) {
             spdlog::error("Could not create path {}", dstPath);
 
             throw std::runtime_error("Failed to create " + dstPath);
@@ -375,14 +346,17 @@ MountId FuseFileSystemImpl_MacOs::mount(
         size_t stack_size = 0;
 
         try {
-            auto* fs =
-                new VirtualFileSystemImpl_MCRAW(
+            auto fs =
+                std::make_shared<VirtualFileSystemImpl_MCRAW>(
                     *mIoThreadPool,
                     *mProcessingThreadPool,
                     *mCache,
+                    *mDecodedFrameCache,
                     options,
                     draftScale,
-                    srcFile);
+                    srcFile,
+                    nullptr,
+                    mRenderMemoryLimit.get());
 
             auto session = std::make_unique<Session>(srcFile, dstPath, fs);
 
@@ -408,6 +382,14 @@ MountId FuseFileSystemImpl_MacOs::mount(
     throw std::runtime_error("Invalid format");
 }
 
+MountId FuseFileSystemImpl_MacOs::mountLibrary(
+    FileRenderOptions options, int draftScale, const std::string& srcFolder, const std::string& dstPath)
+{
+    spdlog::error("Failed to mount {} to {}, library mounts are not supported", srcFolder, dstPath);
+
+    throw std::runtime_error("Library mounts are not supported on this platform, mount the files individually");
+}
+
 void FuseFileSystemImpl_MacOs::unmount(MountId mountId) {
     auto it = mMountedFiles.find(mountId);
     if(it != mMountedFiles.end()) {
@@ -422,4 +404,54 @@ void FuseFileSystemImpl_MacOs::updateOptions(MountId mountId, FileRenderOptions
     }
 }
 
+void FuseFileSystemImpl_MacOs::warmCache(MountId mountId, int64_t startFrame, int numFrames) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        it->second->warmUp(startFrame, numFrames);
+    }
+}
+
+int64_t FuseFileSystemImpl_MacOs::lastAccessedFrame(MountId mountId) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        return it->second->lastAccessedFrame();
+    }
+
+    return -1;
+}
+
+std::shared_ptr<IVirtualFileSystem> FuseFileSystemImpl_MacOs::getFileSystem(MountId mountId) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        return it->second->getFileSystem();
+    }
+
+    return nullptr;
+}
+
+std::shared_ptr<Metrics> FuseFileSystemImpl_MacOs::getMetrics(MountId mountId) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        return it->second->getFileSystem()->getMetrics();
+    }
+
+    return nullptr;
+}
+
+void FuseFileSystemImpl_MacOs::setCacheSize(size_t sizeBytes, bool adaptive) {
+    mCacheBudget->configure(sizeBytes, adaptive);
+}
+
+void FuseFileSystemImpl_MacOs::setCacheCompression(bool enabled) {
+    spdlog::info("Cache compression {}", enabled ? "enabled" : "disabled");
+
+    mCache->setCompressionEnabled(enabled);
+}
+
+void FuseFileSystemImpl_MacOs::setRenderMemoryLimit(size_t limitBytes) {
+    spdlog::info("Render memory limit {} MB", limitBytes / (1024 * 1024));
+
+    mRenderMemoryLimit->setLimit(limitBytes);
+}
+
 } // namespace motioncam
@@ -1,5 +1,6 @@
 #include "mainwindow.h"
 #include "SingleApplication.h"
+#include "Logging.h"
 
 #include <QApplication>
 #include <QCommandLineParser>
@@ -55,6 +56,8 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    motioncam::setupLogging("logs/logfile.txt");
+
     // Create main window
     MainWindow window;
 
@@ -1,5 +1,9 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "Exporter.h"
+#include "AccessLog.h"
+#include "Metrics.h"
+#include "Tracing.h"
 
 #include <QDragEnterEvent>
 #include <QDropEvent>
@@ -9,19 +13,37 @@
 #include <QProcess>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QDir>
 #include <QSettings>
+#include <QProgressDialog>
+#include <QPointer>
 #include <algorithm>
+#include <iterator>
 
 #ifdef _WIN32
 #include "win/FuseFileSystemImpl_Win.h"
 #elif __APPLE__
 #include "macos/FuseFileSystemImpl_MacOS.h"
+#elif __linux__
+#include "linux/FuseFileSystemImpl_Linux.h"
 #endif
 
 namespace {
     constexpr auto PACKAGE_NAME = "com.motioncam";
     constexpr auto APP_NAME = "MotionCam FS";
 
+    // Memory cache sizes in the order they appear in the UI, 0 means adaptive
+    constexpr int CACHE_SIZES_MB[] = { 0, 128, 512, 1024, 2048, 4096, 8192, 16384, 32768 };
+
+    // Frames rendered into the cache after mounting, set "warmUpFrames" to 0 to disable
+    constexpr auto DEFAULT_WARM_UP_FRAMES = 48;
+
+#ifdef _WIN32
+    constexpr auto DEFAULT_CACHE_SIZE_MB = 128;
+#else
+    constexpr auto DEFAULT_CACHE_SIZE_MB = 1024;
+#endif
+
     motioncam::FileRenderOptions getRenderOptions(Ui::MainWindow& ui) {
         motioncam::FileRenderOptions options = motioncam::RENDER_OPT_NONE;
 
@@ -42,6 +64,9 @@ MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
     , mDraftQuality(1)
+    , mCacheSizeMb(DEFAULT_CACHE_SIZE_MB)
+    , mWarmUpFrames(DEFAULT_WARM_UP_FRAMES)
+    , mHttpPort(0)
 {
     ui->setupUi(this);
 
@@ -49,6 +74,8 @@ MainWindow::MainWindow(QWidget *parent)
     mFuseFilesystem = std::make_unique<motioncam::FuseFileSystemImpl_Win>();
 #elif __APPLE__
     mFuseFilesystem = std::make_unique<motioncam::FuseFileSystemImpl_MacOs>();
+#elif __linux__
+    mFuseFilesystem = std::make_unique<motioncam::FuseFileSystemImpl_Linux>();
 #endif
 
     // Enable drag and drop on the scroll area
@@ -62,6 +89,9 @@ MainWindow::MainWindow(QWidget *parent)
     connect(ui->vignetteCorrectionCheckBox, &QCheckBox::checkStateChanged, this, &MainWindow::onRenderSettingsChanged);
     connect(ui->scaleRawCheckBox, &QCheckBox::checkStateChanged, this, &MainWindow::onRenderSettingsChanged);
     connect(ui->draftQuality, &QComboBox::currentIndexChanged, this, &MainWindow::onDraftModeQualityChanged);
+    connect(ui->cacheSize, &QComboBox::currentIndexChanged, this, &MainWindow::onCacheSizeChanged);
+    connect(ui->compressCacheCheckBox, &QCheckBox::checkStateChanged, this, &MainWindow::onCacheCompressionChanged);
+    connect(ui->recordTraceCheckBox, &QCheckBox::checkStateChanged, this, &MainWindow::onRecordTraceChanged);
 
     connect(ui->changeCacheBtn, &QPushButton::clicked, this, &MainWindow::onSetCacheFolder);
 }
@@ -69,6 +99,14 @@ MainWindow::MainWindow(QWidget *parent)
 MainWindow::~MainWindow() {
     saveSettings();
 
+    // Stop a running export, frames already written are kept
+    if(mExportThread.joinable()) {
+        mExporter->cancel();
+        mExportThread.join();
+    }
+
+    motioncam::AccessLog::stop();
+
     delete ui;
 }
 
@@ -80,6 +118,10 @@ void MainWindow::saveSettings() {
     settings.setValue("scaleRaw", ui->scaleRawCheckBox->checkState() == Qt::CheckState::Checked);
     settings.setValue("cachePath", mCacheRootFolder);
     settings.setValue("draftQuality", mDraftQuality);
+    settings.setValue("cacheSizeMb", mCacheSizeMb);
+    settings.setValue("warmUpFrames", mWarmUpFrames);
+    settings.setValue("compressCache", ui->compressCacheCheckBox->checkState() == Qt::CheckState::Checked);
+    settings.setValue("httpPort", mHttpPort);
 
     // Save mounted files
     settings.beginWriteArray("mountedFiles");
@@ -87,6 +129,13 @@ void MainWindow::saveSettings() {
     for (auto i = 0; i < mMountedFiles.size(); ++i) {
         settings.setArrayIndex(i);
         settings.setValue("srcFile", mMountedFiles[i].srcFile);
+
+        // Remember where playback was so the cache can be warmed up there next time
+        auto lastFrame = mFuseFilesystem->lastAccessedFrame(mMountedFiles[i].mountId);
+        if(lastFrame < 0)
+            lastFrame = mResumeFrames.value(mMountedFiles[i].mountId, -1);
+
+        settings.setValue("lastFrame", static_cast<qint64>(lastFrame));
     }
 
     settings.endArray();
@@ -114,14 +163,63 @@ void MainWindow::restoreSettings() {
     else if(mDraftQuality == 8)
         ui->draftQuality->setCurrentIndex(2);
 
+    mCacheSizeMb = settings.value("cacheSizeMb", DEFAULT_CACHE_SIZE_MB).toInt();
+
+    auto cacheSizeIt = std::find(std::begin(CACHE_SIZES_MB), std::end(CACHE_SIZES_MB), mCacheSizeMb);
+    if(cacheSizeIt == std::end(CACHE_SIZES_MB)) {
+        mCacheSizeMb = DEFAULT_CACHE_SIZE_MB;
+        cacheSizeIt = std::find(std::begin(CACHE_SIZES_MB), std::end(CACHE_SIZES_MB), mCacheSizeMb);
+    }
+
+    auto cacheSizeIndex = static_cast<int>(std::distance(std::begin(CACHE_SIZES_MB), cacheSizeIt));
+
+    ui->cacheSize->setCurrentIndex(cacheSizeIndex);
+    onCacheSizeChanged(cacheSizeIndex);
+
+    ui->compressCacheCheckBox->setCheckState(
+        settings.value("compressCache").toBool() ? Qt::CheckState::Checked : Qt::CheckState::Unchecked);
+    onCacheCompressionChanged(ui->compressCacheCheckBox->checkState());
+
+    mWarmUpFrames = std::max(0, settings.value("warmUpFrames", DEFAULT_WARM_UP_FRAMES).toInt());
+
+    // Serve mounted files over HTTP on localhost, disabled unless a port is set
+    // Kept even if listening fails, e.g. while the port is taken, so it isn't lost on exit
+    mHttpPort = settings.value("httpPort", 0).toInt();
+    if(mHttpPort > 0 && mHttpPort <= 65535) {
+        mHttpServer = std::make_unique<HttpServer>();
+
+        if(!mHttpServer->listen(QHostAddress::LocalHost, static_cast<quint16>(mHttpPort)))
+            mHttpServer.reset();
+    }
+
+    // Cap on the memory of frames being rendered, the file system's default unless set
+    if(settings.contains("renderMemoryLimitMb")) {
+        auto renderMemoryLimitMb = std::max(0, settings.value("renderMemoryLimitMb").toInt());
+
+        mFuseFilesystem->setRenderMemoryLimit(static_cast<size_t>(renderMemoryLimitMb) * 1024 * 1024);
+    }
+
+    // Record every read for motioncam-fs-replay, disabled unless a file is set
+    auto accessLogFile = settings.value("accessLogFile").toString();
+    if(!accessLogFile.isEmpty()) {
+        try {
+            motioncam::AccessLog::start(accessLogFile.toStdString());
+        }
+        catch(std::runtime_error& e) {
+            QMessageBox::warning(this, "Error", QString("Failed to record reads. (error: %1)").arg(e.what()));
+        }
+    }
+
     // Restore mounted files
     auto size = settings.beginReadArray("mountedFiles");
     for (int i = 0; i < size; ++i) {
         settings.setArrayIndex(i);
 
         auto srcFile = settings.value("srcFile").toString();
+        auto lastFrame = settings.value("lastFrame", -1).toLongLong();
+
         if(QFile::exists(srcFile)) // Mount files that exist
-            mountFile(srcFile);
+            mountFile(srcFile, lastFrame);
     }
     settings.endArray();
 
@@ -136,12 +234,11 @@ bool MainWindow::eventFilter(QObject *watched, QEvent *event) {
             if (dragEvent->mimeData()->hasUrls()) {
                 const auto urls = dragEvent->mimeData()->urls();
 
-                // Check if at least one file has the extension we want
+                // Check if at least one file has the extension we want, folders are mounted as a library
                 for (const auto& url : urls) {
                     auto filePath = url.toLocalFile();
 
-                    // Replace ".txt" with your desired file extension
-                    if (filePath.endsWith(".mcraw", Qt::CaseInsensitive)) {
+                    if (filePath.endsWith(".mcraw", Qt::CaseInsensitive) || QFileInfo(filePath).isDir()) {
                         dragEvent->acceptProposedAction();
                         return true;
                     }
@@ -158,7 +255,7 @@ bool MainWindow::eventFilter(QObject *watched, QEvent *event) {
 
                 for (const auto& url : urls) {
                     auto filePath = url.toLocalFile();
-                    if (filePath.endsWith(".mcraw", Qt::CaseInsensitive)) {
+                    if (filePath.endsWith(".mcraw", Qt::CaseInsensitive) || QFileInfo(filePath).isDir()) {
                         mountFile(filePath);
                     }
                 }
@@ -173,22 +270,45 @@ bool MainWindow::eventFilter(QObject *watched, QEvent *event) {
     return QMainWindow::eventFilter(watched, event);
 }
 
-void MainWindow::mountFile(const QString& filePath) {
+void MainWindow::mountFile(const QString& filePath, qint64 resumeFrame) {
     // Extract just the filename from the path
     QFileInfo fileInfo(filePath);
     auto fileName = fileInfo.fileName();
-    auto dstPath = (mCacheRootFolder.isEmpty() ? fileInfo.path() : mCacheRootFolder) + "/" + fileInfo.baseName();
+    auto isLibrary = fileInfo.isDir();
+    auto dstRoot = mCacheRootFolder.isEmpty() ? fileInfo.path() : mCacheRootFolder;
+
+    // A library is mounted next to its folder, each clip shows up as a subdirectory
+    auto dstPath = isLibrary ? dstRoot + "/" + fileName + "_dng" : dstRoot + "/" + fileInfo.baseName();
     motioncam::MountId mountId;
 
     try {
-        mountId = mFuseFilesystem->mount(
-            getRenderOptions(*ui), mDraftQuality, filePath.toStdString(), dstPath.toStdString());
+        if(isLibrary)
+            mountId = mFuseFilesystem->mountLibrary(
+                getRenderOptions(*ui), mDraftQuality, filePath.toStdString(), dstPath.toStdString());
+        else
+            mountId = mFuseFilesystem->mount(
+                getRenderOptions(*ui), mDraftQuality, filePath.toStdString(), dstPath.toStdString());
     }
     catch(std::runtime_error& e) {
         QMessageBox::critical(this, "Error", QString("There was an error mounting the file. (error: %1)").arg(e.what()));
         return;
     }
 
+    if(mHttpServer && !isLibrary) {
+        auto fs = mFuseFilesystem->getFileSystem(mountId);
+
+        if(fs) {
+            // Clips with the same name from different folders each get a directory of their own
+            auto name = fileInfo.baseName();
+
+            if(mHttpServer->getFileSystem(name))
+                name = QString("%1-%2").arg(name).arg(mountId);
+
+            mHttpServer->addFileSystem(name, fs);
+            mHttpNames[mountId] = name;
+        }
+    }
+
     // Get the scroll area's content widget and its layout
     auto* scrollContent = ui->dragAndDropScrollArea->widget();
     auto* scrollLayout = qobject_cast<QVBoxLayout*>(scrollContent->layout());
@@ -221,6 +341,26 @@ void MainWindow::mountFile(const QString& filePath) {
 
     fileLayout->addWidget(playButton);
 
+    // Create and add the export button, libraries are exported from the command line
+    QPushButton* exportButton = nullptr;
+
+    if(!isLibrary) {
+        exportButton = new QPushButton("Export", fileWidget);
+
+        exportButton->setMaximumWidth(100);
+        exportButton->setMaximumHeight(30);
+
+        fileLayout->addWidget(exportButton);
+    }
+
+    // Create and add the stats button
+    auto* statsButton = new QPushButton("Stats", fileWidget);
+
+    statsButton->setMaximumWidth(100);
+    statsButton->setMaximumHeight(30);
+
+    fileLayout->addWidget(statsButton);
+
     // Create and add the remove button
     auto* removeButton = new QPushButton("Remove", fileWidget);
 
@@ -237,8 +377,19 @@ void MainWindow::mountFile(const QString& filePath) {
     ui->dragAndDropLabel->hide();
 
     // Connect buttons
-    connect(playButton, &QPushButton::clicked, this, [this, filePath] {
-        playFile(filePath);
+    // A library has no single clip to play, open the mounted folder instead
+    connect(playButton, &QPushButton::clicked, this, [this, filePath, dstPath, isLibrary] {
+        playFile(isLibrary ? dstPath : filePath);
+    });
+
+    if(exportButton) {
+        connect(exportButton, &QPushButton::clicked, this, [this, filePath] {
+            exportFile(filePath);
+        });
+    }
+
+    connect(statsButton, &QPushButton::clicked, this, [this, mountId, fileName] {
+        showStats(mountId, fileName);
     });
 
     connect(removeButton, &QPushButton::clicked, this, [this, fileWidget] {
@@ -247,6 +398,16 @@ void MainWindow::mountFile(const QString& filePath) {
 
     mMountedFiles.append(
         motioncam::MountedFile(mountId, filePath));
+
+    if(resumeFrame >= 0)
+        mResumeFrames[mountId] = resumeFrame;
+
+    // Warm up the cache from the start, or slightly before where playback was last time
+    if(mWarmUpFrames > 0 && !isLibrary) {
+        auto startFrame = std::max<qint64>(0, resumeFrame - mWarmUpFrames / 4);
+
+        mFuseFilesystem->warmCache(mountId, startFrame, mWarmUpFrames);
+    }
 }
 
 void MainWindow::playFile(const QString& path) {
@@ -259,12 +420,121 @@ void MainWindow::playFile(const QString& path) {
     success = QProcess::startDetached("MotionCam_Player.exe", arguments);
 #elif __APPLE__
     success = QProcess::startDetached("/usr/bin/open", arguments);
+#elif __linux__
+    success = QProcess::startDetached("xdg-open", arguments);
 #endif
 
     if (!success)
         QMessageBox::warning(this, "Error", QString("Failed to launch player with file: %1").arg(path));
 }
 
+void MainWindow::exportFile(const QString& filePath) {
+    if(mExportThread.joinable()) {
+        QMessageBox::information(this, "Export", "Please wait for the current export to finish.");
+        return;
+    }
+
+    QFileInfo fileInfo(filePath);
+
+    auto folderPath = QFileDialog::getExistingDirectory(
+        this, "Export DNG Sequence To", fileInfo.path(), QFileDialog::ShowDirsOnly);
+
+    if(folderPath.isEmpty())
+        return;
+
+    // Exporting into a folder that holds part of an export continues it
+    auto dstFolder = folderPath + "/" + fileInfo.baseName();
+
+    mExporter = std::make_unique<motioncam::Exporter>(
+        filePath.toStdString(), dstFolder.toStdString(), getRenderOptions(*ui), mDraftQuality);
+
+    auto* progressDialog = new QProgressDialog(QString("Exporting %1").arg(fileInfo.fileName()), "Cancel", 0, 0, this);
+
+    progressDialog->setAttribute(Qt::WA_DeleteOnClose);
+    progressDialog->setAutoReset(false);
+    progressDialog->setAutoClose(false);
+    progressDialog->setMinimumDuration(0);
+    progressDialog->show();
+
+    connect(progressDialog, &QProgressDialog::canceled, this, [this] {
+        if(mExporter)
+            mExporter->cancel();
+    });
+
+    QPointer<QProgressDialog> dialog(progressDialog);
+    auto* exporter = mExporter.get();
+    auto fileName = fileInfo.fileName();
+
+    // Progress and the result are passed back to the UI thread
+    mExportThread = std::thread([this, exporter, dialog, fileName, dstFolder] {
+        motioncam::ExportProgress result = {};
+        QString error;
+
+        try {
+            result = exporter->run([this, dialog](const motioncam::ExportProgress& progress) {
+                QMetaObject::invokeMethod(this, [dialog, progress] {
+                    if(!dialog)
+                        return;
+
+                    dialog->setMaximum(static_cast<int>(progress.totalFrames));
+                    dialog->setValue(static_cast<int>(progress.framesDone));
+                    dialog->setLabelText(
+                        QString("%1 of %2 frames (%3 frames/s, %4 MB/s)")
+                            .arg(progress.framesDone)
+                            .arg(progress.totalFrames)
+                            .arg(progress.framesPerSecond, 0, 'f', 1)
+                            .arg(progress.megabytesPerSecond, 0, 'f', 1));
+                }, Qt::QueuedConnection);
+            });
+        }
+        catch(std::exception& e) {
+            error = e.what();
+        }
+
+        const bool cancelled = exporter->isCancelled();
+
+        QMetaObject::invokeMethod(this, [this, dialog, fileName, dstFolder, result, error, cancelled] {
+            mExportThread.join();
+            mExporter.reset();
+
+            if(dialog)
+                dialog->close();
+
+            if(!error.isEmpty())
+                QMessageBox::critical(this, "Error", QString("There was an error exporting %1. (error: %2)").arg(fileName, error));
+            else if(!cancelled)
+                QMessageBox::information(
+                    this,
+                    "Export",
+                    QString("Exported %1 frames to %2 (%3 frames/s, %4 MB/s).")
+                        .arg(result.framesWritten)
+                        .arg(dstFolder)
+                        .arg(result.framesPerSecond, 0, 'f', 1)
+                        .arg(result.megabytesPerSecond, 0, 'f', 1));
+        }, Qt::QueuedConnection);
+    });
+}
+
+void MainWindow::showStats(motioncam::MountId mountId, const QString& fileName) {
+    auto metrics = mFuseFilesystem->getMetrics(mountId);
+    if(!metrics)
+        return;
+
+    QMessageBox box(this);
+
+    box.setWindowTitle("Stats");
+    box.setText(QString("Read latency and memory of %1").arg(fileName));
+    box.setInformativeText(QString("<pre>%1</pre>").arg(QString::fromStdString(metrics->format()).toHtmlEscaped()));
+
+    auto* resetButton = box.addButton("Reset", QMessageBox::ResetRole);
+    box.addButton(QMessageBox::Close);
+
+    box.exec();
+
+    if(box.clickedButton() == resetButton)
+        metrics->reset();
+}
+
 void MainWindow::removeFile(QWidget* fileWidget) {
     auto* scrollContent = ui->dragAndDropScrollArea->widget();
     auto* scrollLayout = qobject_cast<QVBoxLayout*>(scrollContent->layout());
@@ -281,6 +551,9 @@ void MainWindow::removeFile(QWidget* fileWidget) {
     bool ok = false;
     auto mountId = fileWidget->property("mountId").toInt(&ok);
     if(ok) {
+        if(mHttpServer && mHttpNames.contains(mountId))
+            mHttpServer->removeFileSystem(mHttpNames.take(mountId));
+
         mFuseFilesystem->unmount(mountId);
 
         auto it = std::find_if(
@@ -288,6 +561,8 @@ void MainWindow::removeFile(QWidget* fileWidget) {
             [mountId](const motioncam::MountedFile& f) { return f.mountId == mountId; });
         if(it != mMountedFiles.end())
             mMountedFiles.erase(it);
+
+        mResumeFrames.remove(mountId);
     }
 }
 
@@ -330,6 +605,46 @@ void MainWindow::onDraftModeQualityChanged(int index) {
     onRenderSettingsChanged(Qt::CheckState::Checked);
 }
 
+void MainWindow::onCacheSizeChanged(int index) {
+    if(index < 0 || index >= static_cast<int>(std::size(CACHE_SIZES_MB)))
+        return;
+
+    mCacheSizeMb = CACHE_SIZES_MB[index];
+
+    // In adaptive mode the cache starts from the default size and follows free memory
+    const auto sizeMb = mCacheSizeMb == 0 ? DEFAULT_CACHE_SIZE_MB : mCacheSizeMb;
+
+    if(mFuseFilesystem)
+        mFuseFilesystem->setCacheSize(static_cast<size_t>(sizeMb) * 1024 * 1024, mCacheSizeMb == 0);
+}
+
+void MainWindow::onCacheCompressionChanged(const Qt::CheckState &state) {
+    if(mFuseFilesystem)
+        mFuseFilesystem->setCacheCompression(state == Qt::CheckState::Checked);
+}
+
+void MainWindow::onRecordTraceChanged(const Qt::CheckState &state) {
+    if(state == Qt::CheckState::Checked) {
+        motioncam::Trace::start();
+        return;
+    }
+
+    motioncam::Trace::stop();
+
+    auto path = QFileDialog::getSaveFileName(
+        this, "Save Trace", QDir::homePath() + "/motioncam-fs-trace.json", "Chrome Trace (*.json)");
+
+    if(path.isEmpty())
+        return;
+
+    try {
+        motioncam::Trace::write(path.toStdString());
+    }
+    catch(std::runtime_error& e) {
+        QMessageBox::critical(this, "Error", QString("There was an error saving the trace. (error: %1)").arg(e.what()));
+    }
+}
+
 void MainWindow::onSetCacheFolder(bool checked) {
     Q_UNUSED(checked);  // Parameter not needed for folder selection
 
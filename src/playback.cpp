@@ -0,0 +1,669 @@
+#include "DecodedFrameCache.h"
+#include "LRUCache.h"
+#include "Logging.h"
+#include "Metrics.h"
+#include "RenderMemoryLimit.h"
+#include "SyntheticFrameSource.h"
+#include "ToolOptions.h"
+#include "Types.h"
+#include "VirtualFileSystemImpl_MCRAW.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include <BS_thread_pool.hpp>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+using json = nlohmann::json;
+
+namespace {
+    using motioncam::tools::toDraftScale;
+    using motioncam::tools::toInt;
+    using motioncam::tools::toJson;
+    using motioncam::tools::parseRenderOption;
+
+    using Clock = std::chrono::steady_clock;
+
+    constexpr auto DEFAULT_CACHE_SIZE_MB = 1024;
+    constexpr auto DEFAULT_IO_THREADS = 4;
+    constexpr auto DEFAULT_READERS = 4;
+    constexpr auto DEFAULT_CHUNK_SIZE_KB = 1024;
+    constexpr auto DEFAULT_MAX_FRAMES = 120;
+    constexpr double DEFAULT_MAX_LATE_PERCENT = 1.0;
+    constexpr size_t DECODED_FRAME_CACHE_SIZE = size_t(512) * 1024 * 1024;
+
+    // Steps of the search for the highest sustained frame rate, each halves the interval
+    constexpr int SEARCH_STEPS = 6;
+
+    // Upper edges of the stall histogram in milliseconds, the last bucket is open
+    constexpr double STALL_BUCKETS_MS[] = { 10, 25, 50, 100, 250, 500, 1000 };
+    constexpr size_t NUM_STALL_BUCKETS = std::size(STALL_BUCKETS_MS) + 1;
+
+    struct Options {
+        std::string clip;
+        std::string outputFile;
+        int readers = DEFAULT_READERS;
+        int chunkSizeKb = DEFAULT_CHUNK_SIZE_KB;
+        int lookahead = 0;          // Frames read ahead of the playhead, 0 for two per reader
+        int maxFrames = DEFAULT_MAX_FRAMES;
+        double maxLatePercent = DEFAULT_MAX_LATE_PERCENT;
+        bool search = true;
+        std::vector<int> draftScales = { 2 };
+        motioncam::FileRenderOptions renderOptions = motioncam::RENDER_OPT_NONE;
+        int cacheSizeMb = DEFAULT_CACHE_SIZE_MB;
+        bool compressCache = false;
+        int renderMemoryMb = 0;
+        unsigned int ioThreads = DEFAULT_IO_THREADS;
+        unsigned int processingThreads = 0;
+    };
+
+    struct TrialResult {
+        double fps = 0;             // Rate frames were due at, 0 when played as fast as possible
+        size_t numFrames = 0;
+        size_t numOnTime = 0;
+        size_t numLate = 0;
+        size_t numFailed = 0;
+        double seconds = 0;
+        double startupMs = 0;       // Until the first frame was ready
+        double stalledMs = 0;       // Total time the playhead waited on late frames
+        uint64_t peakMemoryBytes = 0;
+        size_t stalls[NUM_STALL_BUCKETS] = {};
+        motioncam::LatencyStats stall;
+        motioncam::LatencyStats frameLatency;   // From the first read of a frame until it was complete
+
+        double latePercent() const {
+            // The first frame sets off the clock so it can't be late
+            return numFrames > 1 ? 100.0 * (numLate + numFailed) / (numFrames - 1) : 0.0;
+        }
+
+        double deliveredFps() const {
+            return seconds > 0 ? numFrames / seconds : 0.0;
+        }
+    };
+
+    struct ScaleResult {
+        std::string name;
+        int draftScale = 1;
+        TrialResult unpaced;
+        TrialResult realTime;
+        std::vector<TrialResult> search;
+        double maxSustainedFps = 0;
+    };
+
+    void printUsage(const char* program) {
+        std::cout <<
+            "Usage: " << program << " [options]\n"
+            "\n"
+            "Plays a clip through the virtual file system the way an editor does: readers fetch\n"
+            "frame-N.dng files in order and in chunks, ahead of a playhead that moves at the clip's\n"
+            "frame rate and stalls when a frame isn't ready. Reports the frames delivered on time,\n"
+            "the late ones and the stalls at full and draft scale, then searches for the highest\n"
+            "frame rate each scale sustains.\n"
+            "\n"
+            "Options:\n"
+            "      --clip <path>             Clip to play, an MCRAW file or a synthetic:name?key=value&...\n"
+            "                                clip (default: a 4032x3024 synthetic clip at 30 fps). Synthetic\n"
+            "                                clips are held in memory and leave out MCRAW decoding and disk\n"
+            "                                reads.\n"
+            "  -r, --readers <n>             Frames read at the same time (default: 4)\n"
+            "      --chunk-size <KB>         Size of each read (default: 1024)\n"
+            "      --lookahead <n>           Frames read ahead of the playhead (default: 2 per reader)\n"
+            "  -n, --frames <n>              Frames played per run, 0 for the whole clip (default: 120)\n"
+            "      --max-late <percent>      Late frames a sustained frame rate allows (default: 1)\n"
+            "      --draft-scales <list>     Comma separated draft scales to play besides full\n"
+            "                                scale, e.g. 2,4 (default: 2)\n"
+            "      --no-search               Only play at the clip's frame rate\n"
+            "  -o, --output <file>           Also write the results as JSON to <file>\n"
+            "      --vignette-correction     Apply vignette correction\n"
+            "      --normalize-shading-map   Normalize the shading map\n"
+            "  -c, --cache-size <MB>         Render cache size (default: 1024)\n"
+            "      --compress-cache          Store cached frames compressed\n"
+            "      --render-memory <MB>      Memory frames being rendered may hold at once, 0 for\n"
+            "                                no limit (default: 0)\n"
+            "      --io-threads <n>          Threads reading from the clip (default: 4)\n"
+            "      --processing-threads <n>  Threads rendering frames (default: one per core)\n"
+            "  -h, --help                    Show this help\n";
+    }
+
+    std::vector<int> toDraftScales(const std::string& option, const std::string& value) {
+        std::vector<int> scales;
+        size_t start = 0;
+
+        while(start <= value.size()) {
+            const auto end = (std::min)(value.find(',', start), value.size());
+            scales.push_back(toDraftScale(option, value.substr(start, end - start)));
+            start = end + 1;
+        }
+
+        return scales;
+    }
+
+    // Returns false if only the help should be shown
+    bool parseArgs(int argc, char* argv[], Options& options) {
+        for(int i = 1; i < argc; ++i) {
+            const std::string arg(argv[i]);
+
+            auto nextValue = [&]() -> std::string {
+                if(i + 1 >= argc)
+                    throw std::runtime_error("Missing value for " + arg);
+
+                return argv[++i];
+            };
+
+            if(arg == "-h" || arg == "--help")
+                return false;
+            else if(arg == "--clip")
+                options.clip = nextValue();
+            else if(arg == "-r" || arg == "--readers")
+                options.readers = toInt(arg, nextValue(), 1);
+            else if(arg == "--chunk-size")
+                options.chunkSizeKb = toInt(arg, nextValue(), 1);
+            else if(arg == "--lookahead")
+                options.lookahead = toInt(arg, nextValue(), 1);
+            else if(arg == "-n" || arg == "--frames")
+                options.maxFrames = toInt(arg, nextValue(), 0);
+            else if(arg == "--max-late") {
+                try {
+                    options.maxLatePercent = std::stod(nextValue());
+                }
+                catch(const std::exception&) {
+                    throw std::runtime_error("Invalid value for " + arg);
+                }
+
+                if(options.maxLatePercent < 0 || options.maxLatePercent >= 100)
+                    throw std::runtime_error("Invalid value for " + arg);
+            }
+            else if(arg == "--draft-scales")
+                options.draftScales = toDraftScales(arg, nextValue());
+            else if(arg == "--no-search")
+                options.search = false;
+            else if(arg == "-o" || arg == "--output")
+                options.outputFile = nextValue();
+            else if(parseRenderOption(arg, options.renderOptions))
+                continue;
+            else if(arg == "-c" || arg == "--cache-size")
+                options.cacheSizeMb = toInt(arg, nextValue(), 1);
+            else if(arg == "--compress-cache")
+                options.compressCache = true;
+            else if(arg == "--render-memory")
+                options.renderMemoryMb = toInt(arg, nextValue(), 0);
+            else if(arg == "--io-threads")
+                options.ioThreads = toInt(arg, nextValue(), 1);
+            else if(arg == "--processing-threads")
+                options.processingThreads = toInt(arg, nextValue(), 1);
+            else
+                throw std::runtime_error("Unknown option " + arg);
+        }
+
+        if(options.lookahead == 0)
+            options.lookahead = 2 * options.readers;
+
+        // Readers beyond the lookahead would have nothing to do
+        options.readers = (std::min)(options.readers, options.lookahead);
+
+        if(options.clip.empty()) {
+            motioncam::SyntheticClipOptions clip;
+
+            clip.name = "playback";
+            clip.audioChannels = 0;
+
+            options.clip = clip.toPath();
+        }
+
+        return true;
+    }
+
+    size_t stallBucket(double ms) {
+        size_t i = 0;
+
+        while(i < std::size(STALL_BUCKETS_MS) && ms > STALL_BUCKETS_MS[i])
+            ++i;
+
+        return i;
+    }
+
+    // Plays frames once with cold caches. Readers take the next frame as soon as it is within the
+    // lookahead of the playhead and read it from start to end. The playhead starts when the first
+    // frame is ready and shows a frame every 1/fps seconds, when a frame is late it waits for it
+    // and the frames after it are due that much later. fps 0 shows frames as soon as they're ready.
+    TrialResult play(
+        motioncam::VirtualFileSystemImpl_MCRAW& fs,
+        const std::vector<motioncam::Entry>& frames,
+        double fps,
+        const Options& options)
+    {
+        const size_t chunkSize = static_cast<size_t>(options.chunkSizeKb) * 1024;
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::vector<Clock::time_point> readyAt(frames.size());
+        std::vector<char> ready(frames.size(), 0);
+        std::vector<char> failed(frames.size(), 0);
+        size_t shown = 0;
+        size_t nextFrame = 0;
+
+        motioncam::LatencyHistogram frameLatency;
+
+        auto reader = [&]() {
+            std::vector<char> buffer(chunkSize);
+
+            while(true) {
+                size_t i;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+
+                    if(nextFrame >= frames.size())
+                        return;
+
+                    i = nextFrame++;
+
+                    changed.wait(lock, [&] { return i < shown + options.lookahead; });
+                }
+
+                const auto& entry = frames[i];
+                const auto start = Clock::now();
+                bool success = true;
+
+                for(size_t pos = 0; pos < entry.size && success; pos += chunkSize) {
+                    const auto len = (std::min)(chunkSize, entry.size - pos);
+
+                    // Frames that fail to render come back short rather than with an error
+                    success = fs.readFile(entry, pos, len, buffer.data(), [](size_t, int) {}, false) == static_cast<int>(len);
+                }
+
+                const auto end = Clock::now();
+
+                frameLatency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+
+                    readyAt[i] = end;
+                    ready[i] = 1;
+                    failed[i] = !success;
+                }
+
+                changed.notify_all();
+            }
+        };
+
+        fs.getMetrics()->reset();
+
+        const auto trialStart = Clock::now();
+
+        std::vector<std::thread> readers;
+
+        for(int i = 0; i < options.readers; ++i)
+            readers.emplace_back(reader);
+
+        TrialResult result;
+        motioncam::LatencyHistogram stalls;
+        Clock::time_point playStart;
+        Clock::duration delay(0);
+
+        result.fps = fps;
+        result.numFrames = frames.size();
+
+        for(size_t i = 0; i < frames.size(); ++i) {
+            const auto due = playStart + delay +
+                std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(fps > 0 ? i / fps : 0.0));
+
+            if(i > 0 && fps > 0)
+                std::this_thread::sleep_until(due);
+
+            Clock::time_point frameReadyAt;
+            bool frameFailed;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+
+                changed.wait(lock, [&] { return ready[i] != 0; });
+
+                frameReadyAt = readyAt[i];
+                frameFailed = failed[i] != 0;
+            }
+
+            if(i == 0) {
+                playStart = Clock::now();
+                result.startupMs = std::chrono::duration<double, std::milli>(frameReadyAt - trialStart).count();
+            }
+
+            if(frameFailed)
+                ++result.numFailed;
+            else if(i == 0 || fps <= 0 || frameReadyAt <= due)
+                ++result.numOnTime;
+            else
+                ++result.numLate;
+
+            if(i > 0 && fps > 0 && frameReadyAt > due) {
+                const auto stall = frameReadyAt - due;
+                const double stallMs = std::chrono::duration<double, std::milli>(stall).count();
+
+                stalls.record(std::chrono::duration_cast<std::chrono::nanoseconds>(stall).count());
+
+                ++result.stalls[stallBucket(stallMs)];
+                result.stalledMs += stallMs;
+
+                delay += stall;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                shown = i + 1;
+            }
+
+            changed.notify_all();
+        }
+
+        for(auto& thread : readers)
+            thread.join();
+
+        result.seconds = std::chrono::duration<double>(Clock::now() - playStart).count();
+        result.stall = stalls.stats();
+        result.frameLatency = frameLatency.stats();
+        result.peakMemoryBytes = fs.getMetrics()->totalMemory().peakBytes;
+
+        return result;
+    }
+
+    // Tasks of the previous trial, e.g. frames decoded ahead, are finished first so they can't
+    // fill the caches again
+    void clearCaches(
+        BS::thread_pool& ioThreadPool,
+        BS::thread_pool& processingThreadPool,
+        motioncam::LRUCache& cache,
+        motioncam::DecodedFrameCache& decodedFrameCache)
+    {
+        ioThreadPool.wait();
+        processingThreadPool.wait();
+
+        cache.clear();
+
+        decodedFrameCache.resize(0);
+        decodedFrameCache.resize(DECODED_FRAME_CACHE_SIZE);
+    }
+
+    void printTrial(const char* name, const TrialResult& trial) {
+        std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(1);
+
+        if(trial.fps > 0)
+            std::cout << trial.fps << " fps: ";
+
+        std::cout << trial.numOnTime << " on time, " << trial.numLate << " late";
+
+        if(trial.numFailed > 0)
+            std::cout << ", " << trial.numFailed << " failed";
+
+        std::cout << " (" << trial.latePercent() << "%), "
+                  << trial.deliveredFps() << " fps delivered, startup " << trial.startupMs << " ms"
+                  << ", peak memory " << trial.peakMemoryBytes / (1024 * 1024) << " MB";
+
+        if(trial.stall.count > 0)
+            std::cout << ", stalled " << trial.stalledMs << " ms";
+
+        std::cout << "\n";
+    }
+
+    void printStalls(const TrialResult& trial) {
+        if(trial.stall.count == 0)
+            return;
+
+        std::cout << "  stalls      " << std::fixed << std::setprecision(1)
+                  << "p50 " << trial.stall.p50Us / 1000.0 << " ms"
+                  << ", p95 " << trial.stall.p95Us / 1000.0 << " ms"
+                  << ", max " << trial.stall.maxUs / 1000.0 << " ms\n";
+
+        for(size_t i = 0; i < NUM_STALL_BUCKETS; ++i) {
+            if(trial.stalls[i] == 0)
+                continue;
+
+            std::cout << "    ";
+
+            if(i < std::size(STALL_BUCKETS_MS))
+                std::cout << "<= " << std::setw(6) << std::setprecision(0) << STALL_BUCKETS_MS[i] << " ms";
+            else
+                std::cout << " > " << std::setw(6) << std::setprecision(0) << STALL_BUCKETS_MS[i - 1] << " ms";
+
+            std::cout << "  " << trial.stalls[i] << "\n";
+        }
+    }
+
+    json toJson(const TrialResult& trial) {
+        json stalls = json::array();
+
+        for(size_t i = 0; i < NUM_STALL_BUCKETS; ++i) {
+            stalls.push_back({
+                { "max_ms", i < std::size(STALL_BUCKETS_MS) ? json(STALL_BUCKETS_MS[i]) : json(nullptr) },
+                { "count", trial.stalls[i] }
+            });
+        }
+
+        return {
+            { "fps", trial.fps },
+            { "frames", trial.numFrames },
+            { "on_time", trial.numOnTime },
+            { "late", trial.numLate },
+            { "failed", trial.numFailed },
+            { "late_percent", trial.latePercent() },
+            { "delivered_fps", trial.deliveredFps() },
+            { "seconds", trial.seconds },
+            { "startup_ms", trial.startupMs },
+            { "stalled_ms", trial.stalledMs },
+            { "peak_memory_mb", trial.peakMemoryBytes / (1024.0 * 1024.0) },
+            { "stall", toJson(trial.stall) },
+            { "stall_histogram", stalls },
+            { "frame_latency", toJson(trial.frameLatency) }
+        };
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+
+    try {
+        if(!parseArgs(argc, argv, options)) {
+            printUsage(argv[0]);
+            return 0;
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << "\n\n";
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    motioncam::setupLogging("");
+
+    // Debug messages of every read would drown out the results and slow down playback
+    spdlog::set_level(spdlog::level::warn);
+
+    BS::thread_pool ioThreadPool(options.ioThreads);
+    BS::thread_pool processingThreadPool(options.processingThreads);
+    motioncam::LRUCache cache(static_cast<size_t>(options.cacheSizeMb) * 1024 * 1024);
+    motioncam::DecodedFrameCache decodedFrameCache(DECODED_FRAME_CACHE_SIZE);
+    motioncam::RenderMemoryLimit renderMemoryLimit(static_cast<size_t>(options.renderMemoryMb) * 1024 * 1024);
+
+    cache.setCompressionEnabled(options.compressCache);
+
+    std::unique_ptr<motioncam::VirtualFileSystemImpl_MCRAW> fs;
+
+    try {
+        fs = std::make_unique<motioncam::VirtualFileSystemImpl_MCRAW>(
+            ioThreadPool, processingThreadPool, cache, decodedFrameCache, options.renderOptions, 2, options.clip,
+            nullptr, &renderMemoryLimit);
+    }
+    catch(const std::exception& e) {
+        std::cerr << "Failed to open " << options.clip << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    const double clipFps = fs->frameRate();
+
+    if(clipFps <= 0) {
+        std::cerr << "Can't tell the frame rate of " << options.clip << std::endl;
+        return 1;
+    }
+
+    std::cerr << "Playing " << options.clip << " at " << std::fixed << std::setprecision(2) << clipFps << " fps with "
+              << options.readers << " readers, " << options.chunkSizeKb << " KB reads and "
+              << options.lookahead << " frames of lookahead" << std::endl;
+
+    std::vector<std::pair<std::string, int>> scales = { { "full", 1 } };
+
+    for(int scale : options.draftScales)
+        scales.emplace_back("draft 1/" + std::to_string(scale), scale);
+
+    std::vector<ScaleResult> results;
+
+    for(const auto& [name, scale] : scales) {
+        auto renderOptions = options.renderOptions;
+
+        if(scale > 1)
+            renderOptions |= motioncam::RENDER_OPT_DRAFT;
+
+        fs->updateOptions(renderOptions, scale > 1 ? scale : 2);
+
+        // Entry sizes depend on the scale so frames are listed again each time
+        std::vector<motioncam::Entry> frames;
+
+        for(auto& entry : fs->listFiles()) {
+            if(std::holds_alternative<motioncam::FrameInfo>(entry.userData))
+                frames.push_back(entry);
+        }
+
+        std::sort(frames.begin(), frames.end(), [](const auto& a, const auto& b) {
+            return std::get<motioncam::FrameInfo>(a.userData).frameNumber < std::get<motioncam::FrameInfo>(b.userData).frameNumber;
+        });
+
+        if(options.maxFrames > 0 && frames.size() > static_cast<size_t>(options.maxFrames))
+            frames.resize(options.maxFrames);
+
+        if(frames.size() < 2) {
+            std::cerr << options.clip << " has too few frames to play" << std::endl;
+            return 1;
+        }
+
+        ScaleResult result;
+
+        result.name = name;
+        result.draftScale = scale;
+
+        auto playAt = [&](double fps) {
+            clearCaches(ioThreadPool, processingThreadPool, cache, decodedFrameCache);
+            return play(*fs, frames, fps, options);
+        };
+
+        std::cout << "\n" << name << " (" << frames.size() << " frames, "
+                  << frames.front().size / (1024 * 1024) << " MB each)\n";
+
+        result.realTime = playAt(clipFps);
+
+        printTrial("real time", result.realTime);
+        printStalls(result.realTime);
+
+        if(options.search) {
+            result.unpaced = playAt(0);
+
+            printTrial("unpaced", result.unpaced);
+
+            // Frames can't be shown on time faster than they are delivered flat out. The search
+            // narrows down between 0 and a bit above that, keeping the highest rate that passed.
+            double low = 0;
+            double high = result.unpaced.deliveredFps() * 1.1;
+
+            if(result.realTime.latePercent() <= options.maxLatePercent)
+                low = (std::min)(clipFps, high);
+
+            for(int i = 0; i < SEARCH_STEPS && high - low > 0.1; ++i) {
+                const double fps = (low + high) / 2;
+                const auto trial = playAt(fps);
+
+                printTrial("search", trial);
+
+                if(trial.latePercent() <= options.maxLatePercent)
+                    low = fps;
+                else
+                    high = fps;
+
+                result.search.push_back(trial);
+            }
+
+            result.maxSustainedFps = low;
+
+            std::cout << "max sustained " << std::fixed << std::setprecision(1) << result.maxSustainedFps << " fps ("
+                      << result.maxSustainedFps / clipFps << "x real time)\n";
+        }
+
+        results.push_back(std::move(result));
+    }
+
+    if(!options.outputFile.empty()) {
+        json output = {
+            { "clip", options.clip },
+            { "clip_fps", clipFps },
+            { "options", motioncam::optionsToString(options.renderOptions) },
+            { "readers", options.readers },
+            { "chunk_size_kb", options.chunkSizeKb },
+            { "lookahead", options.lookahead },
+            { "render_memory_mb", options.renderMemoryMb },
+            { "max_late_percent", options.maxLatePercent }
+        };
+
+        json scalesJson = json::array();
+
+        for(const auto& result : results) {
+            json scale = {
+                { "name", result.name },
+                { "draft_scale", result.draftScale },
+                { "real_time", toJson(result.realTime) }
+            };
+
+            if(options.search) {
+                json search = json::array();
+
+                for(const auto& trial : result.search)
+                    search.push_back(toJson(trial));
+
+                scale["unpaced"] = toJson(result.unpaced);
+                scale["search"] = search;
+                scale["max_sustained_fps"] = result.maxSustainedFps;
+            }
+
+            scalesJson.push_back(scale);
+        }
+
+        output["scales"] = scalesJson;
+
+        std::ofstream file(options.outputFile);
+
+        file << output.dump(2) << std::endl;
+
+        if(!file) {
+            std::cerr << "Failed to write " << options.outputFile << std::endl;
+            return 1;
+        }
+    }
+
+    // Tasks still running can't outlive the pools
+    fs.reset();
+
+    ioThreadPool.wait();
+    processingThreadPool.wait();
+
+    return 0;
+}
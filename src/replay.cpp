@@ -0,0 +1,387 @@
+#include "AccessLog.h"
+#include "DecodedFrameCache.h"
+#include "LRUCache.h"
+#include "Logging.h"
+#include "Metrics.h"
+#include "ToolOptions.h"
+#include "Types.h"
+#include "VirtualFileSystemImpl_MCRAW.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <BS_thread_pool.hpp>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+using json = nlohmann::json;
+
+namespace {
+    using motioncam::tools::toDraftScale;
+    using motioncam::tools::toInt;
+    using motioncam::tools::toJson;
+    using motioncam::tools::parseRenderOption;
+
+    constexpr auto DEFAULT_CACHE_SIZE_MB = 1024;
+    constexpr auto DEFAULT_IO_THREADS = 4;
+    constexpr size_t DECODED_FRAME_CACHE_SIZE = size_t(512) * 1024 * 1024;
+
+    struct Options {
+        std::string logFile;
+        std::string clip;
+        std::string outputFile;
+        int source = -1;            // Recorded source to replay, -1 for the one with the most reads
+        double speed = 1.0;         // 0 replays as fast as possible
+        bool list = false;
+        motioncam::FileRenderOptions renderOptions = motioncam::RENDER_OPT_NONE;
+        int draftScale = 2;
+        int cacheSizeMb = DEFAULT_CACHE_SIZE_MB;
+        bool compressCache = false;
+        unsigned int ioThreads = DEFAULT_IO_THREADS;
+        unsigned int processingThreads = 0;
+    };
+
+    struct Results {
+        motioncam::LatencyHistogram latency;
+        motioncam::LatencyHistogram startLag;  // How far behind the recorded time reads were issued
+        std::atomic<uint64_t> numBytes{0};
+        std::atomic<uint64_t> numFailed{0};
+    };
+
+    void printUsage(const char* program) {
+        std::cout <<
+            "Usage: " << program << " [options] --clip <file.mcraw> <access.log>\n"
+            "\n"
+            "Replays the reads of an access log recorded with --record-access against a clip,\n"
+            "with the timing and concurrency they were recorded with, and reports their\n"
+            "latency and throughput.\n"
+            "\n"
+            "Options:\n"
+            "      --clip <path>             Clip to read from, an MCRAW file or a\n"
+            "                                synthetic:name?key=value&... clip\n"
+            "      --source <n>              Replay the reads of the nth recorded file (default: the\n"
+            "                                file with the most reads)\n"
+            "      --list                    List the recorded files and exit\n"
+            "      --speed <x>               Replay <x> times as fast as recorded, 0 issues each read\n"
+            "                                as soon as the previous one on its thread is done\n"
+            "                                (default: 1)\n"
+            "  -o, --output <file>           Also write the results as JSON to <file>\n"
+            "  -d, --draft                   Render draft quality frames\n"
+            "  -s, --draft-scale <2|4|8>     Downscale factor in draft mode (default: 2)\n"
+            "      --vignette-correction     Apply vignette correction\n"
+            "      --normalize-shading-map   Normalize the shading map\n"
+            "  -c, --cache-size <MB>         Render cache size (default: 1024)\n"
+            "      --compress-cache          Store cached frames compressed\n"
+            "      --io-threads <n>          Threads reading from the clip (default: 4)\n"
+            "      --processing-threads <n>  Threads rendering frames (default: one per core)\n"
+            "  -h, --help                    Show this help\n";
+    }
+
+    // Returns false if only the help should be shown
+    bool parseArgs(int argc, char* argv[], Options& options) {
+        for(int i = 1; i < argc; ++i) {
+            const std::string arg(argv[i]);
+
+            auto nextValue = [&]() -> std::string {
+                if(i + 1 >= argc)
+                    throw std::runtime_error("Missing value for " + arg);
+
+                return argv[++i];
+            };
+
+            if(arg == "-h" || arg == "--help")
+                return false;
+            else if(arg == "--clip")
+                options.clip = nextValue();
+            else if(arg == "--source")
+                options.source = toInt(arg, nextValue(), 0);
+            else if(arg == "--list")
+                options.list = true;
+            else if(arg == "--speed") {
+                try {
+                    options.speed = std::stod(nextValue());
+                }
+                catch(const std::exception&) {
+                    throw std::runtime_error("Invalid value for " + arg);
+                }
+
+                if(options.speed < 0)
+                    throw std::runtime_error("Invalid value for " + arg);
+            }
+            else if(arg == "-o" || arg == "--output")
+                options.outputFile = nextValue();
+            else if(arg == "-d" || arg == "--draft")
+                options.renderOptions |= motioncam::RENDER_OPT_DRAFT;
+            else if(arg == "-s" || arg == "--draft-scale")
+                options.draftScale = toDraftScale(arg, nextValue());
+            else if(parseRenderOption(arg, options.renderOptions))
+                continue;
+            else if(arg == "-c" || arg == "--cache-size")
+                options.cacheSizeMb = toInt(arg, nextValue(), 1);
+            else if(arg == "--compress-cache")
+                options.compressCache = true;
+            else if(arg == "--io-threads")
+                options.ioThreads = toInt(arg, nextValue(), 1);
+            else if(arg == "--processing-threads")
+                options.processingThreads = toInt(arg, nextValue(), 1);
+            else if(!arg.empty() && arg[0] == '-')
+                throw std::runtime_error("Unknown option " + arg);
+            else if(options.logFile.empty())
+                options.logFile = arg;
+            else
+                throw std::runtime_error("Only one access log can be replayed");
+        }
+
+        if(options.logFile.empty())
+            throw std::runtime_error("No access log");
+
+        if(options.clip.empty() && !options.list)
+            throw std::runtime_error("No clip to replay against");
+
+        return true;
+    }
+
+    std::vector<size_t> countReads(const motioncam::AccessLogContents& log) {
+        std::vector<size_t> counts(log.sources.size(), 0);
+
+        for(const auto& read : log.reads)
+            ++counts[read.source];
+
+        return counts;
+    }
+
+    void printLatency(const char* name, const motioncam::LatencyStats& stats) {
+        std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(3)
+                  << "mean " << stats.meanUs / 1000.0 << " ms"
+                  << ", p50 " << stats.p50Us / 1000.0 << " ms"
+                  << ", p95 " << stats.p95Us / 1000.0 << " ms"
+                  << ", p99 " << stats.p99Us / 1000.0 << " ms"
+                  << ", max " << stats.maxUs / 1000.0 << " ms\n";
+    }
+
+    // Issues the reads of one recorded thread in order, no earlier than they were recorded
+    void replayThread(
+        motioncam::VirtualFileSystemImpl_MCRAW& fs,
+        const std::vector<const motioncam::AccessRecord*>& reads,
+        const std::vector<std::optional<motioncam::Entry>>& entries,
+        std::chrono::steady_clock::time_point start,
+        double speed,
+        Results& results)
+    {
+        std::vector<char> buffer;
+
+        for(const auto* read : reads) {
+            const auto& entry = entries[read->entry];
+
+            if(speed > 0) {
+                const auto target = start + std::chrono::nanoseconds(static_cast<int64_t>(read->timestampNs / speed));
+
+                std::this_thread::sleep_until(target);
+                results.startLag.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - target).count());
+            }
+
+            if(buffer.size() < read->length)
+                buffer.resize(read->length);
+
+            const auto readStart = std::chrono::steady_clock::now();
+            const int readBytes = fs.readFile(*entry, read->offset, read->length, buffer.data(), [](size_t, int) {}, false);
+            const auto elapsed = std::chrono::steady_clock::now() - readStart;
+
+            results.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+            // Frames that fail to render come back short rather than with an error
+            const size_t expectedBytes = read->offset < entry->size ? (std::min)(static_cast<size_t>(read->length), static_cast<size_t>(entry->size - read->offset)) : 0;
+
+            if(readBytes < 0 || static_cast<size_t>(readBytes) != expectedBytes)
+                ++results.numFailed;
+            else
+                results.numBytes += readBytes;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+
+    try {
+        if(!parseArgs(argc, argv, options)) {
+            printUsage(argv[0]);
+            return 0;
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << "\n\n";
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    motioncam::setupLogging("");
+
+    // Debug messages of every read would drown out the results and slow down the replay
+    spdlog::set_level(spdlog::level::warn);
+
+    motioncam::AccessLogContents log;
+
+    try {
+        log = motioncam::AccessLog::load(options.logFile);
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    const auto readsPerSource = countReads(log);
+
+    if(options.list) {
+        for(size_t i = 0; i < log.sources.size(); ++i)
+            std::cout << i << ": " << log.sources[i] << " (" << readsPerSource[i] << " reads)\n";
+
+        return 0;
+    }
+
+    if(log.sources.empty()) {
+        std::cerr << options.logFile << " has no reads" << std::endl;
+        return 1;
+    }
+
+    if(options.source < 0)
+        options.source = static_cast<int>(std::max_element(readsPerSource.begin(), readsPerSource.end()) - readsPerSource.begin());
+
+    if(options.source >= static_cast<int>(log.sources.size())) {
+        std::cerr << "The log only has " << log.sources.size() << " files" << std::endl;
+        return 1;
+    }
+
+    BS::thread_pool ioThreadPool(options.ioThreads);
+    BS::thread_pool processingThreadPool(options.processingThreads);
+    motioncam::LRUCache cache(static_cast<size_t>(options.cacheSizeMb) * 1024 * 1024);
+    motioncam::DecodedFrameCache decodedFrameCache(DECODED_FRAME_CACHE_SIZE);
+
+    cache.setCompressionEnabled(options.compressCache);
+
+    std::unique_ptr<motioncam::VirtualFileSystemImpl_MCRAW> fs;
+
+    try {
+        fs = std::make_unique<motioncam::VirtualFileSystemImpl_MCRAW>(
+            ioThreadPool, processingThreadPool, cache, decodedFrameCache, options.renderOptions, options.draftScale, options.clip);
+    }
+    catch(const std::exception& e) {
+        std::cerr << "Failed to open " << options.clip << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    // Files that don't exist in the clip, e.g. frames past its end, are skipped
+    std::vector<std::optional<motioncam::Entry>> entries;
+
+    for(const auto& path : log.entries)
+        entries.push_back(fs->findEntry(path));
+
+    std::map<uint32_t, std::vector<const motioncam::AccessRecord*>> readsByThread;
+    size_t numSkipped = 0;
+
+    for(const auto& read : log.reads) {
+        if(read.source != static_cast<uint32_t>(options.source))
+            continue;
+
+        if(!entries[read.entry]) {
+            ++numSkipped;
+            continue;
+        }
+
+        readsByThread[read.thread].push_back(&read);
+    }
+
+    std::cerr << "Replaying reads of " << log.sources[options.source] << " from " << readsByThread.size()
+              << " threads against " << options.clip << std::endl;
+
+    Results results;
+    std::vector<std::thread> threads;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for(const auto& [thread, reads] : readsByThread) {
+        threads.emplace_back(
+            replayThread, std::ref(*fs), std::cref(reads), std::cref(entries), start, options.speed, std::ref(results));
+    }
+
+    for(auto& thread : threads)
+        thread.join();
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const auto latency = results.latency.stats();
+    const auto startLag = results.startLag.stats();
+    const auto numBytes = results.numBytes.load();
+
+    std::cout << std::fixed << std::setprecision(1)
+              << latency.count << " reads (" << numSkipped << " skipped, " << results.numFailed << " failed)"
+              << " in " << seconds << " s, "
+              << latency.count / seconds << " reads/s, "
+              << numBytes / seconds / (1024 * 1024) << " MB/s\n";
+
+    printLatency("latency", latency);
+
+    if(options.speed > 0)
+        printLatency("start lag", startLag);
+
+    std::cout << "\n" << fs->getMetrics()->format();
+
+    if(!options.outputFile.empty()) {
+        json output = {
+            { "log", options.logFile },
+            { "source", log.sources[options.source] },
+            { "clip", options.clip },
+            { "options", motioncam::optionsToString(options.renderOptions) },
+            { "speed", options.speed },
+            { "threads", readsByThread.size() },
+            { "reads", latency.count },
+            { "skipped", numSkipped },
+            { "failed", results.numFailed.load() },
+            { "bytes", numBytes },
+            { "seconds", seconds },
+            { "reads_per_second", latency.count / seconds },
+            { "mb_per_second", numBytes / seconds / (1024 * 1024) },
+            { "latency", toJson(latency) },
+            { "start_lag", toJson(startLag) }
+        };
+
+        json stages = json::object();
+
+        for(int i = 0; i < static_cast<int>(motioncam::Stage::COUNT); ++i) {
+            const auto stage = static_cast<motioncam::Stage>(i);
+            const auto stats = fs->getMetrics()->stats(stage);
+
+            if(stats.count > 0)
+                stages[motioncam::stageName(stage)] = toJson(stats);
+        }
+
+        output["stages"] = stages;
+
+        std::ofstream file(options.outputFile);
+
+        file << output.dump(2) << std::endl;
+
+        if(!file) {
+            std::cerr << "Failed to write " << options.outputFile << std::endl;
+            return 1;
+        }
+    }
+
+    // Tasks still running can't outlive the pools
+    fs.reset();
+
+    ioThreadPool.wait();
+    processingThreadPool.wait();
+
+    return 0;
+}
@@ -4,6 +4,11 @@
 
 #include "VirtualFileSystemImpl_MCRAW.h"
 #include "LRUCache.h"
+#include "CacheBudget.h"
+#include "DecodedFrameCache.h"
+#include "RenderMemoryLimit.h"
+#include "Tracing.h"
+#include "Logging.h"
 
 #include <iostream>
 #include <ntstatus.h>
@@ -18,16 +23,14 @@
 // Logging
 #include <spdlog/spdlog.h>
 
-#include <spdlog/sinks/basic_file_sink.h>
-#include <spdlog/sinks/stdout_color_sinks.h>
-#include <spdlog/sinks/msvc_sink.h>
-
 namespace fs = boost::filesystem;
 namespace lcv = boost::locale::conv;
 
 namespace motioncam {
 
-constexpr auto CACHE_SIZE = 128 * 1024 * 1024; // Small cache size as we write the files to disk
+constexpr auto DEFAULT_CACHE_SIZE = 128 * 1024 * 1024; // Small cache size as we write the files to disk
+constexpr auto DECODED_FRAME_CACHE_SIZE = 256 * 1024 * 1024; // Raw frames kept for re-rendering and decoding ahead
+constexpr size_t DEFAULT_RENDER_MEMORY_LIMIT = size_t(2048) * 1024 * 1024; // Frames being rendered at once, reads wait beyond this
 constexpr auto IO_THREADS = 4;
 
 namespace {
@@ -82,6 +85,9 @@ public:
 
 public:
     void updateOptions(FileRenderOptions options, int draftScale);
+    void warmUp(int64_t startFrame, int numFrames);
+    int64_t lastAccessedFrame() const;
+    std::shared_ptr<VirtualFileSystemImpl_MCRAW> getFileSystem() const;
 
 protected:
     HRESULT StartDirEnum(_In_ const PRJ_CALLBACK_DATA* CallbackData, _In_ const GUID* EnumerationId) override;
@@ -109,7 +115,7 @@ private:
     FileRenderOptions mOptions;
     int mDraftScale;
     std::mutex mOpLock;
-    std::unique_ptr<VirtualFileSystemImpl_MCRAW> mFs;
+    std::shared_ptr<VirtualFileSystemImpl_MCRAW> mFs;
     std::map<GUID, std::unique_ptr<DirInfo>, GUIDComparer> mActiveEnumSessions;
 };
 
@@ -206,8 +212,20 @@ void Session::updateOptions(FileRenderOptions options, int draftScale) {
     }
 }
 
+void Session::warmUp(int64_t startFrame, int numFrames) {
+    mFs->warmUp(startFrame, numFrames);
+}
+
+int64_t Session::lastAccessedFrame() const {
+    return mFs->lastAccessedFrame();
+}
+
+std::shared_ptr<VirtualFileSystemImpl_MCRAW> Session::getFileSystem() const {
+    return mFs;
+}
+
 HRESULT Session::StartDirEnum(_In_ const PRJ_CALLBACK_DATA* CallbackData, _In_ const GUID* EnumerationId) {
-    spdlog::debug("StartDirEnum(): Path [{}] triggered by [{}]",
+    LOG_SAMPLED_DEBUG("StartDirEnum(): Path [{}] triggered by [{}]",
         toUTF8(CallbackData->FilePathName),
         toUTF8(CallbackData->TriggeringProcessImageFileName));
 
@@ -219,7 +237,7 @@ HRESULT Session::StartDirEnum(_In_ const PRJ_CALLBACK_DATA* CallbackData, _In_ c
 }
 
 HRESULT Session::EndDirEnum(_In_ const PRJ_CALLBACK_DATA* CallbackData, _In_ const GUID* EnumerationId) {
-    spdlog::debug("EndDirEnum()");
+    LOG_SAMPLED_DEBUG("EndDirEnum()");
 
     std::lock_guard<std::mutex> guard(mOpLock);
 
@@ -236,7 +254,7 @@ HRESULT Session::GetDirEnum(
     _In_ PRJ_DIR_ENTRY_BUFFER_HANDLE DirEntryBufferHandle)
 {
     // Then your log statement becomes:
-    spdlog::debug("GetDirEnum(): Path [{}] SearchExpression [{}]",
+    LOG_SAMPLED_DEBUG("GetDirEnum(): Path [{}] SearchExpression [{}]",
         toUTF8(CallbackData->FilePathName),
         toUTF8(SearchExpression));
 
@@ -251,7 +269,7 @@ HRESULT Session::GetDirEnum(
         // We were asked for an enumeration we don't know about.
         hr = E_INVALIDARG;
 
-        spdlog::debug("GetDirEnum(): return 0x{:08x}", static_cast<unsigned int>(hr));
+        LOG_SAMPLED_DEBUG("GetDirEnum(): return 0x{:08x}", static_cast<unsigned int>(hr));
 
         return hr;
     }
@@ -303,7 +321,7 @@ HRESULT Session::GetDirEnum(
 HRESULT Session::GetPlaceholderInfo(_In_ const PRJ_CALLBACK_DATA* CallbackData) {
     const auto filename = toUTF8(CallbackData->FilePathName);
 
-    spdlog::debug("GetPlaceholderInfo(): Path [{}] triggered by [{}]",
+    LOG_SAMPLED_DEBUG("GetPlaceholderInfo(): Path [{}] triggered by [{}]",
         filename,
         toUTF8(CallbackData->TriggeringProcessImageFileName));
 
@@ -335,12 +353,14 @@ HRESULT Session::GetPlaceholderInfo(_In_ const PRJ_CALLBACK_DATA* CallbackData)
 }
 
 HRESULT Session::GetFileData(_In_ const PRJ_CALLBACK_DATA* callbackData, _In_ UINT64 byteOffset, _In_ UINT32 length) {
-    spdlog::debug("GetFileData(): Path [{}] (byteOffset: {} and length: {}) triggered by [{}]",
+    LOG_SAMPLED_DEBUG("GetFileData(): Path [{}] (byteOffset: {} and length: {}) triggered by [{}]",
                   toUTF8(callbackData->FilePathName),
                   byteOffset,
                   length,
                   toUTF8(callbackData->TriggeringProcessImageFileName));
 
+    TraceSpan span("projfs.getFileData");
+
     HRESULT hr = S_OK;
 
     // Match file entry first
@@ -430,7 +450,7 @@ HRESULT Session::Notify(
     _In_opt_ PCWSTR DestinationFileName,
     _Inout_ PRJ_NOTIFICATION_PARAMETERS* NotificationParameters) {
 
-    spdlog::debug("{}: Path [{}] triggered by [{}] Notification: 0x{:08x}",
+    LOG_SAMPLED_DEBUG("{}: Path [{}] triggered by [{}] Notification: 0x{:08x}",
                  __FUNCTION__,
                  toUTF8(CallbackData->FilePathName),
                  toUTF8(CallbackData->TriggeringProcessImageFileName),
@@ -457,64 +477,41 @@ HRESULT Session::Notify(
     }
 }
 
-void setupLogging() {
-    try {
-        // Create a vector of sinks
-        std::vector<spdlog::sink_ptr> sinks;
-
-        // Regular console output
-        sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
-
-        // File sink
-        sinks.push_back(std::make_shared<spdlog::sinks::basic_file_sink_mt>("logs/logfile.txt", true));
-
-        // For Windows/Visual Studio debugger
-        sinks.push_back(std::make_shared<spdlog::sinks::msvc_sink_mt>());
-
-        // Create a logger with all sinks
-        auto logger = std::make_shared<spdlog::logger>("multi_sink", sinks.begin(), sinks.end());
-
-        // Set as default logger
-        spdlog::set_default_logger(logger);
+} // namespace
 
-        // Set log level
-#ifdef NDEBUG
-        spdlog::set_level(spdlog::level::info);
-#else
-        spdlog::set_level(spdlog::level::debug);
-#endif
+FuseFileSystemImpl_Win::FuseFileSystemImpl_Win(unsigned int ioThreads, unsigned int processingThreads) :
+    mNextMountId(0),
+    mIoThreadPool(std::make_unique<BS::thread_pool>(ioThreads > 0 ? ioThreads : IO_THREADS)),
+    mProcessingThreadPool(std::make_unique<BS::thread_pool>(processingThreads)),
+    mCache(std::make_unique<LRUCache>(DEFAULT_CACHE_SIZE)),
+    mCacheBudget(std::make_unique<CacheBudget>(*mCache, DEFAULT_CACHE_SIZE, false)),
+    mDecodedFrameCache(std::make_unique<DecodedFrameCache>(DECODED_FRAME_CACHE_SIZE)),
+    mRenderMemoryLimit(std::make_unique<RenderMemoryLimit>(DEFAULT_RENDER_MEMORY_LIMIT))
+{
+}
 
-        // Flush on info level messages
-        spdlog::flush_on(spdlog::level::info);
+FuseFileSystemImpl_Win::~FuseFileSystemImpl_Win() {
+    mMountedFiles.clear();
 
-    }
-    catch (const spdlog::spdlog_ex& ex) {
-        std::cerr << "Log initialization failed: " << ex.what() << std::endl;
-    }
-}
+    // Wait for tasks to complete before the caches they use are destroyed
+    mIoThreadPool->wait();
 
-} // namespace
+    mProcessingThreadPool->wait();
 
-FuseFileSystemImpl_Win::FuseFileSystemImpl_Win() :
-    mNextMountId(0),
-    mIoThreadPool(std::make_unique<BS::thread_pool>(IO_THREADS)),
-    mProcessingThreadPool(std::make_unique<BS::thread_pool>()),
-    mCache(std::make_unique<LRUCache>(CACHE_SIZE))
-{
-    setupLogging();
+    spdlog::info("Destroying FuseFileSystemImpl_Win()");
 }
 
 MountId FuseFileSystemImpl_Win::mount(FileRenderOptions options, int draftScale, const std::string& srcFile, const std::string& dstPath) {
     fs::path srcPath(srcFile);
     std::string extension = srcPath.extension().string();
 
-    spdlog::debug("Mounting file {} to {}", srcFile, dstPath);
+    SPDLOG_DEBUG("Mounting file {} to {}", srcFile, dstPath);
 
     if(boost::iequals(extension, ".mcraw")) {
         auto mountId = mNextMountId++;
 
         try {
-            auto fs = std::make_unique<VirtualFileSystemImpl_MCRAW>(*mIoThreadPool, *mProcessingThreadPool, *mCache, options, draftScale, srcFile);
+            auto fs = std::make_unique<VirtualFileSystemImpl_MCRAW>(*mIoThreadPool, *mProcessingThreadPool, *mCache, *mDecodedFrameCache, options, draftScale, srcFile, nullptr, mRenderMemoryLimit.get());
 
             mMountedFiles[mountId] = std::make_unique<Session>(dstPath, std::move(fs));
         }
@@ -532,6 +529,14 @@ MountId FuseFileSystemImpl_Win::mount(FileRenderOptions options, int draftScale,
     throw std::runtime_error("Invalid format");
 }
 
+MountId FuseFileSystemImpl_Win::mountLibrary(
+    FileRenderOptions options, int draftScale, const std::string& srcFolder, const std::string& dstPath)
+{
+    spdlog::error("Failed to mount {} to {}, library mounts are not supported", srcFolder, dstPath);
+
+    throw std::runtime_error("Library mounts are not supported on this platform, mount the files individually");
+}
+
 void FuseFileSystemImpl_Win::unmount(MountId mountId) {
     mMountedFiles.erase(mountId);
 }
@@ -545,4 +550,56 @@ void FuseFileSystemImpl_Win::updateOptions(MountId mountId, FileRenderOptions op
         options, draftScale);
 }
 
+void FuseFileSystemImpl_Win::warmCache(MountId mountId, int64_t startFrame, int numFrames) {
+    auto it = mMountedFiles.find(mountId);
+    if(it == mMountedFiles.end())
+        return;
+
+    dynamic_cast<Session*>(it->second.get())->warmUp(startFrame, numFrames);
+}
+
+int64_t FuseFileSystemImpl_Win::lastAccessedFrame(MountId mountId) {
+    auto it = mMountedFiles.find(mountId);
+    if(it == mMountedFiles.end())
+        return -1;
+
+    return dynamic_cast<Session*>(it->second.get())->lastAccessedFrame();
+}
+
+std::shared_ptr<IVirtualFileSystem> FuseFileSystemImpl_Win::getFileSystem(MountId mountId) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        return dynamic_cast<Session*>(it->second.get())->getFileSystem();
+    }
+
+    return nullptr;
+}
+
+std::shared_ptr<Metrics> FuseFileSystemImpl_Win::getMetrics(MountId mountId) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        auto fs = dynamic_cast<Session*>(it->second.get())->getFileSystem();
+        if(fs)
+            return fs->getMetrics();
+    }
+
+    return nullptr;
+}
+
+void FuseFileSystemImpl_Win::setCacheSize(size_t sizeBytes, bool adaptive) {
+    mCacheBudget->configure(sizeBytes, adaptive);
+}
+
+void FuseFileSystemImpl_Win::setCacheCompression(bool enabled) {
+    spdlog::info("Cache compression {}", enabled ? "enabled" : "disabled");
+
+    mCache->setCompressionEnabled(enabled);
+}
+
+void FuseFileSystemImpl_Win::setRenderMemoryLimit(size_t limitBytes) {
+    spdlog::info("Render memory limit {} MB", limitBytes / (1024 * 1024));
+
+    mRenderMemoryLimit->setLimit(limitBytes);
+}
+
 } // namespace motioncam
@@ -0,0 +1,142 @@
+#include "CameraFrameMetadata.h"
+#include "CameraMetadata.h"
+#include "IFrameSource.h"
+#include "SyntheticFrameSource.h"
+#include "Types.h"
+#include "Utils.h"
+
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+// parseForRender() skips the fields the renderer doesn't use, a frame rendered from its metadata
+// must come out the same as one rendered from the full parse. Returns non-zero on a mismatch.
+
+using json = nlohmann::json;
+
+namespace {
+    struct TestCase {
+        std::string name;
+        std::function<void(json&)> edit;   // Changes the metadata of a synthetic frame
+    };
+
+    std::vector<TestCase> testCases() {
+        std::vector<TestCase> cases;
+
+        for(auto orientation : {
+                motioncam::ScreenOrientation::PORTRAIT,
+                motioncam::ScreenOrientation::REVERSE_PORTRAIT,
+                motioncam::ScreenOrientation::LANDSCAPE,
+                motioncam::ScreenOrientation::REVERSE_LANDSCAPE,
+                motioncam::ScreenOrientation::INVALID })
+        {
+            cases.push_back({
+                "orientation " + std::to_string(static_cast<int>(orientation)),
+                [orientation](json& metadata) { metadata["orientation"] = static_cast<int>(orientation); } });
+        }
+
+        cases.push_back({ "no shading map", [](json& metadata) { metadata.erase("lensShadingMap"); } });
+        cases.push_back({ "empty shading map", [](json& metadata) { metadata["lensShadingMap"] = json::array(); } });
+
+        // Three channels, too few to apply
+        cases.push_back({ "missing shading map channel", [](json& metadata) {
+            metadata["lensShadingMap"].erase(metadata["lensShadingMap"].size() - 1); } });
+
+        // No longer a whole number of planes
+        cases.push_back({ "short shading map channel", [](json& metadata) {
+            metadata["lensShadingMap"].back().erase(metadata["lensShadingMap"].back().size() - 1); } });
+
+        cases.push_back({ "shading map size mismatch", [](json& metadata) {
+            metadata["lensShadingMapWidth"] = metadata["lensShadingMapWidth"].get<int>() + 1; } });
+
+        cases.push_back({ "portrait without shading map", [](json& metadata) {
+            metadata["orientation"] = static_cast<int>(motioncam::ScreenOrientation::PORTRAIT);
+            metadata.erase("lensShadingMap"); } });
+
+        return cases;
+    }
+
+    // Empty if the frames match, otherwise what differs
+    std::string compare(
+        const std::vector<uint8_t>& data,
+        const json& metadata,
+        const motioncam::utils::RenderConfig& config)
+    {
+        const auto fullMetadata = motioncam::CameraFrameMetadata::parse(metadata);
+        const auto renderMetadata = motioncam::CameraFrameMetadata::parseForRender(metadata);
+
+        if(fullMetadata.orientation != renderMetadata.orientation)
+            return "orientation differs";
+
+        // Both intern the same gains, so they share a map or have none
+        if(fullMetadata.lensShadingMap != renderMetadata.lensShadingMap)
+            return "shading map differs";
+
+        const std::vector<motioncam::FileRenderOptions> renderOptions = {
+            motioncam::RENDER_OPT_NONE,
+            motioncam::RENDER_OPT_APPLY_VIGNETTE_CORRECTION | motioncam::RENDER_OPT_NORMALIZE_SHADING_MAP
+        };
+
+        for(auto renderOption : renderOptions) {
+            for(int scale : { 1, 2 }) {
+                auto expected = motioncam::utils::generateDng(data, fullMetadata, config, 30.0f, 0, renderOption, scale);
+                auto actual = motioncam::utils::generateDng(data, renderMetadata, config, 30.0f, 0, renderOption, scale);
+
+                if(!expected || !actual || *expected != *actual)
+                    return "frames differ (options: " + std::to_string(renderOption) + ", scale: " + std::to_string(scale) + ")";
+            }
+        }
+
+        return {};
+    }
+}
+
+int main() {
+    motioncam::SyntheticClipOptions clip;
+
+    clip.name = "parseForRender";
+    clip.width = 256;
+    clip.height = 192;
+    clip.numFrames = 1;
+    clip.audioChannels = 0;
+
+    int failed = 0;
+
+    try {
+        auto source = motioncam::openFrameSource(clip.toPath());
+        auto config = motioncam::utils::makeRenderConfig(
+            std::make_shared<const motioncam::CameraConfiguration>(
+                motioncam::CameraConfiguration::parse(source->getContainerMetadata())));
+
+        json frameMetadata;
+        std::vector<uint8_t> data;
+
+        source->loadFrame(source->getFrames().front(), data, frameMetadata);
+
+        for(const auto& testCase : testCases()) {
+            auto metadata = frameMetadata;
+
+            testCase.edit(metadata);
+
+            const auto error = compare(data, metadata, *config);
+
+            if(error.empty()) {
+                std::cout << "PASS " << testCase.name << std::endl;
+            }
+            else {
+                std::cout << "FAIL " << testCase.name << ": " << error << std::endl;
+                ++failed;
+            }
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return failed == 0 ? 0 : 1;
+}